@@ -51,8 +51,8 @@ lm.comp.load_plugin(os.path.join(env.bin_path, 'accel_embree'))
 
 # + {"code_folding": [0]}
 # Function to build and render the image
-def build_and_render(scene, accel_name):
-    accel = lm.load_accel('accel', accel_name)
+def build_and_render(scene, accel_name, **accel_prop):
+    accel = lm.load_accel('accel', accel_name, **accel_prop)
     scene.set_accel(accel.loc())
     scene.build()
     film = lm.load_film('film_output', 'bitmap', w=1920, h=1080)
@@ -63,7 +63,17 @@ def build_and_render(scene, accel_name):
 
 # + {"code_folding": []}
 # Accels and scenes
-accel_names = ['nanort', 'embree', 'embreeinstanced']
+# name -> (accel type, properties)
+accels = {
+    'sahbvh_binned': ('sahbvh', {'build_mode': 'binned'}),
+    'sahbvhinstanced': ('sahbvhinstanced', {}),
+    'wbvh4': ('wbvh', {'width': 4}),
+    'wbvh8': ('wbvh', {'width': 8}),
+    'nanort': ('nanort', {}),
+    'embree': ('embree', {}),
+    'embreeinstanced': ('embreeinstanced', {})
+}
+accel_names = list(accels.keys())
 scene_names = lmscene.scenes_small()
 
 
@@ -92,7 +102,8 @@ for scene_name in scene_names:
     # Check consistency for other accels
     for accel_name in accel_names:
         # Render and compute a different image
-        img = build_and_render(scene, accel_name)
+        accel_type, accel_prop = accels[accel_name]
+        img = build_and_render(scene, accel_type, **accel_prop)
         diff = rmse_pixelwised(ref, img)
         
         # Record rmse
@@ -114,3 +125,43 @@ for scene_name in scene_names:
 # Correct if the values are near zero.
 
 rmse_df
+
+# ### Stream intersection
+#
+# Correct if the numbers of mismatches are zero. We compare the hits computed by `intersect_stream` with the hits computed by `intersect` for each ray.
+
+# + {"code_folding": [0]}
+# Function to count mismatches between stream and per-ray intersection
+def count_stream_mismatches(scene, accel_name, num_rays=10000, **accel_prop):
+    accel = lm.load_accel('accel', accel_name, **accel_prop)
+    scene.set_accel(accel.loc())
+    scene.build()
+    rng = np.random.RandomState(1)
+    o = rng.uniform(-1, 1, (num_rays, 3))
+    d = rng.normal(size=(num_rays, 3))
+    d /= np.linalg.norm(d, axis=1)[:,None]
+    tmin = np.full(num_rays, lm.Eps)
+    tmax = np.full(num_rays, lm.Inf)
+    t, uv, primitive, face = accel.intersect_stream(o, d, tmin, tmax)
+    mismatches = 0
+    for i in range(num_rays):
+        hit = accel.intersect(lm.Ray(o[i], d[i]), tmin[i], tmax[i])
+        if hit is None:
+            mismatches += primitive[i] >= 0
+        else:
+            mismatches += hit.primitive != primitive[i] or hit.face != face[i]
+    return mismatches
+
+
+# -
+
+stream_df = pd.DataFrame(columns=['sahbvh'] + accel_names, index=scene_names)
+for scene_name in scene_names:
+    scene = lm.load_scene('scene', 'default')
+    lmscene.load(scene, env.scene_path, scene_name)
+    stream_df['sahbvh'][scene_name] = count_stream_mismatches(scene, 'sahbvh')
+    for accel_name in accel_names:
+        accel_type, accel_prop = accels[accel_name]
+        stream_df[accel_name][scene_name] = count_stream_mismatches(scene, accel_type, **accel_prop)
+
+stream_df
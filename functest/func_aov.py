@@ -0,0 +1,125 @@
+# ---
+# jupyter:
+#   jupytext:
+#     formats: ipynb,py:light
+#     text_representation:
+#       extension: .py
+#       format_name: light
+#       format_version: '1.5'
+#       jupytext_version: 1.3.3
+#   kernelspec:
+#     display_name: Python 3
+#     language: python
+#     name: python3
+# ---
+
+# ## Auxiliary outputs
+#
+# This test renders the auxiliary outputs (AOVs) in the same pass as the rendering with `renderer::pt`.
+# The normal buffer should match the output of `renderer::raycast` with `visualize_normal` up to the sign,
+# except around the edges where the samples of the pixel hit different surfaces.
+
+import lmenv
+env = lmenv.load('.lmenv')
+
+import os
+import numpy as np
+# %matplotlib inline
+import matplotlib.pyplot as plt
+import lightmetrica as lm
+# %load_ext lightmetrica_jupyter
+import lmscene
+
+if not lm.Release:
+    lm.attach_to_debugger()
+
+lm.init()
+if not lm.Release:
+    lm.parallel.init('openmp', num_threads=1)
+lm.log.init('jupyter')
+lm.progress.init('jupyter')
+lm.info()
+
+if not lm.Release:
+    lm.comp.load_plugin(os.path.join(env.bin_path, 'accel_embree'))
+
+accel = lm.load_accel('accel', 'embree')
+scene = lm.load_scene('scene', 'default', accel=accel)
+lmscene.cornell_box_sphere(scene, env.scene_path)
+scene.build()
+
+w, h = 854, 480
+film = lm.load_film('film_output', 'bitmap', w=w, h=h)
+aov_names = ['albedo', 'normal', 'depth', 'primitive_id', 'sample_count']
+aov_films = {name: lm.load_film('film_' + name, 'bitmap', w=w, h=h) for name in aov_names}
+
+def display_image(img, fig_size=15, tonemap=True):
+    f = plt.figure(figsize=(fig_size,fig_size))
+    ax = f.add_subplot(111)
+    ax.imshow(np.clip(np.power(img,1/2.2),0,1) if tonemap else img, origin='lower')
+    ax.axis('off')
+    plt.show()
+
+# ### Rendering with AOVs
+
+renderer = lm.load_renderer('renderer', 'pt',
+    scene=scene,
+    output=film,
+    max_verts=10,
+    scheduler='sample',
+    spp=16,
+    aovs={name: f.loc() for name, f in aov_films.items()})
+renderer.render()
+display_image(np.copy(film.buffer()))
+
+aovs = {name: np.copy(f.buffer()) for name, f in aov_films.items()}
+display_image(aovs['albedo'])
+display_image(np.abs(aovs['normal']), tonemap=False)
+display_image(aovs['depth'] / np.max(aovs['depth']), tonemap=False)
+display_image(aovs['primitive_id'] / np.max(aovs['primitive_id']), tonemap=False)
+print(np.unique(aovs['sample_count']))
+
+# ### Comparison with raycast
+
+film_raycast = lm.load_film('film_raycast', 'bitmap', w=w, h=h)
+renderer = lm.load_renderer('renderer_raycast', 'raycast',
+    scene=scene,
+    output=film_raycast,
+    visualize_normal=True)
+renderer.render()
+ref = np.copy(film_raycast.buffer())
+diff = np.abs(np.abs(aovs['normal']) - ref)
+print(np.median(diff))
+display_image(diff, tonemap=False)
+
+# ### Denoising with AOVs
+#
+# `renderer::denoise_atrous` filters the rendered image guided by the AOVs.
+# The error of the denoised image against a reference should be smaller than the input.
+
+film_ref = lm.load_film('film_ref', 'bitmap', w=w, h=h)
+renderer = lm.load_renderer('renderer_ref', 'pt',
+    scene=scene,
+    output=film_ref,
+    max_verts=10,
+    scheduler='sample',
+    spp=1024)
+renderer.render()
+ref = np.copy(film_ref.buffer())
+
+film_denoised = lm.load_film('film_denoised', 'bitmap', w=w, h=h)
+denoiser = lm.load_renderer('denoiser', 'denoise_atrous',
+    input=film,
+    output=film_denoised,
+    albedo=aov_films['albedo'],
+    normal=aov_films['normal'],
+    depth=aov_films['depth'])
+denoiser.render()
+denoised = np.copy(film_denoised.buffer())
+display_image(denoised)
+
+def rmse(img1, img2):
+    return np.sqrt(np.mean((img1 - img2) ** 2))
+
+print('input: rmse={}'.format(rmse(np.copy(film.buffer()), ref)))
+print('denoised: rmse={}'.format(rmse(denoised, ref)))
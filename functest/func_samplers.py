@@ -0,0 +1,93 @@
+# ---
+# jupyter:
+#   jupytext:
+#     formats: ipynb,py:light
+#     text_representation:
+#       extension: .py
+#       format_name: light
+#       format_version: '1.5'
+#       jupytext_version: 1.3.3
+#   kernelspec:
+#     display_name: Python 3
+#     language: python
+#     name: python3
+# ---
+
+# ## Samplers
+#
+# This test compares the convergence of the samplers at equal number of samples per pixel.
+# The images rendered with the low-discrepancy samplers should have less noise than the independent sampler.
+
+import lmenv
+env = lmenv.load('.lmenv')
+
+import os
+import numpy as np
+# %matplotlib inline
+import matplotlib.pyplot as plt
+import lightmetrica as lm
+# %load_ext lightmetrica_jupyter
+import lmscene
+
+if not lm.Release:
+    lm.attach_to_debugger()
+
+lm.init()
+if not lm.Release:
+    lm.parallel.init('openmp', num_threads=1)
+lm.log.init('jupyter')
+lm.progress.init('jupyter')
+lm.info()
+
+if not lm.Release:
+    lm.comp.load_plugin(os.path.join(env.bin_path, 'accel_embree'))
+
+accel = lm.load_accel('accel', 'embree')
+scene = lm.load_scene('scene', 'default', accel=accel)
+lmscene.cornell_box_sphere(scene, env.scene_path)
+scene.build()
+film = lm.load_film('film_output', 'bitmap', w=854, h=480)
+
+def render(spp, **kwargs):
+    renderer = lm.load_renderer('renderer', 'pt',
+        scene=scene,
+        output=film,
+        max_verts=10,
+        scheduler='sample',
+        spp=spp,
+        seed=42,
+        **kwargs)
+    renderer.render()
+    return np.copy(film.buffer())
+
+def display_image(img, fig_size=15):
+    f = plt.figure(figsize=(fig_size,fig_size))
+    ax = f.add_subplot(111)
+    ax.imshow(np.clip(np.power(img,1/2.2),0,1), origin='lower')
+    ax.axis('off')
+    plt.show()
+
+def rmse(img1, img2):
+    return np.sqrt(np.mean((img1 - img2) ** 2))
+
+# ### Reference
+
+ref = render(1024, sampler='sobol')
+display_image(ref)
+
+# ### Comparison at equal spp
+
+for spp in [4, 16, 64]:
+    for sampler in ['independent', 'stratified', 'sobol']:
+        img = render(spp, sampler=sampler)
+        print('spp={}, sampler={}, rmse={}'.format(spp, sampler, rmse(img, ref)))
+    display_image(img)
+
+# ### Reproducibility
+#
+# The result with a fixed seed is independent of the number of threads.
+
+img1 = render(4, sampler='sobol')
+lm.parallel.init('openmp', num_threads=1)
+img2 = render(4, sampler='sobol')
+print(np.max(np.abs(img1 - img2)))
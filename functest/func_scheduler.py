@@ -82,6 +82,98 @@ ax = f.add_subplot(111)
 ax.imshow(np.clip(np.power(img2,1/2.2),0,1), origin='lower')
 plt.show()
 
+# ### w/ time-based scheduler with hard deadline
+
+renderer = lm.load_renderer('renderer', 'pt',
+    **shared_renderer_params,
+    scheduler='time',
+    render_time=5,
+    hard_deadline=True)
+renderer.render()
+
+img5 = np.copy(film.buffer())
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(img5,1/2.2),0,1), origin='lower')
+plt.show()
+
+# ### w/ tile-based scheduler
+
+renderer = lm.load_renderer('renderer', 'pt',
+    **shared_renderer_params,
+    scheduler='tile',
+    spp=1,
+    tile_size=32,
+    tile_order='hilbert')
+renderer.render()
+
+img3 = np.copy(film.buffer())
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(img3,1/2.2),0,1), origin='lower')
+plt.show()
+
+# ### w/ adaptive scheduler
+
+renderer = lm.load_renderer('renderer', 'pt',
+    **shared_renderer_params,
+    scheduler='adaptive',
+    spp_min=16,
+    spp_max=256,
+    max_error=0.05)
+renderer.render()
+
+img4 = np.copy(film.buffer())
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(img4,1/2.2),0,1), origin='lower')
+plt.show()
+
+# ### w/ progressive accumulation
+#
+# Four renderings with a quarter of the samples accumulated progressively
+# should converge to the same image as the single rendering.
+
+renderer = lm.load_renderer('renderer', 'pt',
+    **shared_renderer_params,
+    scheduler='sample',
+    spp=1,
+    num_samples=2500000,
+    progressive=True)
+for i in range(4):
+    print(renderer.render())
+
+img6 = np.copy(film.buffer())
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(img6,1/2.2),0,1), origin='lower')
+plt.show()
+
+# `reset()` discards the accumulated samples,
+# so the next rendering starts from the cleared film.
+
+renderer.reset()
+print(renderer.render())
+assert renderer.render()['total_processed'] == 2
+
+# The accumulation also works with the schedulers taking varying number of samples per pixel.
+
+renderer = lm.load_renderer('renderer', 'pt',
+    **shared_renderer_params,
+    scheduler='adaptive',
+    spp_min=16,
+    spp_max=128,
+    max_error=0.05,
+    progressive=True)
+for i in range(2):
+    print(renderer.render())
+
+img7 = np.copy(film.buffer())
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(img7,1/2.2),0,1), origin='lower')
+plt.show()
+
 # ### Diff
 
 from scipy.ndimage import gaussian_filter
@@ -90,3 +182,33 @@ f = plt.figure(figsize=(15,15))
 ax = f.add_subplot(111)
 ax.imshow(np.clip(np.power(diff_gauss,1/2.2),0,1), origin='lower')
 plt.show()
+
+diff_gauss = np.abs(gaussian_filter(img1 - img3, sigma=3))
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(diff_gauss,1/2.2),0,1), origin='lower')
+plt.show()
+
+diff_gauss = np.abs(gaussian_filter(img1 - img4, sigma=3))
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(diff_gauss,1/2.2),0,1), origin='lower')
+plt.show()
+
+diff_gauss = np.abs(gaussian_filter(img2 - img5, sigma=3))
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(diff_gauss,1/2.2),0,1), origin='lower')
+plt.show()
+
+diff_gauss = np.abs(gaussian_filter(img1 - img6, sigma=3))
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(diff_gauss,1/2.2),0,1), origin='lower')
+plt.show()
+
+diff_gauss = np.abs(gaussian_filter(img4 - img7, sigma=3))
+f = plt.figure(figsize=(15,15))
+ax = f.add_subplot(111)
+ax.imshow(np.clip(np.power(diff_gauss,1/2.2),0,1), origin='lower')
+plt.show()
@@ -41,12 +41,18 @@ lm.info()
 lm.comp.load_plugin(os.path.join(env.bin_path, 'accel_nanort'))
 lm.comp.load_plugin(os.path.join(env.bin_path, 'accel_embree'))
 
-accel_names = [
-    'sahbvh',
-    'nanort',
-    'embree',
-    'embreeinstanced'
-]
+# Accel configurations: name -> (accel type, properties)
+accels = {
+    'sahbvh': ('sahbvh', {}),
+    'sahbvh_binned': ('sahbvh', {'build_mode': 'binned'}),
+    'sahbvhinstanced': ('sahbvhinstanced', {}),
+    'wbvh4': ('wbvh', {'width': 4}),
+    'wbvh8': ('wbvh', {'width': 8}),
+    'nanort': ('nanort', {}),
+    'embree': ('embree', {}),
+    'embreeinstanced': ('embreeinstanced', {})
+}
+accel_names = list(accels.keys())
 scene_names = lmscene.scenes_small()
 
 # +
@@ -68,7 +74,8 @@ for scene_name in scene_names:
     })
         
     for accel_name in accel_names:
-        accel = lm.load_accel('accel', accel_name, {})
+        accel_type, accel_prop = accels[accel_name]
+        accel = lm.load_accel('accel', accel_type, accel_prop)
         scene.set_accel(accel.loc())
         def build():
             scene.build()
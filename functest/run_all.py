@@ -38,6 +38,8 @@ def run_functests(output_dir, lmenv_path):
         'func_serial_consistency',
         'func_update_asset',
         'func_scheduler',
+        'func_samplers',
+        'func_aov',
         'func_materials',
         'func_lights',
         'func_renderers',
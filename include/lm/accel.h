@@ -6,6 +6,7 @@
 #pragma once
 
 #include "core.h"
+#include "mappedfile.h"
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE)
 
@@ -37,6 +38,61 @@ public:
     */
     virtual void build(const Scene& scene) = 0;
 
+    /*!
+        \brief Refit acceleration structure.
+        \param scene Input scene.
+        \return False if refitting is not supported.
+
+        \rst
+        Updates the acceleration structure built by :cpp:func:`Accel::build`
+        for the scene where only the transformations of the primitives are changed.
+        The topology of the structure is kept and only the bounds are updated,
+        so the quality of the structure can degrade if the transformations change drastically.
+        If the function returns false, the caller must rebuild the structure.
+        The default implementation does nothing and returns false.
+        \endrst
+    */
+    virtual bool refit(const Scene& scene) {
+        LM_UNUSED(scene);
+        return false;
+    }
+
+    /*!
+        \brief Save the built structure to a cache.
+        \param os Output stream.
+        \return False if the acceleration structure does not support caching.
+
+        \rst
+        Writes the built structure in the form loadable with :cpp:func:`Accel::load_cache`.
+        The data should contain the parameters of the structure affecting the build
+        so that the cache built with different parameters can be rejected.
+        The default implementation does nothing and returns false.
+        \endrst
+    */
+    virtual bool save_cache(std::ostream& os) const {
+        LM_UNUSED(os);
+        return false;
+    }
+
+    /*!
+        \brief Load the built structure from a cache.
+        \param file Memory-mapped cache file.
+        \return False if the cache cannot be used.
+
+        \rst
+        Restores the structure saved by :cpp:func:`Accel::save_cache`.
+        The implementation should use the mapped data in place without parsing or copying.
+        In this case the accel keeps the reference to ``file``
+        so that the mapping outlives the structure referring to it.
+        If the function returns false, the structure is built with :cpp:func:`Accel::build`.
+        The default implementation does nothing and returns false.
+        \endrst
+    */
+    virtual bool load_cache(const std::shared_ptr<MappedFile>& file) {
+        LM_UNUSED(file);
+        return false;
+    }
+
     /*!
         \brief Hit result.
 
@@ -68,6 +124,46 @@ public:
         \endrst
     */
     virtual std::optional<Hit> intersect(Ray ray, Float tmin, Float tmax) const = 0;
+
+    /*!
+        \brief Compute closest intersection points for a stream of rays.
+        \param rays Stream of rays.
+        \param hits Output array of hits. Must contain at least ``rays.n`` elements.
+
+        \rst
+        Computes closest intersection points for all rays in the stream,
+        which is equivalent to calling :cpp:func:`Accel::intersect` for each ray.
+        ``hits[i]`` is filled with the result for ``i``-th ray.
+        If no intersection is found, the primitive index of the hit is set to ``-1``.
+        Implementations can amortize the traversal cost over the rays in the stream.
+        The default implementation calls :cpp:func:`Accel::intersect` for each ray.
+        \endrst
+    */
+    virtual void intersect_stream(const RayStream& rays, Hit* hits) const {
+        for (int i = 0; i < rays.n; i++) {
+            const auto hit = intersect(rays.ray(i), rays.tmin[i], rays.tmax[i]);
+            hits[i] = hit ? *hit : Hit{ Inf, Vec2(0_f), Transform(), -1, -1 };
+        }
+    }
+
+    /*!
+        \brief Check if any intersection exists.
+        \param ray Ray.
+        \param tmin Lower valid range of the ray.
+        \param tmax Higher valid range of the ray.
+
+        \rst
+        Returns true if the ray segment specified by ``ray`` and the range ``[tmin, tmax]``
+        intersects with any primitive.
+        Unlike :cpp:func:`Accel::intersect`, the implementation can terminate
+        the traversal as soon as an intersection is found.
+        This function is useful for shadow rays.
+        The default implementation falls back to :cpp:func:`Accel::intersect`.
+        \endrst
+    */
+    virtual bool occluded(Ray ray, Float tmin, Float tmax) const {
+        return bool(intersect(ray, tmin, tmax));
+    }
 };
 
 /*!
@@ -0,0 +1,272 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#pragma once
+
+#include "component.h"
+#include "film.h"
+#include "path.h"
+#include "parallel.h"
+#include "json.h"
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+LM_NAMESPACE_BEGIN(aov)
+
+/*!
+    \addtogroup aov
+    @{
+*/
+
+/*!
+    \brief Type of auxiliary output.
+*/
+enum class Type {
+    Albedo,         //!< Reflectance of the primary hit.
+    Normal,         //!< Shading normal of the primary hit in world coordinates.
+    Depth,          //!< Distance from the camera to the primary hit.
+    PrimitiveID,    //!< Index of the primitive node of the primary hit.
+    SampleCount,    //!< Number of samples of the pixel.
+};
+
+/*!
+    \brief Auxiliary outputs of a renderer.
+
+    \rst
+    The auxiliary outputs (AOVs) are the images of the quantities of the primary hits,
+    written by the renderer in the same pass as the rendering.
+    The outputs are specified by ``aovs`` property of the renderer,
+    which maps the names of the outputs to the locators of the film assets:
+
+    .. code-block:: json
+
+       "aovs": { "albedo": "$.assets.film_albedo", "normal": "$.assets.film_normal" }
+
+    The available names are ``albedo``, ``normal``, ``depth``, ``primitive_id``, and ``sample_count``.
+    The films must have the same size as the output film of the renderer.
+    ``albedo``, ``normal``, and ``depth`` are averaged over the samples of the pixel.
+    These are zero if the primary ray misses the scene or hits the environment.
+    ``primitive_id`` is the index of the primitive node of one of the samples of the pixel,
+    or ``-1`` if missed.
+    ``sample_count`` is the number of the samples recorded to the pixel.
+
+    Renderers call :cpp:func:`Outputs::clear` at the beginning of the rendering,
+    :cpp:func:`Outputs::add` for each sample, and :cpp:func:`Outputs::finalize` at the end.
+    In progressive mode, the renderers keep the outputs of the previous renderings
+    by :cpp:func:`Outputs::clear` with ``accumulate=true``
+    so that the outputs are averaged over all the samples accumulated in the output film.
+    The films of the outputs should use the default accumulation mode
+    because ``primitive_id`` is written with :cpp:func:`lm::Film::set_pixel` during the rendering.
+    \endrst
+*/
+class Outputs {
+private:
+    struct Output {
+        Type type;
+        Film* film;
+
+        template <typename Archive>
+        void serialize(Archive& ar) {
+            ar(type, film);
+        }
+    };
+    std::vector<Output> outputs_;
+    mutable std::unique_ptr<std::atomic<long long>[]> counts_;  // Number of samples per pixel
+    mutable long long num_counts_ = 0;                          // Number of elements of counts_
+
+public:
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(outputs_);
+    }
+
+    /*!
+        \brief Configure the outputs from ``aovs`` property.
+        \param prop Property of the renderer.
+    */
+    void construct(const Json& prop) {
+        outputs_.clear();
+        const auto it = prop.find("aovs");
+        if (it == prop.end()) {
+            return;
+        }
+        for (const auto& item : it->items()) {
+            const auto& name = item.key();
+            Type type{};
+            if (name == "albedo")            type = Type::Albedo;
+            else if (name == "normal")       type = Type::Normal;
+            else if (name == "depth")        type = Type::Depth;
+            else if (name == "primitive_id") type = Type::PrimitiveID;
+            else if (name == "sample_count") type = Type::SampleCount;
+            else {
+                LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid AOV name [name='{}']", name);
+            }
+            outputs_.push_back({ type, json::comp_ref<Film>(*it, name) });
+        }
+    }
+
+    /*!
+        \brief Visit the films of the outputs.
+        \param visit Component visitor.
+    */
+    void foreach_underlying(const Component::ComponentVisitor& visit) {
+        for (auto& o : outputs_) {
+            comp::visit(visit, o.film);
+        }
+    }
+
+    /*!
+        \brief Check if no output is specified.
+    */
+    bool empty() const {
+        return outputs_.empty();
+    }
+
+    /*!
+        \brief Clear the outputs.
+        \param film Output film of the renderer.
+        \param accumulate True to keep the outputs of the previous renderings.
+
+        \rst
+        If ``accumulate`` is true, the averaged outputs finalized by the previous rendering
+        are turned back to the sums so that the samples of the next rendering are added to them.
+        The outputs are cleared if there is no previous rendering of the same size.
+        \endrst
+    */
+    void clear(const Film* film, bool accumulate = false) const {
+        if (empty()) {
+            return;
+        }
+        const int w = film->size().w;
+        const int h = film->size().h;
+        for (const auto& o : outputs_) {
+            const auto size = o.film->size();
+            if (size.w != w || size.h != h) {
+                LM_THROW_EXCEPTION(Error::InvalidArgument,
+                    "AOV film size is different [expected='({},{})', actual='({},{})']", w, h, size.w, size.h);
+            }
+        }
+        if (accumulate && counts_ && num_counts_ == film->num_pixels()) {
+            for (const auto& o : outputs_) {
+                if (o.type == Type::PrimitiveID || o.type == Type::SampleCount) {
+                    continue;
+                }
+                o.film->flush();
+                parallel::foreach(num_counts_, [&](long long i, int) {
+                    const auto count = counts_[i].load();
+                    if (count > 0) {
+                        o.film->update_pixel(int(i % w), int(i / w), [&](Vec3 curr) -> Vec3 {
+                            return curr * Float(count);
+                        });
+                    }
+                });
+            }
+            return;
+        }
+        for (const auto& o : outputs_) {
+            o.film->clear();
+            if (o.type == Type::PrimitiveID) {
+                parallel::foreach(film->num_pixels(), [&](long long i, int) {
+                    o.film->set_pixel(int(i % w), int(i / w), Vec3(-1_f));
+                });
+            }
+        }
+        num_counts_ = film->num_pixels();
+        counts_ = std::make_unique<std::atomic<long long>[]>(num_counts_);
+    }
+
+    /*!
+        \brief Record the primary hit of a sample.
+        \param scene Scene.
+        \param raster_pos Raster position of the primary ray.
+        \param origin Origin of the primary ray.
+        \param hit Primary hit. ``std::nullopt`` if the ray misses the scene.
+    */
+    void add(const Scene* scene, Vec2 raster_pos, Vec3 origin, const std::optional<SceneInteraction>& hit) const {
+        if (empty()) {
+            return;
+        }
+        const auto p = outputs_.front().film->raster_to_pixel(raster_pos);
+        const int x = p.x;
+        const int y = p.y;
+        const auto w = outputs_.front().film->size().w;
+        counts_[y*w + x]++;
+        if (!hit) {
+            return;
+        }
+        const bool on_surface = !hit->geom.infinite && hit->is_type(SceneInteraction::SurfaceInteraction);
+        for (const auto& o : outputs_) {
+            switch (o.type) {
+                case Type::Albedo: {
+                    if (on_surface) {
+                        if (const auto R = path::reflectance(scene, *hit)) {
+                            o.film->splat_pixel(x, y, *R);
+                        }
+                    }
+                    break;
+                }
+                case Type::Normal: {
+                    if (!hit->geom.infinite) {
+                        o.film->splat_pixel(x, y, hit->geom.n);
+                    }
+                    break;
+                }
+                case Type::Depth: {
+                    if (!hit->geom.infinite) {
+                        o.film->splat_pixel(x, y, Vec3(glm::distance(origin, hit->geom.p)));
+                    }
+                    break;
+                }
+                case Type::PrimitiveID: {
+                    o.film->set_pixel(x, y, Vec3(Float(hit->primitive)));
+                    break;
+                }
+                case Type::SampleCount: {
+                    break;
+                }
+            }
+        }
+    }
+
+    /*!
+        \brief Finalize the outputs.
+
+        \rst
+        This function averages the accumulated values by the number of samples of the pixels.
+        \endrst
+    */
+    void finalize() const {
+        if (empty()) {
+            return;
+        }
+        const auto w = outputs_.front().film->size().w;
+        const auto n = outputs_.front().film->num_pixels();
+        for (const auto& o : outputs_) {
+            if (o.type == Type::PrimitiveID) {
+                continue;
+            }
+            o.film->flush();
+            parallel::foreach(n, [&](long long i, int) {
+                const auto count = counts_[i].load();
+                const int x = int(i % w);
+                const int y = int(i / w);
+                if (o.type == Type::SampleCount) {
+                    o.film->set_pixel(x, y, Vec3(Float(count)));
+                }
+                else if (count > 0) {
+                    o.film->update_pixel(x, y, [&](Vec3 curr) -> Vec3 {
+                        return curr / Float(count);
+                    });
+                }
+            });
+        }
+    }
+};
+
+/*!
+    @}
+*/
+
+LM_NAMESPACE_END(aov)
+LM_NAMESPACE_END(LM_NAMESPACE)
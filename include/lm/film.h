@@ -7,6 +7,7 @@
 
 #include "component.h"
 #include "math.h"
+#include <future>
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE)
 
@@ -43,6 +44,23 @@ struct FilmBuffer {
     Float* data;    //!< Data.
 };
 
+/*!
+    \brief Film snapshot.
+
+    \rst
+    The structure represents a snapshot of a film
+    used as a return type of :cpp:func:`lm::Film::snapshot` function.
+    The data is the array of RGB values in single precision,
+    stored in the same order as :cpp:func:`lm::Film::buffer`.
+    \endrst
+*/
+struct FilmSnapshot {
+    int w;              //!< Width of the snapshot.
+    int h;              //!< Height of the snapshot.
+    const float* data;  //!< Data.
+    long long version;  //!< Version of the snapshot incremented for each snapshot.
+};
+
 /*!
     \brief Film.
 
@@ -78,6 +96,19 @@ public:
     */
     virtual void set_pixel(int x, int y, Vec3 v) = 0;
 
+    /*!
+        \brief Get pixel value.
+        \param x x coordinate of the film.
+        \param y y coordinate of the film.
+        \return Pixel color.
+
+        \rst
+        This function returns the current pixel color of the pixel coordinates ``(x,y)``.
+        This function is thread-safe.
+        \endrst
+    */
+    virtual Vec3 get_pixel(int x, int y) const = 0;
+
     /*!
         \brief Save rendered film.
         \param outpath Output image path.
@@ -90,6 +121,23 @@ public:
     */
     virtual bool save(const std::string& outpath) const = 0;
 
+    /*!
+        \brief Save rendered film asynchronously.
+        \param outpath Output image path.
+        \return Handle to wait for the completion. The value is the result of the save.
+
+        \rst
+        This function saves the film in the same way as :cpp:func:`lm::Film::save`,
+        except that the encoding of the image runs in a background thread.
+        The function returns as soon as the state of the film to be saved is fixed,
+        so that the rendering can continue during the encoding,
+        e.g., for the periodic checkpoints of a progressive rendering.
+        What is fixed before the function returns is implementation-dependent.
+        The film waits for the pending saves when it is deleted.
+        \endrst
+    */
+    virtual std::shared_future<bool> save_async(const std::string& outpath) = 0;
+
     /*!
         \brief Get buffer of the film
         \return Film buffer.
@@ -102,6 +150,25 @@ public:
     */
     virtual FilmBuffer buffer() = 0;
 
+    /*!
+        \brief Take a snapshot of the film.
+        \return Film snapshot.
+
+        \rst
+        The function returns the current state of the film
+        as a float RGB image in the internally allocated buffer.
+        Unlike :cpp:func:`lm::Film::buffer`, the function can be called
+        while the rendering is in progress without blocking the splatting threads,
+        e.g., for the preview of the rendering.
+        The values written while the snapshot is taken may or may not be included,
+        and the films buffering the splats include the buffered values.
+        The returned data stays valid until the second next call of the function,
+        so that the reader can keep the previous snapshot while taking the next one.
+        The buffer is reused and no allocation happens after the first two calls.
+        \endrst
+    */
+    virtual FilmSnapshot snapshot() = 0;
+
     /*!
         \brief Accumulate another film.
         \param film Another film.
@@ -142,6 +209,21 @@ public:
     */
     virtual void clear() = 0;
 
+    /*!
+        \brief Merge the pending values.
+
+        \rst
+        Some films buffer the splats and merge them lazily when the film is accessed,
+        e.g., ``film::bitmap`` with the per-thread accumulation.
+        This function merges the pending values explicitly,
+        e.g., before updating the pixels in a parallel loop
+        so that the update of each pixel does not need to merge them.
+        The function must not be called while the other threads are splatting.
+        The default implementation does nothing.
+        \endrst
+    */
+    virtual void flush() {}
+
 public:
     /*!
         \brief Get aspect ratio.
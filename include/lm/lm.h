@@ -17,7 +17,9 @@
 #include "progresscontext.h"
 #include "exception.h"
 #include "scheduler.h"
+#include "sampler.h"
 #include "debug.h"
+#include "mappedfile.h"
 #include "parallel.h"
 #include "parallelcontext.h"
 #include "math.h"
@@ -36,4 +38,5 @@
 #include "model.h"
 #include "objloader.h"
 #include "renderer.h"
+#include "aov.h"
 #include "assetgroup.h"
\ No newline at end of file
@@ -0,0 +1,86 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#pragma once
+
+#include "common.h"
+#include <string>
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+
+/*!
+    \addtogroup mappedfile
+    @{
+*/
+
+/*!
+    \brief Memory-mapped file.
+
+    \rst
+    Platform-independent abstraction of a file mapped into the address space of the process.
+    The contents of the file can be accessed directly via :cpp:func:`MappedFile::data`
+    without reading the file into a buffer.
+    The mapping is released when the object is destroyed.
+    Throws an exception with ``Error::IOError`` if the file cannot be mapped.
+    \endrst
+*/
+class MappedFile {
+public:
+    /*!
+        \brief Map an existing file for reading.
+        \param path Path to the file.
+    */
+    LM_PUBLIC_API MappedFile(const std::string& path);
+
+    /*!
+        \brief Create a file of the given size and map it for reading and writing.
+        \param path Path to the file.
+        \param size Size of the file in bytes.
+        \param truncate If true, the previous contents of the file are discarded.
+
+        \rst
+        If the file already exists, the file is truncated or extended to the given size
+        keeping the contents in the range. If ``truncate`` is true,
+        the existing file is truncated to zero size first, so the whole region reads as zero.
+        \endrst
+    */
+    LM_PUBLIC_API MappedFile(const std::string& path, size_t size, bool truncate = false);
+
+    LM_PUBLIC_API ~MappedFile();
+
+    LM_DISABLE_COPY_AND_MOVE(MappedFile);
+
+public:
+    //! Get pointer to the beginning of the mapped region.
+    void* data() const {
+        return data_;
+    }
+
+    //! Get size of the mapped region in bytes.
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    void map_read(const std::string& path);
+    void map_write(const std::string& path, size_t size, bool truncate);
+    void release();
+
+private:
+    void* data_ = nullptr;      // Pointer to the mapped region
+    size_t size_ = 0;           // Size of the mapped region
+    #if LM_PLATFORM_WINDOWS
+    void* file_ = nullptr;      // File handle
+    void* mapping_ = nullptr;   // File mapping handle
+    #else
+    int fd_ = -1;               // File descriptor
+    #endif
+};
+
+/*!
+    @}
+*/
+
+LM_NAMESPACE_END(LM_NAMESPACE)
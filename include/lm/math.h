@@ -20,6 +20,8 @@
 #pragma warning(pop)
 
 #include <tuple>
+#include <vector>
+#include <algorithm>
 #include <optional>
 #include <random>
 
@@ -76,6 +78,28 @@ struct Ray {
     //! \endcond
 };
 
+/*!
+    \brief Stream of rays.
+
+    \rst
+    Array of rays and their valid ranges in SoA layout.
+    Each array must contain at least ``n`` elements.
+    The structure does not own the arrays.
+    \endrst
+*/
+struct RayStream {
+    int n;              //!< Number of rays
+    const Float* o[3];  //!< Origins of the rays for each axis
+    const Float* d[3];  //!< Directions of the rays for each axis
+    const Float* tmin;  //!< Lower bounds of the valid ranges of the rays
+    const Float* tmax;  //!< Upper bounds of the valid ranges of the rays
+
+    //! Get i-th ray.
+    Ray ray(int i) const {
+        return { Vec3(o[0][i], o[1][i], o[2][i]), Vec3(d[0][i], d[1][i], d[2][i]) };
+    }
+};
+
 /*!
     \brief Axis-aligned bounding box
 */
@@ -199,24 +223,114 @@ struct SphereBound {
 
 #pragma region Random number generator
 
+class Sampler;
+
 LM_NAMESPACE_BEGIN(detail)
 
+// Generates the sample value of the dimension with the sampler.
+// Defined in sampler.cpp to make the header independent of the component interface.
+LM_PUBLIC_API double sampler_u(const Sampler* sampler, unsigned int seed, long long pixel, long long sample, int dim);
+
+/*
+    Counter-based random number generator based on Philox4x32-10.
+    cf. J. K. Salmon et al., Parallel random numbers: as easy as 1, 2, 3, SC'11.
+    The generator only holds the key and the counter, which are set from
+    the tuple of (seed, pixel index, sample index). The random numbers are
+    generated by encrypting the counter incremented for each block of 128 bits,
+    so the n-th random number of a sample is uniquely determined by the tuple
+    irrespective of the thread processing the sample.
+    If a sampler is given, the n-th uniform random number is instead
+    taken from the n-th dimension of the sample generated by the sampler.
+*/
 class RngImplBase {
 private:
-    std::mt19937 eng_;
-    std::uniform_real_distribution<double> dist_;  // Always use double
-    std::uniform_int_distribution<int> dist_int_;
+    unsigned int key_[2];                // Key: { seed, upper bits of sample index }
+    unsigned int ctr_[4];                // Counter: { block index, lower bits of sample index, pixel index }
+    unsigned int buf_[4];                // Random bits of the current block
+    int pos_ = 4;                        // Next position in buf_
+    const Sampler* sampler_ = nullptr;   // Sampler (optional)
+    unsigned int seed_;                  // Seed
+    long long pixel_;                    // Pixel index
+    long long sample_;                   // Sample index
+    int dim_ = 0;                        // Next dimension of the sample
 
 protected:
-    RngImplBase() {
-        // Initialize eng_ with random_device
-        eng_.seed(std::random_device{}());
+    RngImplBase() : RngImplBase(std::random_device{}(), 0, 0) {}
+    RngImplBase(int seed) : RngImplBase((unsigned int)(seed), 0, 0) {}
+    RngImplBase(unsigned int seed, long long pixel, long long sample, const Sampler* sampler = nullptr)
+        : sampler_(sampler)
+        , seed_(seed)
+        , pixel_(pixel)
+        , sample_(sample)
+    {
+        const auto p = (unsigned long long)(pixel);
+        const auto s = (unsigned long long)(sample);
+        key_[0] = seed;
+        key_[1] = (unsigned int)(s >> 32);
+        ctr_[0] = 0;
+        ctr_[1] = (unsigned int)(s);
+        ctr_[2] = (unsigned int)(p);
+        ctr_[3] = (unsigned int)(p >> 32);
+    }
+
+    // Generates 32 random bits
+    unsigned int next_bits() {
+        if (pos_ == 4) {
+            philox(buf_);
+            ctr_[0]++;
+            pos_ = 0;
+        }
+        return buf_[pos_++];
+    }
+
+    // Generates a double in [0,1) from 53 random bits
+    // or takes the value of the next dimension from the sampler
+    double u() {
+        if (sampler_) {
+            return sampler_u(sampler_, seed_, pixel_, sample_, dim_++);
+        }
+        const auto hi = (unsigned long long)(next_bits());
+        const auto lo = (unsigned long long)(next_bits());
+        return double(((hi << 32) | lo) >> 11) / double(1ULL << 53);
+    }
+
+    // Generates an integer in [0, INT_MAX]
+    int u_int() {
+        return int(next_bits() >> 1);
     }
-    RngImplBase(int seed) {
-        eng_.seed(seed);
+
+    // Sets the dimension of the sample taken by the next u().
+    // Only effective with the sampler.
+    void set_dim(int dim) {
+        dim_ = dim;
+    }
+
+private:
+    // Encrypts the counter with 10 rounds of Philox4x32
+    void philox(unsigned int out[4]) const {
+        constexpr unsigned long long M0 = 0xD2511F53;
+        constexpr unsigned long long M1 = 0xCD9E8D57;
+        constexpr unsigned int W0 = 0x9E3779B9;
+        constexpr unsigned int W1 = 0xBB67AE85;
+        unsigned int c0 = ctr_[0], c1 = ctr_[1], c2 = ctr_[2], c3 = ctr_[3];
+        unsigned int k0 = key_[0], k1 = key_[1];
+        for (int i = 0; i < 10; i++) {
+            const auto p0 = M0 * c0;
+            const auto p1 = M1 * c2;
+            const auto n0 = (unsigned int)(p1 >> 32) ^ c1 ^ k0;
+            const auto n2 = (unsigned int)(p0 >> 32) ^ c3 ^ k1;
+            c1 = (unsigned int)(p1);
+            c3 = (unsigned int)(p0);
+            c0 = n0;
+            c2 = n2;
+            k0 += W0;
+            k1 += W1;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
     }
-    double u() { return dist_(eng_); }
-    int u_int() { return dist_int_(eng_); }
 };
 
 template <typename F>
@@ -227,8 +341,11 @@ class RngImpl<double> : public RngImplBase {
 public:
     RngImpl() = default;
     RngImpl(int seed) : RngImplBase(seed) {}
+    RngImpl(unsigned int seed, long long pixel, long long sample, const Sampler* sampler = nullptr)
+        : RngImplBase(seed, pixel, sample, sampler) {}
     using RngImplBase::u;
     using RngImplBase::u_int;
+    using RngImplBase::set_dim;
 
     template <typename T>
     T next() {
@@ -246,6 +363,8 @@ class RngImpl<float> : public RngImplBase {
 public:
     RngImpl() = default;
     RngImpl(int seed) : RngImplBase(seed) {}
+    RngImpl(unsigned int seed, long long pixel, long long sample, const Sampler* sampler = nullptr)
+        : RngImplBase(seed, pixel, sample, sampler) {}
 
     /*
         According to the C++ standard std::uniform_real_distribution::operator()
@@ -268,6 +387,7 @@ public:
     }
 
     using RngImplBase::u_int;
+    using RngImplBase::set_dim;
 };
 
 LM_NAMESPACE_END(detail)
@@ -281,6 +401,8 @@ LM_NAMESPACE_END(detail)
     Various random variables are defined based on the uniform random number
     generated by this class. Note that the class internally holds the state
     therefore the member function calls are `not` thread-safe.
+    The generator is counter-based and the state is small,
+    so it is cheap to construct a generator for each sample.
 
     .. We manually documented the member functions
        because doxygen is not good at documenting template specializations.
@@ -291,9 +413,29 @@ LM_NAMESPACE_END(detail)
 
        Construct the random number generator by a given seed value.
 
+    .. cpp:function:: Rng(unsigned int seed, long long pixel, long long sample)
+
+       Construct the random number generator for a sample.
+       The sequence of the random numbers is uniquely determined by the seed,
+       the pixel index, and the sample index.
+       Use this constructor with the pixel and sample indices given by the scheduler
+       to make the result independent of the number of threads.
+
+    .. cpp:function:: Rng(unsigned int seed, long long pixel, long long sample, const Sampler* sampler)
+
+       Construct the random number generator for a sample taking the uniform random numbers
+       from the sampler. The n-th call of ``u()`` returns the n-th dimension of the sample.
+
     .. cpp:function:: Float u()
 
        Generate an uniform random number in [0,1).
+
+    .. cpp:function:: void set_dim(int dim)
+
+       Set the dimension of the sample taken by the next call of ``u()``.
+       The subsequent calls take the following dimensions.
+       The function has no effect if the generator is constructed without a sampler.
+       See :cpp:class:`lm::PathSampleDims` for the layout of the dimensions used by the renderers.
     \endrst
 */
 using Rng = detail::RngImpl<Float>;
@@ -622,6 +764,105 @@ static Float local_tan2(Vec3 local_d) {
 
 #pragma endregion
 
+#pragma region Space filling curves
+
+/*!
+    \brief Compute 3D Morton code.
+    \param x Quantized x coordinate in [0,1023].
+    \param y Quantized y coordinate in [0,1023].
+    \param z Quantized z coordinate in [0,1023].
+    \return 30-bit Morton code.
+*/
+static unsigned int morton_code_3d(unsigned int x, unsigned int y, unsigned int z) {
+    // Inserts two zero bits between each of the lower 10 bits
+    const auto expand = [](unsigned int v) -> unsigned int {
+        v &= 0x3ffu;
+        v = (v | (v << 16)) & 0x030000ffu;
+        v = (v | (v <<  8)) & 0x0300f00fu;
+        v = (v | (v <<  4)) & 0x030c30c3u;
+        v = (v | (v <<  2)) & 0x09249249u;
+        return v;
+    };
+    return (expand(x) << 2) | (expand(y) << 1) | expand(z);
+}
+
+/*!
+    \brief Compute 2D Morton code.
+    \param x Quantized x coordinate in [0,65535].
+    \param y Quantized y coordinate in [0,65535].
+    \return 32-bit Morton code.
+*/
+static unsigned int morton_code_2d(unsigned int x, unsigned int y) {
+    // Inserts a zero bit between each of the lower 16 bits
+    const auto expand = [](unsigned int v) -> unsigned int {
+        v &= 0xffffu;
+        v = (v | (v << 8)) & 0x00ff00ffu;
+        v = (v | (v << 4)) & 0x0f0f0f0fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    };
+    return (expand(y) << 1) | expand(x);
+}
+
+/*!
+    \brief Compute index along 2D Hilbert curve.
+    \param n Size of the grid. Must be a power of two.
+    \param x x coordinate in [0,n-1].
+    \param y y coordinate in [0,n-1].
+    \return Index of the cell along the Hilbert curve in [0,n*n-1].
+*/
+static unsigned long long hilbert_index_2d(unsigned int n, unsigned int x, unsigned int y) {
+    unsigned long long d = 0;
+    for (unsigned int s = n / 2; s > 0; s /= 2) {
+        const unsigned int rx = (x & s) > 0;
+        const unsigned int ry = (y & s) > 0;
+        d += (unsigned long long)(s) * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/*!
+    \brief Sort rays according to their directions.
+    \param rays Stream of rays.
+    \param order Output indices of the rays in the sorted order.
+
+    \rst
+    Computes the order of the rays along the Morton curve of the quantized directions.
+    Rays in the same octant of the directions are placed contiguously
+    and rays with similar directions are placed close to each other.
+    This is useful to improve the coherence of the traversal of the acceleration structure.
+    \endrst
+*/
+static void sort_rays_by_direction(const RayStream& rays, std::vector<int>& order) {
+    thread_local std::vector<std::pair<unsigned int, int>> keys;
+    keys.resize(rays.n);
+    for (int i = 0; i < rays.n; i++) {
+        // Map the direction from [-1,1] to [0,1023].
+        // Sign of each component is stored in the most significant bit.
+        unsigned int q[3];
+        for (int a = 0; a < 3; a++) {
+            q[a] = (unsigned int)(glm::clamp((rays.d[a][i] + 1_f) * 512_f, 0_f, 1023_f));
+        }
+        keys[i] = { morton_code_3d(q[0], q[1], q[2]), i };
+    }
+    std::sort(keys.begin(), keys.end());
+    order.resize(rays.n);
+    for (int i = 0; i < rays.n; i++) {
+        order[i] = keys[i].second;
+    }
+}
+
+#pragma endregion
+
 #pragma region Sampling related
 
 /*!
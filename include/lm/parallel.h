@@ -43,6 +43,16 @@ LM_PUBLIC_API void init(const std::string& type = DefaultType, const Json& prop
 */
 LM_PUBLIC_API void shutdown();
 
+/*!
+    \brief Scoped guard of `init` and `shutdown` functions.
+*/
+class ScopedInit {
+public:
+    ScopedInit(const std::string& type = DefaultType, const Json& prop = {}) { init(type, prop); }
+    ~ScopedInit() { shutdown(); }
+    LM_DISABLE_COPY_AND_MOVE(ScopedInit)
+};
+
 /*!
     \brief Get number of threads configured for the subsystem.
     \return Number of threads.
@@ -62,12 +72,44 @@ LM_PUBLIC_API bool main_thread();
 */
 using ParallelProcessFunc = std::function<void(long long index, int threadid)>;
 
+/*!
+    \brief Callback function for range-based parallel process.
+    \param begin Index of the first iteration in the range.
+    \param end Index next to the last iteration in the range.
+    \param threadId Thread identifier in `0 ... num_threads()-1`.
+*/
+using ParallelRangeProcessFunc = std::function<void(long long begin, long long end, int threadid)>;
+
 /*!
     \brief Callback function for progress updates.
     \param processed Processed number of samples.
 */
 using ProgressUpdateFunc = std::function<void(long long processed)>;
 
+/*!
+    \brief Parallel for loop over the blocks of iterations.
+    \param num_samples Total number of samples.
+    \param process_func Callback function called for each block of iterations.
+    \param progress_func Callback function called for each progress update.
+
+    \rst
+    The range ``[0, num_samples)`` is split into the contiguous blocks
+    and ``process_func`` is called once for each block with the range of the block.
+    Compared to :cpp:func:`lm::parallel::foreach`, the callback is called much less frequently,
+    so the user can hoist per-thread setup out of the loop over the iterations.
+    \endrst
+*/
+LM_PUBLIC_API void foreach_range(long long num_samples, const ParallelRangeProcessFunc& process_func, const ProgressUpdateFunc& progress_func);
+
+/*!
+    \brief Parallel for loop over the blocks of iterations.
+    \param num_samples Total number of samples.
+    \param process_func Callback function called for each block of iterations.
+*/
+LM_INLINE void foreach_range(long long num_samples, const ParallelRangeProcessFunc& process_func) {
+    foreach_range(num_samples, process_func, [](long long) {});
+}
+
 /*!
     \brief Parallel for loop.
     \param num_samples Total number of samples.
@@ -76,6 +118,7 @@ using ProgressUpdateFunc = std::function<void(long long processed)>;
 
     \rst
     We provide an abstraction for the parallel loop specifialized for rendering purpose.
+    This function is implemented with :cpp:func:`lm::parallel::foreach_range`.
     \endrst
 */
 LM_PUBLIC_API void foreach(long long num_samples, const ParallelProcessFunc& process_func, const ProgressUpdateFunc& progress_func);
@@ -89,6 +132,53 @@ LM_INLINE void foreach(long long num_samples, const ParallelProcessFunc& process
     foreach(num_samples, process_func, [](long long) {});
 }
 
+/*!
+    \brief Interleave the pages of a memory region across NUMA nodes.
+    \param data Pointer to the beginning of the region.
+    \param size Size of the region in bytes.
+
+    \rst
+    Large read-only arrays constructed by a single thread are placed on the NUMA node of the thread,
+    making the threads running on the other nodes access them through the interconnect.
+    This function distributes the pages of the region over all NUMA nodes in round-robin manner
+    to balance the memory traffic. Call the function after the array is fully constructed.
+    Only the pages entirely inside the region are affected,
+    so the other objects sharing the pages at both ends keep their placement,
+    and regions smaller than a page are left as they are.
+    The function is only effective on Linux machines with multiple NUMA nodes
+    and does nothing otherwise.
+    \endrst
+*/
+LM_PUBLIC_API void interleave_memory(const void* data, size_t size);
+
+/*!
+    \brief Cancel the running parallel loop.
+
+    \rst
+    This function requests cancellation of the parallel loop
+    currently running with :cpp:func:`lm::parallel::foreach_range` or :cpp:func:`lm::parallel::foreach`.
+    The cancellation is cooperative: the blocks being processed run to completion
+    and the blocks not yet dispatched are skipped.
+    The function must be called from inside the process or progress callbacks,
+    and the request is scoped to the loop processed by the calling thread.
+    The other loops running concurrently, e.g., the loops started by the other threads,
+    are not affected. The function has no effect outside of the parallel loops.
+    \endrst
+*/
+LM_PUBLIC_API void cancel();
+
+/*!
+    \brief Check if cancellation of the running parallel loop is requested.
+    \return `true` if cancellation is requested, `false` otherwise.
+
+    \rst
+    Long-running process callbacks can use this function to return early after the cancellation.
+    Like :cpp:func:`lm::parallel::cancel`, the function refers to the loop processed by the calling thread
+    and returns ``false`` outside of the parallel loops.
+    \endrst
+*/
+LM_PUBLIC_API bool cancelled();
+
 /*!
     @}
 */
@@ -29,7 +29,73 @@ class ParallelContext : public Component {
 public:
     virtual int num_threads() const = 0;
     virtual bool main_thread() const = 0;
-    virtual void foreach(long long numSamples, const ParallelProcessFunc& processFunc, const ProgressUpdateFunc& progressFunc) const = 0;
+    virtual void foreach_range(long long numSamples, const ParallelRangeProcessFunc& processFunc, const ProgressUpdateFunc& progressFunc) const = 0;
+    virtual void cancel() const = 0;
+    virtual bool cancelled() const = 0;
+};
+
+/*!
+    \brief Pin the current thread to a logical processor.
+    \param policy Affinity policy.
+    \param index Index of the thread.
+
+    \rst
+    ``policy`` is either ``none``, ``compact``, or ``scatter``.
+    ``compact`` fills the logical processors of a NUMA node before moving to the next node,
+    and ``scatter`` assigns consecutive threads to different nodes in round-robin manner.
+    The function is only supported on Linux and does nothing on the other platforms.
+    Throws an exception with ``Error::InvalidArgument`` if the policy is invalid.
+    \endrst
+*/
+LM_PUBLIC_API void pin_thread(const std::string& policy, int index);
+
+/*!
+    \brief Get the affinity of the current thread.
+    \return Logical processors the current thread can run on.
+
+    \rst
+    The function is only supported on Linux and returns an empty list on the other platforms.
+    \endrst
+*/
+LM_PUBLIC_API std::vector<int> thread_affinity();
+
+/*!
+    \brief Set the affinity of the current thread.
+    \param cpus Logical processors the current thread can run on.
+
+    \rst
+    The function is only supported on Linux and does nothing on the other platforms.
+    \endrst
+*/
+LM_PUBLIC_API void set_thread_affinity(const std::vector<int>& cpus);
+
+/*!
+    \brief Scoped pinning of the current thread.
+
+    \rst
+    The class pins the current thread with :cpp:func:`lm::parallel::pin_thread`
+    and restores the previous affinity when it goes out of the scope.
+    This is useful when the thread calling the parallel loop takes part in the loop,
+    so that the affinity of the caller, e.g., the Python interpreter, is kept after the loop.
+    \endrst
+*/
+class ScopedPinThread {
+public:
+    ScopedPinThread(const std::string& policy, int index) {
+        if (policy != "none") {
+            prev_ = thread_affinity();
+            pin_thread(policy, index);
+        }
+    }
+    ~ScopedPinThread() {
+        if (!prev_.empty()) {
+            set_thread_affinity(prev_);
+        }
+    }
+    LM_DISABLE_COPY_AND_MOVE(ScopedPinThread)
+
+private:
+    std::vector<int> prev_;     // Affinity before pinning
 };
 
 /*!
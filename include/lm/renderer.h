@@ -6,6 +6,7 @@
 #pragma once
 
 #include "component.h"
+#include "film.h"
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE)
 
@@ -23,6 +24,112 @@ public:
         \brief Process rendering.
     */
     virtual Json render() const = 0;
+
+    /*!
+        \brief Reset the state accumulated across the renderings.
+
+        \rst
+        The renderers supporting the progressive rendering discard the accumulated samples
+        so that the next rendering starts from the cleared film.
+        The default implementation does nothing.
+        \endrst
+    */
+    virtual void reset() {}
+};
+
+/*!
+    \brief Progressive accumulation of the samples across the renderings.
+
+    \rst
+    This class lets the successive calls of :cpp:func:`lm::Renderer::render`
+    refine the same image. The film itself keeps the running sum of the samples,
+    and this class only keeps the total number of samples.
+    Before a rendering, :cpp:func:`ProgressiveAccumulator::begin` turns the image of the film
+    back to the sum of the samples of the previous renderings,
+    onto which the new samples are splatted.
+    After the rendering, :cpp:func:`ProgressiveAccumulator::end` normalizes the image
+    by the total number of samples.
+
+    The normalization factor ``norm`` is the factor of the renderer
+    such that the image is the sum of the samples multiplied by ``norm / count()``,
+    e.g., ``1`` for the pixel sampling and the number of pixels for the image sampling.
+    For the schedulers with varying number of samples per pixel,
+    the renderer passes :cpp:func:`ProgressiveAccumulator::count` as ``base_spp``
+    of :cpp:func:`lm::scheduler::Scheduler::run_range`.
+    The accumulation is reset when the size of the film changes.
+    \endrst
+*/
+class ProgressiveAccumulator {
+private:
+    long long count_ = 0;       // Total number of samples accumulated in the film
+    FilmSize size_{ 0, 0 };     // Size of the film of the accumulation
+
+public:
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(count_, size_.w, size_.h);
+    }
+
+    /*!
+        \brief Get the total number of samples accumulated so far.
+
+        \rst
+        The renderers use this value as the offset of the sample indices
+        so that the successive renderings generate different samples.
+        \endrst
+    */
+    long long count() const {
+        return count_;
+    }
+
+    /*!
+        \brief Reset the accumulation.
+
+        \rst
+        The next call of :cpp:func:`ProgressiveAccumulator::begin` clears the film.
+        \endrst
+    */
+    void reset() {
+        count_ = 0;
+    }
+
+    /*!
+        \brief Prepare the film for a rendering.
+        \param film Output film.
+        \param norm Normalization factor of the image.
+
+        \rst
+        Clears the film if nothing is accumulated or the size of the film changed.
+        Otherwise rescales the image to the sum of the samples accumulated so far.
+        \endrst
+    */
+    void begin(Film* film, Float norm) {
+        const auto size = film->size();
+        if (size.w != size_.w || size.h != size_.h) {
+            size_ = size;
+            count_ = 0;
+        }
+        if (count_ == 0) {
+            film->clear();
+            return;
+        }
+        film->rescale(Float(count_) / norm);
+    }
+
+    /*!
+        \brief Normalize the film after a rendering.
+        \param film Output film.
+        \param norm Normalization factor of the image.
+        \param processed Number of samples of the rendering.
+        \return Total number of samples.
+    */
+    long long end(Film* film, Float norm, long long processed) {
+        count_ += processed;
+        if (count_ > 0) {
+            film->rescale(norm / count_);
+        }
+        return count_;
+    }
 };
 
 /*!
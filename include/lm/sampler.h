@@ -0,0 +1,104 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#pragma once
+
+#include "component.h"
+#include "math.h"
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+
+/*!
+    \addtogroup sampler
+    @{
+*/
+
+/*!
+    \brief Sampler.
+
+    \rst
+    Sampler generates the sample values in the unit hypercube used by the renderers.
+    A sample is identified by the tuple of the seed, the pixel index, and the sample index,
+    and each dimension of the sample is generated independently from the others.
+    Thus the sampler holds no per-sample state and it can be shared among threads.
+    The renderers use the sampler through :cpp:type:`lm::Rng` constructed for each sample,
+    where the n-th uniform random number is taken from the n-th dimension of the sample.
+    \endrst
+*/
+class Sampler : public Component {
+public:
+    /*!
+        \brief Generate a sample value of a dimension.
+        \param seed Seed.
+        \param pixel Pixel index.
+        \param sample Sample index.
+        \param dim Dimension.
+        \return Sample value in [0,1).
+
+        \rst
+        The samples of a pixel are distributed well if the sample indices are consecutive.
+        For the renderers sampling the whole image, ``pixel`` is fixed to zero
+        and the sample index is the index of the sample in the image.
+        \endrst
+    */
+    virtual double u(unsigned int seed, long long pixel, long long sample, int dim) const = 0;
+};
+
+/*!
+    \brief Layout of the sample dimensions of a path.
+
+    \rst
+    The renderers sampling a path vertex by vertex assign a fixed block of dimensions
+    to each vertex, and each use of the random numbers at the vertex has a fixed offset in the block.
+    Thus a dimension is always used for the same purpose even if some random numbers
+    are drawn conditionally, e.g., by the next event estimation or Russian roulette.
+    Use :cpp:func:`lm::Rng::set_dim` with the dimensions given by this structure
+    before drawing the random numbers.
+    The offsets are even, so a pair of the random numbers starting at an offset
+    is stratified as a pair by ``sampler::sobol``.
+    The random numbers drawn variable number of times, e.g., by the distance sampling
+    in participating media, take the separate dimensions after the fixed blocks.
+    \endrst
+*/
+struct PathSampleDims {
+    // Offsets of the dimensions in the block of a vertex
+    static constexpr int NEE = 0;           //!< Light sampling of NEE from the vertex (8 dimensions).
+    static constexpr int Direction = 8;     //!< Direction sampling from the vertex (4 dimensions).
+    static constexpr int Component = 12;    //!< Component sampling at the vertex (2 dimensions).
+    static constexpr int RR = 14;           //!< Russian roulette at the vertex (1 dimension).
+    static constexpr int Position = 16;     //!< Position sampling of the initial vertex (4 dimensions).
+    static constexpr int BlockSize = 20;    //!< Number of dimensions per vertex.
+
+    // Slots of the random numbers drawn variable number of times at a vertex
+    static constexpr int Distance = 0;          //!< Distance sampling from the vertex.
+    static constexpr int Transmittance = 1;     //!< Transmittance estimation of NEE from the vertex.
+    static constexpr int NumVariableSlots = 2;  //!< Number of slots per vertex.
+    static constexpr int VariableBase = 1 << 20;    //!< First dimension of the slots.
+    static constexpr int VariableSize = 1 << 10;    //!< Number of dimensions per slot.
+
+    /*!
+        \brief Get the dimension of a fixed use at a vertex.
+        \param vertex Index of the vertex (0 for the initial vertex).
+        \param offset Offset in the block, e.g., ``PathSampleDims::NEE``.
+    */
+    static constexpr int fixed(int vertex, int offset) {
+        return vertex * BlockSize + offset;
+    }
+
+    /*!
+        \brief Get the first dimension of a slot of the variable draws at a vertex.
+        \param vertex Index of the vertex (0 for the initial vertex).
+        \param slot Slot, e.g., ``PathSampleDims::Distance``.
+    */
+    static constexpr int variable(int vertex, int slot) {
+        return VariableBase + (vertex * NumVariableSlots + slot) * VariableSize;
+    }
+};
+
+/*!
+    @}
+*/
+
+LM_NAMESPACE_END(LM_NAMESPACE)
@@ -88,6 +88,18 @@ public:
 	*/
 	virtual int create_instance_group_node() = 0;
 
+    /*!
+        \brief Set local transformation of a group node.
+        \param node_index Index of the group node.
+        \param transform Local transformation of the node.
+
+        \rst
+        This function replaces the transformation applied to the child nodes of the group.
+        Call :cpp:func:`Scene::update` to reflect the change to the acceleration structure.
+        \endrst
+    */
+    virtual void set_transform(int node_index, Mat4 transform) = 0;
+
     /*!
         \brief Add primitive group.
         \param parent Parent node index.
@@ -314,9 +326,35 @@ public:
     */
     virtual void set_accel(const std::string& accel_loc) = 0;
 
-    //! Build acceleration structure.
+    /*!
+        \brief Build acceleration structure.
+
+        \rst
+        If the scene is created with ``accel_cache_dir`` property,
+        the built acceleration structure is cached in the directory.
+        The cache is identified by the type of the acceleration structure
+        and the hash of the triangles and transformations of the primitives.
+        If the cache is found, the acceleration structure is loaded
+        from the memory-mapped cache instead of being rebuilt.
+        See :cpp:func:`Accel::save_cache` and :cpp:func:`Accel::load_cache`.
+        \endrst
+    */
     virtual void build() = 0;
 
+    /*!
+        \brief Update acceleration structure.
+
+        \rst
+        Reflects the changes of the scene graph since the last build or update.
+        If only the transformations of the group nodes are changed,
+        the function refits the acceleration structure with :cpp:func:`Accel::refit`
+        instead of rebuilding it.
+        If the structure of the scene graph is changed or the scene has never been built,
+        this function is equivalent to :cpp:func:`Scene::build`.
+        \endrst
+    */
+    virtual void update() = 0;
+
     /*!
         \brief Compute closest intersection point.
         \param ray Ray.
@@ -334,6 +372,34 @@ public:
     */
     virtual std::optional<SceneInteraction> intersect(Ray ray, Float tmin = Eps, Float tmax = Inf) const = 0;
 
+    /*!
+        \brief Check if the ray segment intersects with the scene.
+        \param ray Ray.
+        \param tmin Lower bound of the valid range of the ray.
+        \param tmax Upper bound of the valid range of the ray.
+
+        \rst
+        This function returns true if any intersection is found in the given range of the ray.
+        Unlike :cpp:func:`Scene::intersect`, the function uses any-hit query of the
+        underlying acceleration structure and does not compute the scene interaction.
+        Note that environment light is not considered as an occluder.
+        \endrst
+    */
+    virtual bool occluded(Ray ray, Float tmin = Eps, Float tmax = Inf) const = 0;
+
+    /*!
+        \brief Compute closest intersection points for a stream of rays.
+        \param rays Stream of rays.
+        \param sis Output array of scene interactions. Must contain at least ``rays.n`` elements.
+
+        \rst
+        This function is equivalent to calling :cpp:func:`Scene::intersect` for each ray in the stream
+        and writing the result to ``sis[i]``,
+        but uses :cpp:func:`Accel::intersect_stream` to compute the intersections at once.
+        \endrst
+    */
+    virtual void intersect_stream(const RayStream& rays, std::optional<SceneInteraction>* sis) const = 0;
+
     /*!
         \brief Check if two surface points are mutually visible.
         \param sp1 Scene interaction of the first point.
@@ -353,7 +419,7 @@ public:
                     return d * (1_f - Eps);
                 }();
             // Exclude environent light from intersection test with tmax < Inf
-            return !intersect(Ray{sp1.geom.p, wo}, Eps, tmax);
+            return !occluded(Ray{sp1.geom.p, wo}, Eps, tmax);
         };
         if (sp1.geom.infinite) {
             return visible_(sp2, sp1);
@@ -6,6 +6,7 @@
 #pragma once
 
 #include "component.h"
+#include "math.h"
 #include <chrono>
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE)
@@ -16,6 +17,49 @@ LM_NAMESPACE_BEGIN(scheduler)
     @{
 */
 
+/*!
+    \brief Range of pixel samples dispatched to a thread.
+
+    \rst
+    A range represents a block of the linear indices of pixel samples ``[begin, end)``.
+    The pixel and sample indices of a linear index ``i`` are given by
+    ``i / samples_per_pixel`` and ``sample_offset + i % samples_per_pixel`` respectively
+    if ``samples_per_pixel > 0``, otherwise ``0`` and ``sample_offset + i``.
+    Use :cpp:func:`lm::scheduler::Range::foreach` to iterate the pixel samples in the range.
+
+    If ``contributions`` is not null, the scheduler requests the contributions of the samples,
+    e.g., for the adaptive sampling. The renderer must store the contribution of the sample
+    with linear index ``i`` to ``contributions[i - begin]``, which is only valid
+    if the sample contributes only to its own pixel.
+    The renderer storing the contributions sets ``*contributions_reported`` to true,
+    so that the scheduler can reject the renderers not supporting the request.
+    \endrst
+*/
+struct Range {
+    long long begin;                //!< Begin of the linear index
+    long long end;                  //!< End of the linear index
+    long long samples_per_pixel;    //!< Number of consecutive samples of a pixel (0: single pixel)
+    long long sample_offset;        //!< Offset of the sample index
+    Vec3* contributions = nullptr;  //!< Output of the contributions of the samples (optional)
+    bool* contributions_reported = nullptr; //!< Set to true if the contributions are stored
+
+    /*!
+        \brief Iterate pixel samples in the range.
+        \param process Function called for each pixel sample with pixel and sample indices.
+    */
+    template <typename ProcessSampleFunc>
+    void foreach(const ProcessSampleFunc& process) const {
+        for (long long i = begin; i < end; i++) {
+            if (samples_per_pixel > 0) {
+                process(i / samples_per_pixel, sample_offset + i % samples_per_pixel);
+            }
+            else {
+                process(0LL, sample_offset + i);
+            }
+        }
+    }
+};
+
 /*!
     \brief Scheduler for rendering loop.
 
@@ -33,12 +77,45 @@ public:
     */
     using ProcessFunc = std::function<void(long long pixel_index, long long sample_index, int threadid)>;
 
+    /*!
+        \brief Callback function for range-based parallel loop.
+        \param range Range of pixel samples.
+        \param threadid Thread index.
+    */
+    using RangeProcessFunc = std::function<void(const Range& range, int threadid)>;
+
+    /*!
+        \brief Dispatch scheduler with range-based callback.
+        \param process Callback function called for each block of pixel samples.
+        \param base_spp Number of samples per pixel already accumulated in the film.
+        \return Processed samples per pixel.
+
+        \rst
+        The callback is called once for each block of pixel samples processed by a thread,
+        so per-thread setup can be hoisted out of the loop over the pixel samples.
+
+        ``base_spp`` is used when the film keeps the sum of the samples of the previous renderings,
+        e.g., in the progressive rendering with :cpp:class:`lm::ProgressiveAccumulator`.
+        The schedulers normalizing the pixels by the number of samples taken in each pixel
+        count the accumulated samples together with the samples of the current run.
+        The other schedulers ignore the value.
+        \endrst
+    */
+    virtual long long run_range(const RangeProcessFunc& process, long long base_spp = 0) const = 0;
+
     /*!
         \brief Dispatch scheduler.
         \param process Callback function for parallel loop.
+        \param base_spp Number of samples per pixel already accumulated in the film.
         \return Processed samples per pixel.
     */
-    virtual long long run(const ProcessFunc& process) const = 0;
+    long long run(const ProcessFunc& process, long long base_spp = 0) const {
+        return run_range([&](const Range& range, int threadid) {
+            range.foreach([&](long long pixel_index, long long sample_index) {
+                process(pixel_index, sample_index, threadid);
+            });
+        }, base_spp);
+    }
 };
 
 /*!
@@ -11,6 +11,7 @@
 #include <string>
 #include <atomic>
 #include <mutex>
+#include <future>
 #include <random>
 #include <unordered_map>
 #include <unordered_set>
@@ -16,6 +16,7 @@ namespace {
 struct FlattenedPrimitiveNode {
     Transform global_transform;  // Global transform of the primitive
     int primitive;              // Primitive node index
+    glm::vec3* vs;              // Vertex buffer of the geometry
 };
 
 }
@@ -98,19 +99,14 @@ public:
 
             // Record flattened primitive
             const int flatten_node_index = int(flattened_nodes_.size());
-            flattened_nodes_.push_back({ Transform(global_transform), node.index });
             // Create triangle mesh
             auto geom = rtcNewGeometry(device_, RTC_GEOMETRY_TYPE_TRIANGLE);
             const int num_triangles = node.primitive.mesh->num_triangles();
             auto* vs = (glm::vec3*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, sizeof(glm::vec3), num_triangles*3);
             auto* fs = (glm::uvec3*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, sizeof(glm::uvec3), num_triangles);
-            node.primitive.mesh->foreach_triangle([&](int face, const Mesh::Tri& tri) {
-                const auto p1 = global_transform * Vec4(tri.p1.p, 1_f);
-                const auto p2 = global_transform * Vec4(tri.p2.p, 1_f);
-                const auto p3 = global_transform * Vec4(tri.p3.p, 1_f);
-                vs[3*face  ] = glm::vec3(p1);
-                vs[3*face+1] = glm::vec3(p2);
-                vs[3*face+2] = glm::vec3(p3);
+            flattened_nodes_.push_back({ Transform(global_transform), node.index, vs });
+            write_vertices(node, global_transform, vs);
+            node.primitive.mesh->foreach_triangle([&](int face, const Mesh::Tri&) {
                 fs[face][0] = 3*face;
                 fs[face][1] = 3*face+1;
                 fs[face][2] = 3*face+2;
@@ -124,6 +120,47 @@ public:
         rtcCommitScene(scene_);
     }
 
+    virtual bool refit(const Scene& scene) override {
+        exception::ScopedDisableFPEx guard_;
+        if (!scene_) {
+            return false;
+        }
+
+        // Collect updated primitive nodes.
+        // The traversal order is the same as the last build if the structure is not changed.
+        std::vector<std::tuple<const SceneNode*, Mat4>> nodes;
+        scene.traverse_primitive_nodes([&](const SceneNode& node, Mat4 global_transform) {
+            if (node.type != SceneNodeType::Primitive) {
+                return;
+            }
+            if (!node.primitive.mesh) {
+                return;
+            }
+            nodes.push_back({ &node, global_transform });
+        });
+        if (nodes.size() != flattened_nodes_.size()) {
+            return false;
+        }
+
+        // Update vertex buffers and let Embree refit the BVH of each geometry
+        LM_INFO("Refitting");
+        for (int i = 0; i < int(nodes.size()); i++) {
+            const auto& [node, global_transform] = nodes[i];
+            auto& fn = flattened_nodes_[i];
+            if (fn.primitive != node->index) {
+                return false;
+            }
+            fn.global_transform = Transform(global_transform);
+            write_vertices(*node, global_transform, fn.vs);
+            auto geom = rtcGetGeometry(scene_, unsigned(i));
+            rtcSetGeometryBuildQuality(geom, RTC_BUILD_QUALITY_REFIT);
+            rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0);
+            rtcCommitGeometry(geom);
+        }
+        rtcCommitScene(scene_);
+        return true;
+    }
+
     virtual std::optional<Hit> intersect(Ray ray, Float tmin, Float tmax) const override {
         exception::ScopedDisableFPEx guard_;
 
@@ -131,6 +168,86 @@ public:
         rtcInitIntersectContext(&context);
 
         // Setup ray
+        auto rayhit = make_rayhit(ray, tmin, tmax);
+        
+        // Intersection query
+        rtcIntersect1(scene_, &context, &rayhit);
+        if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
+            // No intersection
+            return {};
+        }
+        
+        // Store hit information
+        return make_hit(rayhit);
+    }
+
+    virtual void intersect_stream(const RayStream& rays, Hit* hits) const override {
+        exception::ScopedDisableFPEx guard_;
+
+        RTCIntersectContext context;
+        rtcInitIntersectContext(&context);
+        context.flags = RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+
+        // Setup rays
+        thread_local std::vector<RTCRayHit> rayhits;
+        rayhits.resize(rays.n);
+        for (int i = 0; i < rays.n; i++) {
+            rayhits[i] = make_rayhit(rays.ray(i), rays.tmin[i], rays.tmax[i]);
+        }
+
+        // Intersection query for the stream of rays
+        rtcIntersect1M(scene_, &context, rayhits.data(), unsigned(rays.n), sizeof(RTCRayHit));
+
+        // Store hit information
+        for (int i = 0; i < rays.n; i++) {
+            const auto& rayhit = rayhits[i];
+            hits[i] = rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID
+                ? Hit{ Inf, Vec2(0_f), Transform(), -1, -1 }
+                : make_hit(rayhit);
+        }
+    }
+
+    virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;
+
+        RTCIntersectContext context;
+        rtcInitIntersectContext(&context);
+
+        // Setup ray
+        RTCRay r;
+        r.org_x = float(ray.o.x);
+        r.org_y = float(ray.o.y);
+        r.org_z = float(ray.o.z);
+        r.tnear = float(tmin);
+        r.dir_x = float(ray.d.x);
+        r.dir_y = float(ray.d.y);
+        r.dir_z = float(ray.d.z);
+        r.time = 0.f;
+        r.tfar = float(tmax);
+        r.mask = unsigned(-1);
+        r.flags = 0;
+
+        // Occlusion query
+        // tfar is set to -inf if any intersection is found
+        rtcOccluded1(scene_, &context, &r);
+        return r.tfar < 0.f;
+    }
+
+private:
+    // Writes transformed vertices of the primitive to the vertex buffer
+    static void write_vertices(const SceneNode& node, Mat4 global_transform, glm::vec3* vs) {
+        node.primitive.mesh->foreach_triangle([&](int face, const Mesh::Tri& tri) {
+            const auto p1 = global_transform * Vec4(tri.p1.p, 1_f);
+            const auto p2 = global_transform * Vec4(tri.p2.p, 1_f);
+            const auto p3 = global_transform * Vec4(tri.p3.p, 1_f);
+            vs[3*face  ] = glm::vec3(p1);
+            vs[3*face+1] = glm::vec3(p2);
+            vs[3*face+2] = glm::vec3(p3);
+        });
+    }
+
+    // Makes embree ray from the given ray
+    static RTCRayHit make_rayhit(Ray ray, Float tmin, Float tmax) {
         RTCRayHit rayhit;
         rayhit.ray.org_x = float(ray.o.x);
         rayhit.ray.org_y = float(ray.o.y);
@@ -141,18 +258,16 @@ public:
         rayhit.ray.dir_z = float(ray.d.z);
         rayhit.ray.time = 0.f;
         rayhit.ray.tfar = float(tmax);
+        rayhit.ray.mask = unsigned(-1);
+        rayhit.ray.flags = 0;
         rayhit.hit.primID = RTC_INVALID_GEOMETRY_ID;
         rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
         rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
-        
-        // Intersection query
-        rtcIntersect1(scene_, &context, &rayhit);
-        if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
-            // No intersection
-            return {};
-        }
-        
-        // Store hit information
+        return rayhit;
+    }
+
+    // Makes hit information from the intersected embree ray
+    Hit make_hit(const RTCRayHit& rayhit) const {
         const auto& fn = flattened_nodes_.at(rayhit.hit.geomID);
         return Hit{
             Float(rayhit.ray.tfar),
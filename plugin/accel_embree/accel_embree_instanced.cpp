@@ -295,6 +295,32 @@ public:
             int(rayhit.hit.primID)
         };
     }
+
+    virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;
+
+        RTCIntersectContext context;
+        rtcInitIntersectContext(&context);
+
+        // Setup ray
+        RTCRay r;
+        r.org_x = float(ray.o.x);
+        r.org_y = float(ray.o.y);
+        r.org_z = float(ray.o.z);
+        r.tnear = float(tmin);
+        r.dir_x = float(ray.d.x);
+        r.dir_y = float(ray.d.y);
+        r.dir_z = float(ray.d.z);
+        r.time = 0.f;
+        r.tfar = float(tmax);
+        r.mask = unsigned(-1);
+        r.flags = 0;
+
+        // Occlusion query
+        // tfar is set to -inf if any intersection is found
+        rtcOccluded1(scene_, &context, &r);
+        return r.tfar < 0.f;
+    }
 };
 
 LM_COMP_REG_IMPL(Accel_Embree_Instanced, "accel::embreeinstanced");
@@ -17,6 +17,30 @@ struct FlattenedPrimitiveNode {
     int primitive;              // Primitive node index
 };
 
+// Triangle intersector for any-hit query.
+// nanort always finds the closest hit, so once a hit is found
+// we shrink the valid range of the ray to its lower bound.
+// This culls the remaining nodes and effectively terminates the traversal.
+template <typename T>
+class AnyHitTriangleIntersector : public nanort::TriangleIntersector<T> {
+private:
+    T tmin_;
+
+public:
+    AnyHitTriangleIntersector(const T* vertices, const unsigned int* faces, size_t vertex_stride_bytes, T tmin)
+        : nanort::TriangleIntersector<T>(vertices, faces, vertex_stride_bytes)
+        , tmin_(tmin)
+    {}
+
+    bool Intersect(T* t_inout, const unsigned int prim_index) const {
+        if (!nanort::TriangleIntersector<T>::Intersect(t_inout, prim_index)) {
+            return false;
+        }
+        *t_inout = tmin_;
+        return true;
+    }
+};
+
 /*
 \rst
 .. function:: accel::nanort
@@ -95,6 +119,24 @@ public:
         const auto& fn = flattened_nodes_.at(node);
         return Hit{ isect.t, Vec2(isect.u, isect.v), fn.global_transform, fn.primitive, face };
     }
+
+    virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;
+
+        nanort::Ray<Float> r;
+        r.org[0] = ray.o[0];
+        r.org[1] = ray.o[1];
+        r.org[2] = ray.o[2];
+        r.dir[0] = ray.d[0];
+        r.dir[1] = ray.d[1];
+        r.dir[2] = ray.d[2];
+        r.min_t = tmin;
+        r.max_t = tmax;
+
+        AnyHitTriangleIntersector<Float> intersector(vs_.data(), fs_.data(), sizeof(Float) * 3, tmin);
+        nanort::TriangleIntersection<Float> isect;
+        return accel_.Traverse(r, intersector, &isect);
+    }
 };
 
 LM_COMP_REG_IMPL(Accel_NanoRT, "accel::nanort");
@@ -8,86 +8,184 @@
 #include <lm/accel.h>
 #include <lm/scene.h>
 #include <lm/mesh.h>
+#include <lm/parallel.h>
+#include "bvh.h"
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE)
 
 namespace {
 
-struct FlattenedPrimitiveNode {
-    Transform global_transform;	// Global transform of the primitive
-    int primitive;              // Primitive node index
-
-    template <typename Archive>
-    void serialize(Archive& ar) {
-        ar(global_transform, primitive);
-    }
-};
+using bvh::FlattenedPrimitiveNode;
+using bvh::BuildParams;
+using bvh::Bin;
+using bvh::Node;
+using bvh::MaxDepth;
 
+// Triangle data used in the intersection (hot data).
+// Stored in single precision in leaf order.
 struct Tri {
-    Vec3 p1;            // One vertex of the triangle
-    Vec3 e1, e2;        // Two edges incident to p1
-    Bound b;            // Bound of the triangle
-    Vec3 c;             // Center of the bound
-    int flattened_node; // Index of flattened primitive associated to the triangle
-    int face;           // Face index of the mesh associated to the triangle
+    float p1[3];        // One vertex of the triangle
+    float e1[3];        // Two edges incident to p1
+    float e2[3];
 
     template <typename Archive>
     void serialize(Archive& ar) {
-        ar(p1, e1, e2, b, c, flattened_node, face);
+        ar(p1[0], p1[1], p1[2], e1[0], e1[1], e1[2], e2[0], e2[1], e2[2]);
     }
 
     Tri() {}
 
-    Tri(Vec3 p1, Vec3 p2, Vec3 p3, int flattened_node, int face)
-        : p1(p1), flattened_node(flattened_node), face(face) {
-        e1 = p2 - p1;
-        e2 = p3 - p1;
-        b = merge(b, p1);
-        b = merge(b, p2);
-        b = merge(b, p3);
-        c = b.center();
+    Tri(Vec3 v1, Vec3 v2, Vec3 v3) {
+        for (int i = 0; i < 3; i++) {
+            p1[i] = float(v1[i]);
+            e1[i] = float(v2[i] - v1[i]);
+            e2[i] = float(v3[i] - v1[i]);
+        }
     }
 
-    // Hit information
-    struct Hit {
-        Float t;     // Distance to the triangle
-        Float u, v;  // Hitpoint in barycentric coordinates
-    };
+    // Converts the stored values to a vector
+    static Vec3 vec(const float* v) {
+        return Vec3(v[0], v[1], v[2]);
+    }
 
-    // Checks intersection with a ray [Möller & Trumbore 1997]
+    // Computes the bound of the triangle represented by the stored values
+    Bound bound() const {
+        Bound b;
+        b = merge(b, vec(p1));
+        b = merge(b, vec(p1) + vec(e1));
+        b = merge(b, vec(p1) + vec(e2));
+        return b;
+    }
+
+    using Hit = bvh::TriHit;
+
+    // Checks intersection with a ray.
+    // Computations are performed in double precision.
     std::optional<Hit> intersect(Ray r, Float tl, Float th) const {
-        auto p = glm::cross(r.d, e2);
-        auto tv = r.o - p1;
-        auto q = glm::cross(tv, e1);
-        auto d = glm::dot(e1, p);
-        auto ad = glm::abs(d);
-        auto s = std::copysign(1_f, d);
-        auto u = glm::dot(tv, p) * s;
-        auto v = glm::dot(r.d, q) * s;
-        if (ad < 1e-8_f || u < 0_f || v < 0_f || u + v > ad) {
-            return {};
-        }
-        auto t = glm::dot(e2, q) / d;
-        if (t < tl || th < t) {
-            return {};
-        }
-        return Hit{ t, u / ad, v / ad };
+        return bvh::intersect_triangle(r, vec(p1), vec(e1), vec(e2), tl, th);
+    }
+};
+
+// Triangle data used to make hit information (cold data).
+// Stored in leaf order and only accessed for the closest hit.
+struct TriMeta {
+    int flattened_node; // Index of flattened primitive associated to the triangle
+    int face;           // Face index of the mesh associated to the triangle
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(flattened_node, face);
     }
 };
 
-// BVH node
-struct Node {
+// Triangle data used only in the construction
+struct BuildTri {
+    Bound b;            // Bound of the triangle
+    Vec3 c;             // Center of the bound
+};
+
+// BVH node used in the construction
+struct BuildNode {
     Bound b;        // Bound of the node
     bool leaf = 0;  // True if the node is leaf
     int s, e;       // Range of triangle indices (valid only in leaf nodes)
     int c1, c2;     // Index to the child nodes
+};
 
+// Array of trivially copyable elements which either owns the elements
+// or refers to the elements in the memory-mapped cache in place.
+// The referred elements are copied on the first modification.
+template <typename T>
+class MappableArray {
+private:
+    std::vector<T> v_;          // Owned elements
+    const T* ref_ = nullptr;    // Referred elements (nullptr if the elements are owned)
+    size_t ref_size_ = 0;       // Number of referred elements
+
+public:
     template <typename Archive>
     void serialize(Archive& ar) {
-        ar(b, leaf, s, e, c1, c2);
+        ar(vec());
+    }
+
+    const T* data() const { return ref_ ? ref_ : v_.data(); }
+    size_t size() const { return ref_ ? ref_size_ : v_.size(); }
+    bool empty() const { return size() == 0; }
+    const T& operator[](size_t i) const { return data()[i]; }
+
+    // Refers to the elements in place
+    void refer(const void* data, size_t size) {
+        std::vector<T>().swap(v_);
+        ref_ = static_cast<const T*>(data);
+        ref_size_ = size;
+    }
+
+    // Clears the elements
+    void clear() {
+        v_.clear();
+        ref_ = nullptr;
+        ref_size_ = 0;
     }
+
+    // Gets the owned elements for modification
+    std::vector<T>& vec() {
+        if (ref_) {
+            v_.assign(ref_, ref_ + ref_size_);
+            ref_ = nullptr;
+            ref_size_ = 0;
+        }
+        return v_;
+    }
+};
+
+// Header of the cache.
+// The arrays of nodes, triangles, triangle metadata, flattened nodes, and flattened indices follow the header
+// in this order, each of which is stored as the raw memory image
+// starting from the offset aligned to CacheAlignment.
+struct CacheHeader {
+    char magic[8];              // Magic number
+    int version;                // Version of the cache format
+    int build_mode;             // Construction parameters
+    BuildParams params;
+    long long num_nodes;        // Number of elements in the arrays
+    long long num_trs;
+    long long num_meta;
+    long long num_flattened_nodes;
+    long long num_flattened_indices;
+};
+
+constexpr char CacheMagic[8] = { 'L', 'M', 'S', 'A', 'H', 'B', 'V', 'H' };
+constexpr int CacheVersion = 4;
+
+// Alignment of the arrays in the cache.
+// The mapped file starts at a page boundary, so the arrays can be used in place.
+constexpr size_t CacheAlignment = 64;
+
+// Offsets of the arrays in the cache
+struct CacheLayout {
+    size_t offsets[5];  // Offsets of the arrays in the order of the header
+    size_t size;        // Total size of the cache
 };
 
+// Computes the layout of the cache from the header.
+// Returns nullopt if the numbers of elements are invalid for the given size of the cache.
+std::optional<CacheLayout> cache_layout(const CacheHeader& h, size_t max_size) {
+    const long long nums[5] = { h.num_nodes, h.num_trs, h.num_meta, h.num_flattened_nodes, h.num_flattened_indices };
+    const size_t elem_sizes[5] = { sizeof(Node), sizeof(Tri), sizeof(TriMeta), sizeof(FlattenedPrimitiveNode), sizeof(int) };
+    CacheLayout l;
+    size_t o = sizeof(CacheHeader);
+    for (int i = 0; i < 5; i++) {
+        if (nums[i] < 0 || size_t(nums[i]) > max_size / elem_sizes[i]) {
+            return {};
+        }
+        o = (o + CacheAlignment - 1) / CacheAlignment * CacheAlignment;
+        l.offsets[i] = o;
+        o += size_t(nums[i]) * elem_sizes[i];
+    }
+    l.size = o;
+    return l;
+}
+
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -97,38 +195,372 @@ struct Node {
 .. function:: accel::sahbvh
 
    Bounding volume hierarchy with surface area heuristics.
-   
+
+   :param str build_mode: Construction mode of the hierarchy (default: ``full``).
+                          ``full`` evaluates every split position by sorting the triangles.
+                          ``binned`` evaluates the splits on ``num_bins`` bins [Wald2007]_.
+   :param int num_bins: Number of bins per axis used in ``binned`` mode (default: 16).
+   :param int leaf_size: Nodes with less or equal number of triangles
+                         are always made leaves (default: 1).
+   :param float cost_traversal: Cost of traversing a node used in SAH (default: 1).
+   :param float cost_intersection: Cost of a ray-triangle intersection used in SAH (default: 1).
+
    Features
 
-   - Parallel construction.
-   - Split axis is determined by longest axis.
-   - Split position is determined by minimum SAH cost.
-   - Uses full-sort of underlying geometries.
+   - Task-parallel construction on the parallel subsystem.
+     The top levels are split with parallel binning and partitioning
+     in ``binned`` mode, or with full-sort SAH sorting the three axes in parallel
+     in ``full`` mode, and the subtrees below are built as independent tasks.
+     The top levels thus use the same SAH evaluation as the selected mode.
+   - Split axis and position are determined by minimum SAH cost.
+   - Uses full-sort or binning of underlying geometries.
+   - Nodes are packed into 32 bytes in depth-first order.
+   - Triangles are stored in leaf order in single precision.
+     Data only used in the construction or for the closest hit are stored separately.
+   - Traversal visits the nearer child first.
+   - Supports the accel cache of the scene.
+     The arrays are used in place from the memory-mapped cache without copying.
+   - Supports refitting for the scene updated only by transformations.
+   - Stream intersection shares the traversal among coherent rays (packet traversal).
    - Uses triangle intersection by Möller and Trumbore [Möller1997]_.
 
    .. [Möller1997] T. Möller & B. Trumbore.
                    Fast, Minimum Storage Ray-Triangle Intersection.
                    Journal of Graphics Tools. 2(1):21--28. 1997.
+   .. [Wald2007] I. Wald.
+                 On fast Construction of SAH-based Bounding Volume Hierarchies.
+                 Symposium on Interactive Ray Tracing. 2007.
 \endrst
 */
 class Accel_SAHBVH final : public Accel {
 private:
-    std::vector<Node> nodes_;                             // Nodes
-    std::vector<Tri> trs_;                                // Triangles
-    std::vector<int> indices_;                            // Triangle indices
-    std::vector<FlattenedPrimitiveNode> flattened_nodes_; // Flattened scene graph
-    
+    enum class BuildMode {
+        Full,
+        Binned,
+    };
+
+private:
+    BuildMode build_mode_;                                // Construction mode
+    BuildParams params_;                                  // Construction parameters
+    MappableArray<Node> nodes_;                           // Nodes in depth-first order
+    MappableArray<Tri> trs_;                              // Triangles in leaf order
+    MappableArray<TriMeta> meta_;                         // Triangle metadata in leaf order
+    MappableArray<FlattenedPrimitiveNode> flattened_nodes_; // Flattened scene graph
+    MappableArray<int> flattened_indices_;                // Indices of the triangles in leaf order in the flattened order (used in refit)
+    std::vector<BuildTri> build_trs_;                     // Triangles used in the construction (only in build)
+    std::vector<int> indices_;                            // Triangle indices (only in build)
+    std::shared_ptr<MappedFile> cache_;                   // Cache referred by the arrays (if loaded from the cache)
+
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(nodes_, trs_, indices_, flattened_nodes_);
+        ar(build_mode_, params_, nodes_, trs_, meta_, flattened_nodes_, flattened_indices_);
+    }
+
+public:
+    virtual void construct(const Json& prop) override {
+        const auto mode = json::value<std::string>(prop, "build_mode", "full");
+        if (mode == "full") {
+            build_mode_ = BuildMode::Full;
+        }
+        else if (mode == "binned") {
+            build_mode_ = BuildMode::Binned;
+        }
+        else {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid build mode [mode='{}']", mode);
+        }
+        params_.construct(prop, 1);
     }
 
 public:
     virtual void build(const Scene& scene) override {
         // Flatten the scene graph and setup triangle list
+        // The arrays referring to the cache are discarded.
         LM_INFO("Flattening scene");
+        nodes_.clear();
         trs_.clear();
+        meta_.clear();
         flattened_nodes_.clear();
+        flattened_indices_.clear();
+        cache_.reset();
+        flatten(scene, trs_.vec(), meta_.vec(), flattened_nodes_.vec());
+
+        // Setup the data used only in the construction
+        const int nt = int(trs_.size()); // Number of triangles
+        if (nt == 0) {
+            return;
+        }
+        build_trs_.resize(nt);
+        for (int i = 0; i < nt; i++) {
+            auto& bt = build_trs_[i];
+            bt.b = trs_[i].bound();
+            bt.c = bt.b.center();
+        }
+
+        // --------------------------------------------------------------------
+
+        std::vector<BuildNode> bn(2*nt-1); // Maximum number of nodes: 2*nt-1
+        std::atomic<int> nn = 1;           // Number of current nodes
+        indices_.assign(nt, 0);
+        std::iota(indices_.begin(), indices_.end(), 0);
+
+        // Build the top levels of the tree in breadth-first order.
+        // The splits of the large nodes are computed in parallel over the triangles.
+        // The nodes smaller than task_size are deferred as the subtree tasks.
+        struct Entry {
+            int index;
+            int start;
+            int end;
+            int depth;
+        };
+        const int task_size = std::max({ MinTaskSize, params_.leaf_size, nt / (4 * parallel::num_threads()) });
+        std::vector<Entry> tasks;
+        std::vector<Entry> level{ {0, 0, nt, 0} };
+        LM_INFO("Building top levels");
+        while (!level.empty()) {
+            std::vector<Entry> next;
+            for (const auto& [ni, s, e, depth] : level) {
+                if (e - s <= task_size || depth >= MaxDepth) {
+                    tasks.push_back({ ni, s, e, depth });
+                    continue;
+                }
+                auto& n = bn[ni];
+                Bound cb;
+                std::tie(n.b, cb) = bound_parallel(s, e);
+                const auto m = build_mode_ == BuildMode::Binned
+                    ? split_parallel(n.b, cb, s, e)
+                    : split_full_parallel(n.b, s, e);
+                if (!m) {
+                    n.leaf = 1;
+                    n.s = s;
+                    n.e = e;
+                    continue;
+                }
+                n.c1 = nn++;
+                n.c2 = nn++;
+                next.push_back({ n.c1, s, *m, depth + 1 });
+                next.push_back({ n.c2, *m, e, depth + 1 });
+            }
+            level.swap(next);
+        }
+
+        // Build the subtrees in parallel.
+        // Larger subtrees are processed first for load balancing.
+        LM_INFO("Building subtrees [tasks={}]", tasks.size());
+        std::sort(tasks.begin(), tasks.end(), [](const Entry& t1, const Entry& t2) {
+            return t1.end - t1.start > t2.end - t2.start;
+        });
+        parallel::foreach(tasks.size(), [&](long long i, int) {
+            const auto& t = tasks[i];
+            build_subtree(bn, nn, t.index, t.start, t.end, t.depth);
+        });
+
+        // Reorder the nodes in depth-first order and pack them
+        LM_INFO("Packing nodes");
+        nodes_.vec().reserve(nn);
+        pack(bn, 0);
+
+        // Reorder the triangles in leaf order so that the leaves refer to them directly
+        // and discard the data used only in the construction.
+        // The order is kept to locate the triangles in the refit.
+        LM_INFO("Reordering triangles");
+        std::vector<Tri> trs(nt);
+        std::vector<TriMeta> meta(nt);
+        for (int i = 0; i < nt; i++) {
+            trs[i] = trs_[indices_[i]];
+            meta[i] = meta_[indices_[i]];
+        }
+        trs_.vec().swap(trs);
+        meta_.vec().swap(meta);
+        std::vector<BuildTri>().swap(build_trs_);
+        flattened_indices_.vec().swap(indices_);
+        std::vector<int>().swap(indices_);
+        interleave();
+    };
+
+    virtual bool refit(const Scene& scene) override {
+        // Flatten the scene graph again with the updated transformations
+        LM_INFO("Flattening scene");
+        std::vector<Tri> trs;
+        std::vector<TriMeta> meta;
+        std::vector<FlattenedPrimitiveNode> flattened_nodes;
+        flatten(scene, trs, meta, flattened_nodes);
+
+        // Check if the structure of the scene is not changed before modifying anything.
+        // Each triangle in leaf order must be found at the recorded index
+        // in the flattened order with the same primitive and face.
+        if (nodes_.empty() || trs.size() != trs_.size() || flattened_nodes.size() != flattened_nodes_.size() ||
+            flattened_indices_.size() != trs_.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < flattened_nodes.size(); i++) {
+            if (flattened_nodes[i].primitive != flattened_nodes_[i].primitive) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < trs_.size(); i++) {
+            const int k = flattened_indices_[i];
+            if (k < 0 || k >= int(meta.size())) {
+                return false;
+            }
+            const auto& m = meta[k];
+            if (m.flattened_node != meta_[i].flattened_node || m.face != meta_[i].face) {
+                return false;
+            }
+        }
+
+        // Move the updated triangles to leaf order
+        flattened_nodes_.vec().swap(flattened_nodes);
+        auto& trs_owned = trs_.vec();
+        for (size_t i = 0; i < trs_owned.size(); i++) {
+            trs_owned[i] = trs[flattened_indices_[i]];
+        }
+
+        // Refit the bounds from bottom to top.
+        // In depth-first order, the children are always stored after the parent.
+        LM_INFO("Refitting nodes");
+        auto& nodes = nodes_.vec();
+        for (int i = int(nodes.size()) - 1; i >= 0; i--) {
+            auto& n = nodes[i];
+            if (n.leaf()) {
+                Bound b;
+                for (int j = n.offset; j < n.offset + n.count; j++) {
+                    b = merge(b, trs_owned[j].bound());
+                }
+                n.set_bound(b);
+                continue;
+            }
+            const auto& c1 = nodes[i + 1];
+            const auto& c2 = nodes[n.offset];
+            for (int a = 0; a < 3; a++) {
+                n.bmin[a] = std::min(c1.bmin[a], c2.bmin[a]);
+                n.bmax[a] = std::max(c1.bmax[a], c2.bmax[a]);
+            }
+        }
+        return true;
+    }
+
+    virtual bool save_cache(std::ostream& os) const override {
+        const auto h = cache_header();
+        const auto layout = cache_layout(h, std::numeric_limits<size_t>::max());
+        os.write(reinterpret_cast<const char*>(&h), sizeof(CacheHeader));
+        size_t pos = sizeof(CacheHeader);
+        const auto write = [&](const auto& v, size_t offset) {
+            // Pad to the aligned offset
+            const char zeros[CacheAlignment] = {};
+            os.write(zeros, offset - pos);
+            os.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(v[0]));
+            pos = offset + v.size() * sizeof(v[0]);
+        };
+        write(nodes_, layout->offsets[0]);
+        write(trs_, layout->offsets[1]);
+        write(meta_, layout->offsets[2]);
+        write(flattened_nodes_, layout->offsets[3]);
+        write(flattened_indices_, layout->offsets[4]);
+        return bool(os);
+    }
+
+    virtual bool load_cache(const std::shared_ptr<MappedFile>& file) override {
+        // Check if the cache is built with the same parameters
+        const auto* data = static_cast<const char*>(file->data());
+        const auto size = file->size();
+        if (size < sizeof(CacheHeader) || reinterpret_cast<std::uintptr_t>(data) % CacheAlignment != 0) {
+            return false;
+        }
+        CacheHeader h;
+        std::memcpy(&h, data, sizeof(CacheHeader));
+        const auto expected = cache_header();
+        if (std::memcmp(h.magic, CacheMagic, sizeof(CacheMagic)) != 0 ||
+            h.version != expected.version ||
+            h.build_mode != expected.build_mode ||
+            h.params.num_bins != expected.params.num_bins ||
+            h.params.leaf_size != expected.params.leaf_size ||
+            h.params.cost_traversal != expected.params.cost_traversal ||
+            h.params.cost_intersection != expected.params.cost_intersection) {
+            return false;
+        }
+        const auto layout = cache_layout(h, size);
+        if (!layout || layout->size != size) {
+            return false;
+        }
+
+        // Use the memory images of the arrays in place.
+        // The mapping is kept alive while the arrays refer to it.
+        nodes_.refer(data + layout->offsets[0], size_t(h.num_nodes));
+        trs_.refer(data + layout->offsets[1], size_t(h.num_trs));
+        meta_.refer(data + layout->offsets[2], size_t(h.num_meta));
+        flattened_nodes_.refer(data + layout->offsets[3], size_t(h.num_flattened_nodes));
+        flattened_indices_.refer(data + layout->offsets[4], size_t(h.num_flattened_indices));
+        cache_ = file;
+        return true;
+    }
+
+    virtual std::optional<Hit> intersect(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
+        Tri::Hit mh;
+        int mi = -1;
+        intersect_single(ray, tmin, tmax, mh, mi);
+        if (mi < 0) {
+            return {};
+        }
+        return make_hit(mh, mi);
+    }
+
+    virtual void intersect_stream(const RayStream& rays, Hit* hits) const override {
+        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
+        if (nodes_.empty()) {
+            for (int i = 0; i < rays.n; i++) {
+                hits[i] = Hit{ Inf, Vec2(0_f), Transform(), -1, -1 };
+            }
+            return;
+        }
+
+        // Sort the rays to make neighboring rays coherent
+        thread_local std::vector<int> order;
+        math::sort_rays_by_direction(rays, order);
+
+        // Process the rays in packets.
+        // Coherent packets share the traversal, otherwise rays are traversed one by one.
+        for (int i = 0; i < rays.n; i += PacketSize) {
+            const int m = std::min(PacketSize, rays.n - i);
+            const int* idx = &order[i];
+            if (m > 1 && coherent(rays, idx, m)) {
+                intersect_packet(rays, idx, m, hits);
+                continue;
+            }
+            for (int j = 0; j < m; j++) {
+                const int k = idx[j];
+                Tri::Hit mh;
+                int mi = -1;
+                Float tmax = rays.tmax[k];
+                intersect_single(rays.ray(k), rays.tmin[k], tmax, mh, mi);
+                hits[k] = mi < 0 ? Hit{ Inf, Vec2(0_f), Transform(), -1, -1 } : make_hit(mh, mi);
+            }
+        }
+    }
+
+    virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
+        bool hit = false;
+        traverse(ray, tmin, tmax, [&](const Node& n, Float&) {
+            // Terminate the traversal with the first intersection found
+            for (int i = n.offset; i < n.offset + n.count; i++) {
+                if (trs_[i].intersect(ray, tmin, tmax)) {
+                    hit = true;
+                    return true;
+                }
+            }
+            return false;
+        });
+        return hit;
+    }
+
+private:
+    // Flattens the scene graph and setup triangle list.
+    // The triangles are recorded in the order of the traversal.
+    static void flatten(const Scene& scene, std::vector<Tri>& trs, std::vector<TriMeta>& meta, std::vector<FlattenedPrimitiveNode>& flattened_nodes) {
+        trs.clear();
+        meta.clear();
+        flattened_nodes.clear();
         scene.traverse_primitive_nodes([&](const SceneNode& node, Mat4 global_transform) {
             if (node.type != SceneNodeType::Primitive) {
                 return;
@@ -138,164 +570,413 @@ public:
             }
 
             // Record flattened primitive
-            const int flattened_node_index = int(flattened_nodes_.size());
-            flattened_nodes_.push_back({ Transform(global_transform), node.index });
+            const int flattened_node_index = int(flattened_nodes.size());
+            flattened_nodes.push_back({ Transform(global_transform), node.index });
 
             // Record triangles
             node.primitive.mesh->foreach_triangle([&](int face, const Mesh::Tri& tri) {
                 const auto p1 = global_transform * Vec4(tri.p1.p, 1_f);
                 const auto p2 = global_transform * Vec4(tri.p2.p, 1_f);
                 const auto p3 = global_transform * Vec4(tri.p3.p, 1_f);
-                trs_.emplace_back(p1, p2, p3, flattened_node_index, face);
+                trs.emplace_back(p1, p2, p3);
+                meta.push_back({ flattened_node_index, face });
             });
         });
+    }
 
-        // --------------------------------------------------------------------
+    // Distributes the pages of the arrays accessed in the traversal across NUMA nodes.
+    // The arrays referring to the cache are shared with the page cache and left as they are.
+    void interleave() const {
+        if (cache_) {
+            return;
+        }
+        parallel::interleave_memory(nodes_.data(), nodes_.size() * sizeof(Node));
+        parallel::interleave_memory(trs_.data(), trs_.size() * sizeof(Tri));
+    }
 
-        const int nt = int(trs_.size()); // Number of triangles
-        struct Entry {
-            int index;
-            int start;
-            int end;
-        };
-        std::queue<Entry> q;            // Queue for traversal (node index, start, end)
-        q.push({0, 0, nt});             // Initialize the queue with root node
-        nodes_.assign(2*nt-1, {});      // Maximum number of nodes: 2*nt-1
-        indices_.assign(nt, 0);
-        std::iota(indices_.begin(), indices_.end(), 0);
-        std::mutex mu;                  // For concurrent queue
-        std::condition_variable cv;     // For concurrent queue
-        std::atomic<int> pr = 0;        // Processed triangles
-        std::atomic<int> nn = 1;        // Number of current nodes
-        bool done = 0;                  // True if the build process is done
-
-        auto process = [&]() {
-            while (!done) {
-                // Each step construct a node for the triangles ranges in [s,e)
-                auto [ni, s, e] = [&]() -> Entry {
-                    std::unique_lock<std::mutex> lk(mu);
-                    if (!done && q.empty()) {
-                        cv.wait(lk, [&]() { return done || !q.empty(); });
-                    }
-                    if (done) {
-                        return {};
-                    }
-                    auto v = q.front();
-                    q.pop();
-                    return v;
-                }();
-                if (done) {
-                    break;
-                }
+    // Makes the header of the cache for the current structure
+    CacheHeader cache_header() const {
+        static_assert(std::is_trivially_copyable_v<Node>);
+        static_assert(std::is_trivially_copyable_v<Tri>);
+        static_assert(std::is_trivially_copyable_v<TriMeta>);
+        static_assert(std::is_trivially_copyable_v<FlattenedPrimitiveNode>);
+        CacheHeader h{};
+        std::memcpy(h.magic, CacheMagic, sizeof(CacheMagic));
+        h.version = CacheVersion;
+        h.build_mode = int(build_mode_);
+        h.params = params_;
+        h.num_nodes = (long long)(nodes_.size());
+        h.num_trs = (long long)(trs_.size());
+        h.num_meta = (long long)(meta_.size());
+        h.num_flattened_nodes = (long long)(flattened_nodes_.size());
+        h.num_flattened_indices = (long long)(flattened_indices_.size());
+        return h;
+    }
+
+    // Minimum number of triangles processed in a subtree task
+    static constexpr int MinTaskSize = 4096;
+
+    // Number of triangles processed in a parallel task in the top levels
+    static constexpr int ChunkSize = 4096;
+
+    // Builds the subtree rooted at bn[ni] of the given depth for the triangles in [s,e) in the current thread
+    void build_subtree(std::vector<BuildNode>& bn, std::atomic<int>& nn, int ni, int s, int e, int depth) {
+        // Calculate the bound for the node
+        auto& n = bn[ni];
+        for (int i = s; i < e; i++) {
+            n.b = merge(n.b, build_trs_[indices_[i]].b);
+        }
 
-                // Calculate the bound for the node
-                Node& n = nodes_[ni];
-                for (int i = s; i < e; i++) {
-                    n.b = merge(n.b, trs_[indices_[i]].b);
+        // Selects a split axis and position according to SAH.
+        // Create a leaf node if the number of triangle is small enough, the depth reaches the limit,
+        // or no split is found.
+        std::optional<int> m;
+        if (e - s > params_.leaf_size && depth < MaxDepth) {
+            m = build_mode_ == BuildMode::Binned
+                ? split_binned(n.b, s, e)
+                : split_full(n.b, s, e);
+        }
+        if (!m) {
+            n.leaf = 1;
+            n.s = s;
+            n.e = e;
+            return;
+        }
+        n.c1 = nn++;
+        n.c2 = nn++;
+        build_subtree(bn, nn, n.c1, s, *m, depth + 1);
+        build_subtree(bn, nn, n.c2, *m, e, depth + 1);
+    }
+
+    // Number of rays in a packet
+    static constexpr int PacketSize = 16;
+
+    // Makes hit information from the triangle hit and the index of the triangle
+    Hit make_hit(const Tri::Hit& h, int i) const {
+        const auto& m = meta_[i];
+        const auto& fn = flattened_nodes_[m.flattened_node];
+        return Hit{ h.t, Vec2(h.u, h.v), fn.global_transform, fn.primitive, m.face };
+    }
+
+    // Finds the closest intersection of a single ray.
+    // mh and mi are updated if a hit closer than tmax is found.
+    void intersect_single(Ray ray, Float tmin, Float& tmax, Tri::Hit& mh, int& mi) const {
+        traverse(ray, tmin, tmax, [&](const Node& n, Float& tmax_) {
+            for (int i = n.offset; i < n.offset + n.count; i++) {
+                if (const auto h = trs_[i].intersect(ray, tmin, tmax_)) {
+                    mh = *h;
+                    tmax_ = h->t;
+                    mi = i;
                 }
+            }
+            return false;
+        });
+    }
 
-                // Function to sort the triangles according to the given axis
-                auto st = [&, s = s, e = e](int ax) {
-                    auto cmp = [&](int i1, int i2) {
-                        return trs_[i1].c[ax] < trs_[i2].c[ax];
-                    };
-                    std::sort(&indices_[s], &indices_[e-1]+1, cmp);
-                };
+    // Traverses the nodes visiting the nearer child first
+    template <typename IsectLeafFunc>
+    void traverse(Ray ray, Float tmin, Float& tmax, const IsectLeafFunc& isect_leaf) const {
+        bvh::traverse(nodes_.data(), nodes_.size(), ray, tmin, tmax, isect_leaf);
+    }
 
-                // Function to create a leaf node
-                auto make_leaf = [&, s = s, e = e]() {
-                    n.leaf = 1;
-                    n.s = s;
-                    n.e = e;
-                    pr += e - s;
-                    if (pr == int(trs_.size())) {
-                        std::unique_lock<std::mutex> lk(mu);
-                        done = 1;
-                        cv.notify_all();
-                    }
-                };
+    // Packs the nodes in the subtree rooted at bn[i] in depth-first order.
+    // Returns the index of the packed node.
+    int pack(const std::vector<BuildNode>& bn, int i) {
+        auto& nodes = nodes_.vec();
+        const int index = int(nodes.size());
+        nodes.emplace_back();
+        const auto& b = bn[i];
+        nodes[index].set_bound(b.b);
+        if (b.leaf) {
+            nodes[index].offset = b.s;
+            nodes[index].count = b.e - b.s;
+            return index;
+        }
+        pack(bn, b.c1);
+        const int c2 = pack(bn, b.c2);
+        // The recursive calls might reallocate the nodes
+        nodes[index].offset = c2;
+        nodes[index].count = 0;
+        return index;
+    }
 
-                // Create a leaf node if the number of triangle is 1
-                if (e - s < 2) {
-                    make_leaf();
-                    continue;
+    // Checks if the rays in the packet are coherent enough to share the traversal.
+    // We require the directions to be in the same octant and within a cone.
+    bool coherent(const RayStream& rays, const int* idx, int m) const {
+        const auto d0 = glm::normalize(rays.ray(idx[0]).d);
+        for (int j = 1; j < m; j++) {
+            const auto d = glm::normalize(rays.ray(idx[j]).d);
+            for (int a = 0; a < 3; a++) {
+                if (std::signbit(d[a]) != std::signbit(d0[a])) {
+                    return false;
+                }
+            }
+            if (glm::dot(d, d0) < .9_f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Finds the closest intersections of a packet of rays.
+    // The rays in the packet share the traversal stack
+    // and a node is visited if any of the active rays intersects with the node.
+    void intersect_packet(const RayStream& rays, const int* idx, int m, Hit* hits) const {
+        Ray rs[PacketSize];
+        Float tmin[PacketSize];
+        Float tmax[PacketSize];
+        Tri::Hit mh[PacketSize];
+        int mi[PacketSize];
+        bvh::RayInv rinv[PacketSize];
+        for (int j = 0; j < m; j++) {
+            rs[j] = rays.ray(idx[j]);
+            rinv[j] = bvh::RayInv(rs[j]);
+            tmin[j] = rays.tmin[idx[j]];
+            tmax[j] = rays.tmax[idx[j]];
+            mi[j] = -1;
+        }
+        int s[MaxDepth + 2]{};  // Two entries are pushed per level
+        int si = 0;
+        while (si >= 0) {
+            const int ni = s[si--];
+            const auto& n = nodes_[ni];
+
+            // Find rays intersecting with the node
+            unsigned int active = 0;
+            for (int j = 0; j < m; j++) {
+                Float t;
+                if (n.isect(rinv[j], tmin[j], tmax[j], t)) {
+                    active |= 1u << j;
                 }
+            }
+            if (active == 0) {
+                continue;
+            }
+            if (!n.leaf()) {
+                assert(si + 2 < MaxDepth + 2);
+                s[++si] = n.offset;
+                s[++si] = ni + 1;
+                continue;
+            }
 
-                // Selects a split axis and position according to SAH
-                Float b = Inf;
-                int bi = -1, ba = -1;
-                for (int a = 0; a < 3; a++) {
-                    thread_local std::vector<Float> l(nt+1), r(nt+1);
-                    st(a);
-                    Bound bl, br;
-                    for (int i = 0; i <= e - s; i++) {
-                        int j = e - s - i;
-                        l[i] = bl.surface_area() * i;
-                        r[j] = br.surface_area() * i;
-                        bl = i < e - s ? merge(bl, trs_[indices_[s+i]].b) : bl;
-                        br = j > 0 ? merge(br, trs_[indices_[s+j-1]].b) : br;
+            // Intersect the active rays with the triangles in the leaf
+            for (int i = n.offset; i < n.offset + n.count; i++) {
+                const auto& tr = trs_[i];
+                for (int j = 0; j < m; j++) {
+                    if (!(active & (1u << j))) {
+                        continue;
                     }
-                    for (int i = 1; i < e - s; i++) {
-                        const auto c = 1_f + (l[i]+r[i])/n.b.surface_area();
-                        if (c < b) {
-                            b = c;
-                            bi = i;
-                            ba = a;
-                        }
+                    if (const auto h = tr.intersect(rs[j], tmin[j], tmax[j])) {
+                        mh[j] = *h;
+                        tmax[j] = h->t;
+                        mi[j] = i;
                     }
                 }
-                if (b > e - s) {
-                    make_leaf();
-                    continue;
-                }
-                st(ba);
-                int m = s + bi;
-                std::unique_lock<std::mutex> lk(mu);
-                q.push({n.c1 = nn++, s, m});
-                q.push({n.c2 = nn++, m, e});
-                cv.notify_one();
             }
+        }
+        for (int j = 0; j < m; j++) {
+            hits[idx[j]] = mi[j] < 0 ? Hit{ Inf, Vec2(0_f), Transform(), -1, -1 } : make_hit(mh[j], mi[j]);
+        }
+    }
+
+    // Evaluates SAH for all split positions by sorting the triangles in [s,e) along each axis.
+    // Returns the split position or nullopt if making a leaf is cheaper.
+    std::optional<int> split_full(const Bound& nb, int s, int e) {
+        // Function to sort the triangles according to the given axis
+        const auto st = [&](int ax) {
+            const auto cmp = [&](int i1, int i2) {
+                return build_trs_[i1].c[ax] < build_trs_[i2].c[ax];
+            };
+            std::sort(&indices_[s], &indices_[e-1]+1, cmp);
         };
-        LM_INFO("Building");
-        std::vector<std::thread> ths(std::thread::hardware_concurrency());
-        for (auto& th : ths) {
-            th = std::thread(process);
+
+        Float b = Inf;
+        int bi = -1, ba = -1;
+        for (int a = 0; a < 3; a++) {
+            thread_local std::vector<Float> l, r;
+            l.resize(std::max(int(l.size()), e - s + 1));
+            r.resize(std::max(int(r.size()), e - s + 1));
+            st(a);
+            Bound bl, br;
+            for (int i = 0; i <= e - s; i++) {
+                int j = e - s - i;
+                l[i] = bl.surface_area() * i;
+                r[j] = br.surface_area() * i;
+                bl = i < e - s ? merge(bl, build_trs_[indices_[s+i]].b) : bl;
+                br = j > 0 ? merge(br, build_trs_[indices_[s+j-1]].b) : br;
+            }
+            for (int i = 1; i < e - s; i++) {
+                const auto c = params_.cost_traversal + params_.cost_intersection * (l[i]+r[i]) / nb.surface_area();
+                if (c < b) {
+                    b = c;
+                    bi = i;
+                    ba = a;
+                }
+            }
         }
-        for (auto& th : ths) {
-            th.join();
+        if (ba < 0 || b > params_.cost_intersection * (e - s)) {
+            return {};
         }
-    };
+        st(ba);
+        return s + bi;
+    }
 
-    virtual std::optional<Hit> intersect(Ray ray, Float tmin, Float tmax) const override {
-        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
-        std::optional<Tri::Hit> mh, h;
-        int mi = -1;
-        int s[99]{};
-        int si = 0;
-        while (si >= 0) {
-            auto& n = nodes_.at(s[si--]);
-            if (!n.b.isect(ray, tmin, tmax)) {
-                continue;
+    // Parallel version of split_full for the large nodes.
+    // The triangles are sorted and the split positions are evaluated for the three axes in parallel.
+    std::optional<int> split_full_parallel(const Bound& nb, int s, int e) {
+        const int n = e - s;
+        std::vector<int> sorted[3];
+        Float bs[3] = { Inf, Inf, Inf };
+        int bis[3] = { -1, -1, -1 };
+        parallel::foreach(3, [&](long long ax, int) {
+            const int a = int(ax);
+            auto& idx = sorted[a];
+            idx.assign(&indices_[s], &indices_[e-1]+1);
+            std::sort(idx.begin(), idx.end(), [&](int i1, int i2) {
+                return build_trs_[i1].c[a] < build_trs_[i2].c[a];
+            });
+            std::vector<Float> r(n + 1);
+            Bound br;
+            for (int i = 0; i <= n; i++) {
+                int j = n - i;
+                r[j] = br.surface_area() * i;
+                br = j > 0 ? merge(br, build_trs_[idx[j-1]].b) : br;
+            }
+            Bound bl = build_trs_[idx[0]].b;
+            for (int i = 1; i < n; i++) {
+                const auto c = params_.cost_traversal + params_.cost_intersection * (bl.surface_area()*i + r[i]) / nb.surface_area();
+                if (c < bs[a]) {
+                    bs[a] = c;
+                    bis[a] = i;
+                }
+                bl = merge(bl, build_trs_[idx[i]].b);
             }
-            if (!n.leaf) {
-                s[++si] = n.c1;
-                s[++si] = n.c2;
+        });
+
+        // Select the axis in the same order as split_full
+        Float b = Inf;
+        int ba = -1;
+        for (int a = 0; a < 3; a++) {
+            if (bis[a] >= 0 && bs[a] < b) {
+                b = bs[a];
+                ba = a;
+            }
+        }
+        if (ba < 0 || b > params_.cost_intersection * n) {
+            return {};
+        }
+        std::copy(sorted[ba].begin(), sorted[ba].end(), &indices_[s]);
+        return s + bis[ba];
+    }
+
+    // Splits the triangles in [s,e) with binned SAH.
+    // Returns the split position or nullopt if making a leaf is cheaper.
+    std::optional<int> split_binned(const Bound& nb, int s, int e) {
+        const auto m = bvh::split_binned(params_, nb, &indices_[s], e - s,
+            [&](int i) { return build_trs_[i].b; },
+            [&](int i) { return build_trs_[i].c; });
+        if (!m) {
+            return {};
+        }
+        return s + *m;
+    }
+
+    // Computes the bound of the triangles and the bound of their centroids in [s,e) in parallel
+    std::tuple<Bound, Bound> bound_parallel(int s, int e) const {
+        const int nc = (e - s + ChunkSize - 1) / ChunkSize;
+        std::vector<Bound> bs(nc), cbs(nc);
+        parallel::foreach(nc, [&](long long c, int) {
+            const int cs = s + int(c) * ChunkSize;
+            const int ce = std::min(cs + ChunkSize, e);
+            for (int i = cs; i < ce; i++) {
+                const auto& bt = build_trs_[indices_[i]];
+                bs[c] = merge(bs[c], bt.b);
+                cbs[c] = merge(cbs[c], bt.c);
+            }
+        });
+        Bound b, cb;
+        for (int c = 0; c < nc; c++) {
+            b = merge(b, bs[c]);
+            cb = merge(cb, cbs[c]);
+        }
+        return { b, cb };
+    }
+
+    // Parallel version of split_binned for the large nodes.
+    // The triangles are binned and partitioned in parallel over the chunks of the range.
+    std::optional<int> split_parallel(const Bound& nb, const Bound& cb, int s, int e) {
+        // Assign triangles to the bins of each chunk for all axes
+        const int nc = (e - s + ChunkSize - 1) / ChunkSize;
+        const int num_bins = params_.num_bins;
+        const auto bin_index = [&](int ax, int i) {
+            return bvh::bin_index(params_, cb, ax, build_trs_[i].c);
+        };
+        std::vector<Bin> chunk_bins(nc * 3 * num_bins);
+        parallel::foreach(nc, [&](long long c, int) {
+            const int cs = s + int(c) * ChunkSize;
+            const int ce = std::min(cs + ChunkSize, e);
+            for (int a = 0; a < 3; a++) {
+                if (cb.max[a] <= cb.min[a]) {
+                    continue;
+                }
+                auto* bins = &chunk_bins[(c * 3 + a) * num_bins];
+                for (int i = cs; i < ce; i++) {
+                    auto& bin = bins[bin_index(a, indices_[i])];
+                    bin.b = merge(bin.b, build_trs_[indices_[i]].b);
+                    bin.n++;
+                }
+            }
+        });
+
+        // Merge the bins and evaluate the splits
+        std::vector<Bin> bins;
+        Float b = Inf;
+        int bi = -1, ba = -1;
+        for (int a = 0; a < 3; a++) {
+            if (cb.max[a] <= cb.min[a]) {
                 continue;
             }
-            for (int i = n.s; i < n.e; i++) {
-                if (h = trs_[indices_[i]].intersect(ray, tmin, tmax)) {
-                    mh = h;
-                    tmax = h->t;
-                    mi = i;
+            bins.assign(num_bins, {});
+            for (int c = 0; c < nc; c++) {
+                for (int j = 0; j < num_bins; j++) {
+                    const auto& cbin = chunk_bins[(c * 3 + a) * num_bins + j];
+                    bins[j].b = merge(bins[j].b, cbin.b);
+                    bins[j].n += cbin.n;
                 }
             }
+            if (bvh::sweep_bins(params_, bins.data(), nb, e - s, b, bi)) {
+                ba = a;
+            }
         }
-        if (!mh) {
+        if (ba < 0 || b > params_.cost_intersection * (e - s)) {
             return {};
         }
-        const auto& tr = trs_.at(indices_.at(mi));
-        const auto& fn = flattened_nodes_.at(tr.flattened_node);
-        return Hit{ tmax, Vec2(mh->u, mh->v), fn.global_transform, fn.primitive, tr.face };
+
+        // Count the triangles in the left partition for each chunk
+        const auto left = [&](int i) {
+            return bin_index(ba, i) <= bi;
+        };
+        std::vector<int> nl(nc + 1, 0);
+        parallel::foreach(nc, [&](long long c, int) {
+            const int cs = s + int(c) * ChunkSize;
+            const int ce = std::min(cs + ChunkSize, e);
+            nl[c + 1] = int(std::count_if(&indices_[cs], &indices_[ce-1]+1, left));
+        });
+        std::partial_sum(nl.begin(), nl.end(), nl.begin());
+
+        // Scatter the indices to the partitions preserving the order in the chunks
+        std::vector<int> tmp(e - s);
+        parallel::foreach(nc, [&](long long c, int) {
+            const int cs = s + int(c) * ChunkSize;
+            const int ce = std::min(cs + ChunkSize, e);
+            int li = nl[c];
+            int ri = nl[nc] + (cs - s) - nl[c];
+            for (int i = cs; i < ce; i++) {
+                tmp[left(indices_[i]) ? li++ : ri++] = indices_[i];
+            }
+        });
+        std::copy(tmp.begin(), tmp.end(), &indices_[s]);
+        return s + nl[nc];
     }
 };
 
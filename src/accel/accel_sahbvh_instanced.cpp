@@ -0,0 +1,381 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include <lm/core.h>
+#include <lm/accel.h>
+#include <lm/scene.h>
+#include <lm/mesh.h>
+#include <lm/parallel.h>
+#include "bvh.h"
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+
+namespace {
+
+using bvh::FlattenedPrimitiveNode;
+using bvh::Tri;
+using bvh::BuildParams;
+using bvh::Node;
+using bvh::MaxDepth;
+
+// BVH over the items specified by their bounds.
+// Used for both the bottom-level hierarchies over triangles
+// and the top-level hierarchy over instances.
+struct BVH {
+    std::vector<Node> nodes;    // Nodes in depth-first order
+    std::vector<int> indices;   // Item indices
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(nodes, indices);
+    }
+
+    // Builds the hierarchy with binned SAH [Wald 2007]
+    void build(const std::vector<Bound>& bs, const BuildParams& p) {
+        nodes.clear();
+        indices.clear();
+        const int n = int(bs.size());
+        if (n == 0) {
+            return;
+        }
+        std::vector<Vec3> cs(n);
+        for (int i = 0; i < n; i++) {
+            cs[i] = bs[i].center();
+        }
+        indices.assign(n, 0);
+        std::iota(indices.begin(), indices.end(), 0);
+        nodes.reserve(2*n-1);
+        build_node(bs, cs, p, 0, n, 0);
+    }
+
+    // Traverses the nodes visiting the nearer child first.
+    // See bvh::traverse for the details.
+    template <typename IsectLeafFunc>
+    bool traverse(Ray ray, Float tmin, Float& tmax, const IsectLeafFunc& isect_leaf) const {
+        return bvh::traverse(nodes.data(), nodes.size(), ray, tmin, tmax, isect_leaf);
+    }
+
+private:
+    // Builds the subtree of the given depth for the items in [s,e) in depth-first order.
+    // Returns the index of the node.
+    int build_node(const std::vector<Bound>& bs, const std::vector<Vec3>& cs, const BuildParams& p, int s, int e, int depth) {
+        Bound b;
+        for (int i = s; i < e; i++) {
+            b = merge(b, bs[indices[i]]);
+        }
+        const int index = int(nodes.size());
+        nodes.emplace_back();
+        nodes[index].set_bound(b);
+        std::optional<int> m;
+        if (e - s > p.leaf_size && depth < MaxDepth) {
+            m = bvh::split_binned(p, b, &indices[s], e - s,
+                [&](int i) { return bs[i]; },
+                [&](int i) { return cs[i]; });
+        }
+        if (!m) {
+            nodes[index].offset = s;
+            nodes[index].count = e - s;
+            return index;
+        }
+        build_node(bs, cs, p, s, s + *m, depth + 1);
+        const int c2 = build_node(bs, cs, p, s + *m, e, depth + 1);
+        nodes[index].offset = c2;
+        nodes[index].count = 0;
+        return index;
+    }
+};
+
+// Bottom-level hierarchy created for each unique instance group.
+// The triangles are stored in the local coordinates of the instance group.
+struct BottomLevel {
+    BVH bvh;                                            // Hierarchy over the triangles
+    std::vector<Tri> trs;                               // Triangles
+    std::vector<FlattenedPrimitiveNode> flattened_nodes; // Flattened primitives in the group
+    Bound bound;                                        // Bound of the triangles
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(bvh, trs, flattened_nodes, bound);
+    }
+};
+
+// Instance of a bottom-level hierarchy
+struct Instance {
+    int bottom_level;       // Index of the bottom-level hierarchy
+    Transform transform;    // Transform from the instance to world coordinates
+    Mat4 inv;               // Transform from world to the instance coordinates
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(bottom_level, transform, inv);
+    }
+};
+
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+\rst
+.. function:: accel::sahbvhinstanced
+
+   Two-level bounding volume hierarchy with surface area heuristics supporting instancing.
+
+   :param int num_bins: Number of bins per axis used in the construction (default: 16).
+   :param int leaf_size: Nodes with less or equal number of items
+                         are always made leaves (default: 1).
+   :param float cost_traversal: Cost of traversing a node used in SAH (default: 1).
+   :param float cost_intersection: Cost of an intersection with an item used in SAH (default: 1).
+
+   Unlike ``accel::sahbvh``, which bakes the global transformation into the copies of the triangles,
+   this accel builds a bottom-level hierarchy once for each unique instance group
+   created by :cpp:func:`lm::Scene::create_instance_group_node`
+   and a top-level hierarchy over the transformed bounds of the instances.
+   The rays are transformed into the local coordinates of the instance
+   when the traversal enters a bottom-level hierarchy.
+   The primitives not belonging to any instance group are stored in a separate bottom-level
+   hierarchy with the identity transformation.
+   As with ``accel::embreeinstanced``, only single-level instancing is supported.
+   Instance groups nested inside an instance group are flattened.
+
+   Features
+
+   - Parallel construction of bottom-level hierarchies.
+   - Split axis and position are determined by minimum SAH cost with binning [Wald2007]_.
+   - Nodes are packed into 32 bytes in depth-first order.
+   - Traversal visits the nearer child first.
+   - Memory usage is proportional to the number of unique triangles and the number of instances.
+\endrst
+*/
+class Accel_SAHBVH_Instanced final : public Accel {
+private:
+    BuildParams params_;                        // Construction parameters
+    std::vector<BottomLevel> bottom_levels_;    // Bottom-level hierarchies (index 0: root)
+    std::vector<Instance> instances_;           // Instances
+    BVH top_level_;                             // Top-level hierarchy over the instances
+
+public:
+    LM_SERIALIZE_IMPL(ar) {
+        ar(params_, bottom_levels_, instances_, top_level_);
+    }
+
+public:
+    virtual void construct(const Json& prop) override {
+        params_.construct(prop, 1);
+    }
+
+public:
+    virtual void build(const Scene& scene) override {
+        exception::ScopedDisableFPEx guard_;
+        bottom_levels_.clear();
+        instances_.clear();
+
+        // Flatten the scene with single-level instance group
+        LM_INFO("Flattening scene");
+        flatten(scene);
+
+        // Build bottom-level hierarchies
+        LM_INFO("Building bottom-level hierarchies [num={}]", bottom_levels_.size());
+        parallel::foreach(bottom_levels_.size(), [&](long long index, int) {
+            auto& bl = bottom_levels_[index];
+            std::vector<Bound> bs(bl.trs.size());
+            for (size_t i = 0; i < bl.trs.size(); i++) {
+                bs[i] = bl.trs[i].bound();
+                bl.bound = merge(bl.bound, bs[i]);
+            }
+            bl.bvh.build(bs, params_);
+        });
+
+        // Build top-level hierarchy over the transformed bounds of the instances.
+        // Instances of the empty bottom-level hierarchies are removed.
+        LM_INFO("Building top-level hierarchy");
+        instances_.erase(std::remove_if(instances_.begin(), instances_.end(), [&](const Instance& inst) {
+            return bottom_levels_[inst.bottom_level].trs.empty();
+        }), instances_.end());
+        std::vector<Bound> bs(instances_.size());
+        for (size_t i = 0; i < instances_.size(); i++) {
+            const auto& inst = instances_[i];
+            const auto& b = bottom_levels_[inst.bottom_level].bound;
+            for (int j = 0; j < 8; j++) {
+                const Vec3 p(
+                    (j & 1) ? b.max.x : b.min.x,
+                    (j & 2) ? b.max.y : b.min.y,
+                    (j & 4) ? b.max.z : b.min.z);
+                bs[i] = merge(bs[i], Vec3(inst.transform.M * Vec4(p, 1_f)));
+            }
+        }
+        top_level_.build(bs, params_);
+
+        // Distribute the pages of the bottom-level hierarchies across NUMA nodes
+        for (const auto& bl : bottom_levels_) {
+            parallel::interleave_memory(bl.bvh.nodes.data(), bl.bvh.nodes.size() * sizeof(Node));
+            parallel::interleave_memory(bl.trs.data(), bl.trs.size() * sizeof(Tri));
+        }
+    }
+
+    virtual std::optional<Hit> intersect(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
+        Tri::Hit mh;
+        int mi = -1;    // Index of the intersected triangle
+        int minst = -1; // Index of the intersected instance
+        top_level_.traverse(ray, tmin, tmax, [&](const Node& n, Float& tmax_) {
+            for (int i = n.offset; i < n.offset + n.count; i++) {
+                // Traverse the bottom-level hierarchy with the ray in the instance coordinates.
+                // The distances are not changed by the transformation because
+                // the transformed direction is not normalized.
+                const int k = top_level_.indices[i];
+                const auto& inst = instances_[k];
+                const auto& bl = bottom_levels_[inst.bottom_level];
+                const auto local_ray = to_local(inst, ray);
+                bl.bvh.traverse(local_ray, tmin, tmax_, [&](const Node& m, Float& tmax2) {
+                    for (int j = m.offset; j < m.offset + m.count; j++) {
+                        const int l = bl.bvh.indices[j];
+                        if (const auto h = bl.trs[l].intersect(local_ray, tmin, tmax2)) {
+                            mh = *h;
+                            tmax2 = h->t;
+                            mi = l;
+                            minst = k;
+                        }
+                    }
+                    return false;
+                });
+            }
+            return false;
+        });
+        if (mi < 0) {
+            return {};
+        }
+
+        // Store hit information
+        const auto& inst = instances_[minst];
+        const auto& bl = bottom_levels_[inst.bottom_level];
+        const auto& tr = bl.trs[mi];
+        const auto& fn = bl.flattened_nodes[tr.flattened_node];
+        return Hit{
+            mh.t,
+            Vec2(mh.u, mh.v),
+            inst.bottom_level == 0
+                ? fn.global_transform
+                : Transform(inst.transform.M * fn.global_transform.M),
+            fn.primitive,
+            tr.face
+        };
+    }
+
+    virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
+        return top_level_.traverse(ray, tmin, tmax, [&](const Node& n, Float&) {
+            // Terminate the traversal with the first intersection found
+            for (int i = n.offset; i < n.offset + n.count; i++) {
+                const auto& inst = instances_[top_level_.indices[i]];
+                const auto& bl = bottom_levels_[inst.bottom_level];
+                const auto local_ray = to_local(inst, ray);
+                Float tmax_ = tmax;
+                const bool hit = bl.bvh.traverse(local_ray, tmin, tmax_, [&](const Node& m, Float&) {
+                    for (int j = m.offset; j < m.offset + m.count; j++) {
+                        if (bl.trs[bl.bvh.indices[j]].intersect(local_ray, tmin, tmax)) {
+                            return true;
+                        }
+                    }
+                    return false;
+                });
+                if (hit) {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+private:
+    // Transforms the ray into the coordinates of the instance
+    static Ray to_local(const Instance& inst, Ray ray) {
+        return {
+            Vec3(inst.inv * Vec4(ray.o, 1_f)),
+            Vec3(inst.inv * Vec4(ray.d, 0_f))
+        };
+    }
+
+    // Flattens the scene graph into bottom-level hierarchies and instances.
+    // The primitives out of instance groups are recorded in the root (index 0)
+    // with the global transformations baked into the triangles.
+    // The primitives in an instance group are recorded once in the coordinates of the group.
+    void flatten(const Scene& scene) {
+        // Node index -> index of bottom-level hierarchy
+        std::unordered_map<int, int> node_to_bottom_level_map;
+        using VisitSceneNodeFunc = std::function<void(const SceneNode&, Mat4, int, bool)>;
+        VisitSceneNodeFunc visit_scene_node = [&](const SceneNode& node, Mat4 global_transform, int bottom_level_index, bool ignore_instance_group) {
+            // Primitive node type
+            if (node.type == SceneNodeType::Primitive) {
+                if (!node.primitive.mesh) {
+                    return;
+                }
+
+                // Record flattened primitive
+                auto& bl = bottom_levels_[bottom_level_index];
+                const int flattened_node_index = int(bl.flattened_nodes.size());
+                bl.flattened_nodes.push_back({ Transform(global_transform), node.index });
+
+                // Record triangles
+                node.primitive.mesh->foreach_triangle([&](int face, const Mesh::Tri& tri) {
+                    const auto p1 = global_transform * Vec4(tri.p1.p, 1_f);
+                    const auto p2 = global_transform * Vec4(tri.p2.p, 1_f);
+                    const auto p3 = global_transform * Vec4(tri.p3.p, 1_f);
+                    bl.trs.emplace_back(p1, p2, p3, flattened_node_index, face);
+                });
+                return;
+            }
+
+            // Group node type
+            if (node.type == SceneNodeType::Group) {
+                // Instance group
+                if (!ignore_instance_group && node.group.instanced) {
+                    // Create a new bottom-level hierarchy if not available.
+                    // The local transform of the group is applied inside the hierarchy.
+                    int index = -1;
+                    if (auto it = node_to_bottom_level_map.find(node.index); it != node_to_bottom_level_map.end()) {
+                        index = it->second;
+                    }
+                    else {
+                        index = int(bottom_levels_.size());
+                        node_to_bottom_level_map[node.index] = index;
+                        bottom_levels_.emplace_back();
+                        visit_scene_node(node, Mat4(1_f), index, true);
+                    }
+
+                    // Add instance
+                    instances_.push_back({ index, Transform(global_transform), glm::inverse(global_transform) });
+                    return;
+                }
+
+                // Apply local transform
+                Mat4 M = global_transform;
+                if (node.group.local_transform) {
+                    M *= *node.group.local_transform;
+                }
+
+                // Normal group
+                for (int child : node.group.children) {
+                    scene.visit_node(child, [&](const SceneNode& child_node) {
+                        visit_scene_node(child_node, M, bottom_level_index, ignore_instance_group);
+                    });
+                }
+                return;
+            }
+
+            LM_UNREACHABLE();
+        };
+        bottom_levels_.emplace_back();
+        instances_.push_back({ 0, Transform(Mat4(1_f)), Mat4(1_f) });
+        scene.visit_node(scene.root_node(), [&](const SceneNode& node) {
+            visit_scene_node(node, Mat4(1_f), 0, false);
+        });
+    }
+};
+
+LM_COMP_REG_IMPL(Accel_SAHBVH_Instanced, "accel::sahbvhinstanced");
+
+LM_NAMESPACE_END(LM_NAMESPACE)
@@ -0,0 +1,583 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include <lm/core.h>
+#include <lm/accel.h>
+#include <lm/scene.h>
+#include <lm/mesh.h>
+#include "bvh.h"
+
+// Use SSE/AVX kernels for the ray-bounds intersection of the child nodes.
+// SSE is available on all x64 targets. AVX is enabled only if the compiler targets it.
+#if LM_ARCH_X64 || defined(__SSE2__)
+#define WBVH_USE_SSE 1
+#else
+#define WBVH_USE_SSE 0
+#endif
+#if defined(__AVX__)
+#define WBVH_USE_AVX 1
+#else
+#define WBVH_USE_AVX 0
+#endif
+#if WBVH_USE_SSE || WBVH_USE_AVX
+#include <immintrin.h>
+#endif
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+
+namespace {
+
+using bvh::FlattenedPrimitiveNode;
+using bvh::Tri;
+using bvh::BuildParams;
+using bvh::MaxDepth;
+
+// Triangle information only used in the construction
+struct BuildTri {
+    Bound b;    // Bound of the triangle
+    Vec3 c;     // Center of the bound
+    int index;  // Index of the triangle
+};
+
+// Node of the intermediate binary tree
+struct BinaryNode {
+    Bound b;        // Bound of the node
+    int s, e;       // Range of triangle indices
+    int c1 = -1;    // Index to the child nodes (-1 for leaves)
+    int c2 = -1;
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// Scale applied to the far distances of the bound intersection.
+// This makes the float-precision test conservative [Ize 2013].
+constexpr float RobustScale = 1.f + 2.f * (3.f * std::numeric_limits<float>::epsilon() * .5f)
+    / (1.f - 3.f * std::numeric_limits<float>::epsilon() * .5f);
+
+// Converts a bound coordinate to float rounding toward the outside of the bound.
+// The error of the ray origin is accounted separately in RayF.
+float round_down(Float v) {
+    const auto f = float(v - glm::abs(v) * 1e-6_f);
+    return std::nextafter(f, -std::numeric_limits<float>::infinity());
+}
+float round_up(Float v) {
+    const auto f = float(v + glm::abs(v) * 1e-6_f);
+    return std::nextafter(f, std::numeric_limits<float>::infinity());
+}
+
+// Ray in float precision with precomputed inverse direction.
+// Rounding the origin to float moves the slabs relative to the ray by up to an ulp of the origin,
+// which is not covered by the padding of the bounds when the bound coordinates are near zero.
+// Thus the origin is shifted along each axis by the rounding error toward the direction
+// for the entry distances and away from the direction for the exit distances,
+// so that the float-precision slabs are never narrower than the double-precision ones.
+struct RayF {
+    float o_near[3];    // Origin for the entry distances
+    float o_far[3];     // Origin for the exit distances
+    float d_inv[3];     // Inverse of the direction
+    int neg[3];         // True if the direction is negative
+
+    RayF(Ray r) {
+        constexpr auto Inf = std::numeric_limits<float>::infinity();
+        for (int i = 0; i < 3; i++) {
+            d_inv[i] = float(1_f / r.d[i]);
+            neg[i] = std::signbit(d_inv[i]);
+            const auto err = glm::abs(r.o[i]) * Float(std::numeric_limits<float>::epsilon());
+            const auto lo = std::nextafter(float(r.o[i] - err), -Inf);
+            const auto hi = std::nextafter(float(r.o[i] + err), Inf);
+            o_near[i] = neg[i] ? lo : hi;
+            o_far[i] = neg[i] ? hi : lo;
+        }
+    }
+};
+
+// Node of wide BVH.
+// Bounds of the children are stored in SoA layout
+// so that the bounds can be tested with a single SIMD instruction.
+template <int N>
+struct LM_ALIGN_32 WideNode {
+    float bmin[3][N];   // Minimum coordinates of the child bounds for each axis
+    float bmax[3][N];   // Maximum coordinates of the child bounds for each axis
+    int child[N];       // Child node index or start of the triangle range for leaves (-1 for empty slots)
+    int count[N];       // Number of triangles for leaves (0 for inner nodes)
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < N; j++) {
+                ar(bmin[i][j], bmax[i][j]);
+            }
+        }
+        for (int j = 0; j < N; j++) {
+            ar(child[j], count[j]);
+        }
+    }
+};
+
+#if WBVH_USE_SSE
+// Intersects the ray with four child bounds starting from the k-th slot
+template <int N>
+int isect_children_sse(const WideNode<N>& n, int k, const RayF& r, float tmin, float tmax, float* t_near) {
+    auto tn = _mm_set1_ps(tmin);
+    auto tf = _mm_set1_ps(tmax);
+    for (int a = 0; a < 3; a++) {
+        const auto* lo = r.neg[a] ? n.bmax[a] : n.bmin[a];
+        const auto* hi = r.neg[a] ? n.bmin[a] : n.bmax[a];
+        const auto o_near = _mm_set1_ps(r.o_near[a]);
+        const auto o_far = _mm_set1_ps(r.o_far[a]);
+        const auto d_inv = _mm_set1_ps(r.d_inv[a]);
+        const auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(lo + k), o_near), d_inv);
+        const auto t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(hi + k), o_far), d_inv);
+        // Operand order is important: NaN in t1 or t2 selects the current range
+        tn = _mm_max_ps(t1, tn);
+        tf = _mm_min_ps(t2, tf);
+    }
+    tf = _mm_mul_ps(tf, _mm_set1_ps(RobustScale));
+    _mm_storeu_ps(t_near + k, tn);
+    return _mm_movemask_ps(_mm_cmple_ps(tn, tf)) << k;
+}
+#endif
+
+#if WBVH_USE_AVX
+// Intersects the ray with eight child bounds
+int isect_children_avx(const WideNode<8>& n, const RayF& r, float tmin, float tmax, float* t_near) {
+    auto tn = _mm256_set1_ps(tmin);
+    auto tf = _mm256_set1_ps(tmax);
+    for (int a = 0; a < 3; a++) {
+        const auto* lo = r.neg[a] ? n.bmax[a] : n.bmin[a];
+        const auto* hi = r.neg[a] ? n.bmin[a] : n.bmax[a];
+        const auto o_near = _mm256_set1_ps(r.o_near[a]);
+        const auto o_far = _mm256_set1_ps(r.o_far[a]);
+        const auto d_inv = _mm256_set1_ps(r.d_inv[a]);
+        const auto t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(lo), o_near), d_inv);
+        const auto t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(hi), o_far), d_inv);
+        tn = _mm256_max_ps(t1, tn);
+        tf = _mm256_min_ps(t2, tf);
+    }
+    tf = _mm256_mul_ps(tf, _mm256_set1_ps(RobustScale));
+    _mm256_storeu_ps(t_near, tn);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ));
+}
+#endif
+
+// Intersects the ray with all child bounds of the node.
+// Returns the bit mask of the intersected children
+// and writes the entry distances of the children to t_near.
+template <int N>
+int isect_children(const WideNode<N>& n, const RayF& r, float tmin, float tmax, float* t_near) {
+    #if WBVH_USE_AVX
+    if constexpr (N == 8) {
+        return isect_children_avx(n, r, tmin, tmax, t_near);
+    }
+    #endif
+    #if WBVH_USE_SSE
+    int mask = 0;
+    for (int k = 0; k < N; k += 4) {
+        mask |= isect_children_sse(n, k, r, tmin, tmax, t_near);
+    }
+    return mask;
+    #else
+    int mask = 0;
+    for (int j = 0; j < N; j++) {
+        float tn = tmin;
+        float tf = tmax;
+        for (int a = 0; a < 3; a++) {
+            const auto lo = r.neg[a] ? n.bmax[a][j] : n.bmin[a][j];
+            const auto hi = r.neg[a] ? n.bmin[a][j] : n.bmax[a][j];
+            const auto t1 = (lo - r.o_near[a]) * r.d_inv[a];
+            const auto t2 = (hi - r.o_far[a]) * r.d_inv[a];
+            tn = t1 > tn ? t1 : tn;
+            tf = t2 < tf ? t2 : tf;
+        }
+        tf *= RobustScale;
+        t_near[j] = tn;
+        if (tn <= tf) {
+            mask |= 1 << j;
+        }
+    }
+    return mask;
+    #endif
+}
+
+// ------------------------------------------------------------------------------------------------
+
+// Wide BVH with N children per node
+template <int N>
+struct WideBVH {
+    std::vector<WideNode<N>> nodes;
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(nodes);
+    }
+
+    // Collapses the binary tree into the wide tree
+    void build(const std::vector<BinaryNode>& bn) {
+        nodes.clear();
+        if (bn.empty()) {
+            return;
+        }
+        collapse(bn, 0);
+    }
+
+    // Creates a wide node from the binary node of index bi
+    int collapse(const std::vector<BinaryNode>& bn, int bi) {
+        // Gather up to N children by repeatedly opening the inner child with the largest surface area
+        int cs[N];
+        int nc = 0;
+        if (bn[bi].c1 < 0) {
+            cs[nc++] = bi;
+        }
+        else {
+            cs[nc++] = bn[bi].c1;
+            cs[nc++] = bn[bi].c2;
+        }
+        while (nc < N) {
+            int best = -1;
+            Float best_sa = -1_f;
+            for (int k = 0; k < nc; k++) {
+                const auto& c = bn[cs[k]];
+                if (c.c1 >= 0 && c.b.surface_area() > best_sa) {
+                    best = k;
+                    best_sa = c.b.surface_area();
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            const int o = cs[best];
+            cs[best] = bn[o].c1;
+            cs[nc++] = bn[o].c2;
+        }
+
+        // Create node
+        const int index = int(nodes.size());
+        nodes.emplace_back();
+        for (int j = 0; j < N; j++) {
+            auto& n = nodes[index];
+            if (j >= nc) {
+                // Empty slot never intersects with rays
+                for (int a = 0; a < 3; a++) {
+                    n.bmin[a][j] = std::numeric_limits<float>::infinity();
+                    n.bmax[a][j] = -std::numeric_limits<float>::infinity();
+                }
+                n.child[j] = -1;
+                n.count[j] = 0;
+                continue;
+            }
+            const auto& c = bn[cs[j]];
+            for (int a = 0; a < 3; a++) {
+                n.bmin[a][j] = round_down(c.b.min[a]);
+                n.bmax[a][j] = round_up(c.b.max[a]);
+            }
+            if (c.c1 < 0) {
+                n.child[j] = c.s;
+                n.count[j] = c.e - c.s;
+            }
+            else {
+                // Note that the recursive call might reallocate the nodes
+                const int child = collapse(bn, cs[j]);
+                nodes[index].child[j] = child;
+                nodes[index].count[j] = 0;
+            }
+        }
+
+        return index;
+    }
+
+    // Traverses the tree in front-to-back order.
+    // isect_leaf(s, e, tmax) is called for each intersected leaf
+    // and updates tmax if the closer intersection is found.
+    // The traversal terminates when isect_leaf returns true.
+    template <typename IsectLeafFunc>
+    void traverse(Ray ray, Float tmin, Float& tmax, const IsectLeafFunc& isect_leaf) const {
+        if (nodes.empty()) {
+            return;
+        }
+        struct Entry {
+            int index;  // Node index or start of the triangle range
+            int count;  // Number of triangles (0 for inner nodes)
+            float t;    // Entry distance
+        };
+        // The depth of the wide tree is at most the depth of the binary tree
+        // and each visited inner node replaces its entry with at most N entries.
+        constexpr int StackSize = 1 + (N - 1) * MaxDepth;
+        Entry stack[StackSize];
+        int si = 0;
+        const RayF r(ray);
+        const float tminf = std::nextafter(float(tmin), -std::numeric_limits<float>::infinity());
+        stack[si++] = { 0, 0, tminf };
+        while (si > 0) {
+            const auto e = stack[--si];
+            const float tmaxf = round_up(tmax);
+            if (e.t > tmaxf) {
+                continue;
+            }
+            if (e.count > 0) {
+                if (isect_leaf(e.index, e.index + e.count, tmax)) {
+                    return;
+                }
+                continue;
+            }
+
+            // Intersect with all children at once
+            const auto& n = nodes[e.index];
+            LM_ALIGN_32 float t_near[N];
+            const int mask = isect_children(n, r, tminf, tmaxf, t_near);
+            if (mask == 0) {
+                continue;
+            }
+
+            // Push intersected children in far-to-near order
+            // so that the nearest child is popped first
+            const int base = si;
+            assert(si + N <= StackSize);
+            for (int j = 0; j < N; j++) {
+                if (!(mask & (1 << j))) {
+                    continue;
+                }
+                const Entry c{ n.child[j], n.count[j], t_near[j] };
+                int k = si++;
+                while (k > base && stack[k-1].t < c.t) {
+                    stack[k] = stack[k-1];
+                    k--;
+                }
+                stack[k] = c;
+            }
+        }
+    }
+};
+
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+\rst
+.. function:: accel::wbvh
+
+   Wide bounding volume hierarchy.
+
+   :param int width: Number of children per node. 4 or 8 (default: 4).
+   :param int num_bins: Number of bins per axis used in the binned SAH construction (default: 16).
+   :param int leaf_size: Nodes with less or equal number of triangles
+                         are always made leaves (default: 4).
+   :param float cost_traversal: Cost of traversing a node used in SAH (default: 1).
+   :param float cost_intersection: Cost of a ray-triangle intersection used in SAH (default: 1).
+
+   Features
+
+   - Binary tree is constructed by binned SAH and then collapsed into 4-wide or 8-wide tree
+     by repeatedly opening the child with the largest surface area.
+   - Child bounds are stored in single precision with SoA layout and
+     tested with a single SSE (4-wide) or AVX (8-wide) instruction sequence.
+     AVX is used when the library is compiled for AVX targets,
+     otherwise 8-wide nodes are tested with two SSE instruction sequences.
+   - Children are traversed in front-to-back order.
+   - Stream intersection traverses the rays in the order sorted by direction.
+   - Triangles are stored in leaf order.
+   - Uses triangle intersection by Möller and Trumbore [Möller1997]_.
+
+   This accelerator does not require any external library.
+\endrst
+*/
+class Accel_WBVH final : public Accel {
+private:
+    int width_;                                           // Number of children per node
+    BuildParams params_;                                  // Construction parameters
+    std::vector<Tri> trs_;                                // Triangles in leaf order
+    std::vector<FlattenedPrimitiveNode> flattened_nodes_; // Flattened scene graph
+    WideBVH<4> bvh4_;                                     // Tree used when width_ = 4
+    WideBVH<8> bvh8_;                                     // Tree used when width_ = 8
+
+public:
+    LM_SERIALIZE_IMPL(ar) {
+        ar(width_, params_, trs_, flattened_nodes_, bvh4_, bvh8_);
+    }
+
+public:
+    virtual void construct(const Json& prop) override {
+        width_ = json::value<int>(prop, "width", 4);
+        params_.construct(prop, 4);
+        if (width_ != 4 && width_ != 8) {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Width must be 4 or 8 [width={}]", width_);
+        }
+    }
+
+public:
+    virtual void build(const Scene& scene) override {
+        exception::ScopedDisableFPEx guard_;
+
+        // Flatten the scene graph and setup triangle list
+        LM_INFO("Flattening scene");
+        std::vector<Tri> trs;
+        std::vector<BuildTri> bts;
+        flattened_nodes_.clear();
+        scene.traverse_primitive_nodes([&](const SceneNode& node, Mat4 global_transform) {
+            if (node.type != SceneNodeType::Primitive) {
+                return;
+            }
+            if (!node.primitive.mesh) {
+                return;
+            }
+
+            // Record flattened primitive
+            const int flattened_node_index = int(flattened_nodes_.size());
+            flattened_nodes_.push_back({ Transform(global_transform), node.index });
+
+            // Record triangles
+            node.primitive.mesh->foreach_triangle([&](int face, const Mesh::Tri& tri) {
+                const auto p1 = Vec3(global_transform * Vec4(tri.p1.p, 1_f));
+                const auto p2 = Vec3(global_transform * Vec4(tri.p2.p, 1_f));
+                const auto p3 = Vec3(global_transform * Vec4(tri.p3.p, 1_f));
+                Bound b;
+                b = merge(b, p1);
+                b = merge(b, p2);
+                b = merge(b, p3);
+                bts.push_back({ b, b.center(), int(trs.size()) });
+                trs.emplace_back(p1, p2, p3, flattened_node_index, face);
+            });
+        });
+
+        // Build intermediate binary tree
+        LM_INFO("Building binary tree");
+        std::vector<BinaryNode> bn;
+        if (!bts.empty()) {
+            bn.reserve(2 * bts.size() - 1);
+            build_binary(bn, bts, 0, int(bts.size()), 0);
+        }
+
+        // Reorder the triangles in leaf order
+        trs_.resize(trs.size());
+        for (size_t i = 0; i < bts.size(); i++) {
+            trs_[i] = trs[bts[i].index];
+        }
+
+        // Collapse into the wide tree
+        LM_INFO("Collapsing into {}-wide tree", width_);
+        bvh4_.nodes.clear();
+        bvh8_.nodes.clear();
+        if (width_ == 4) {
+            bvh4_.build(bn);
+        }
+        else {
+            bvh8_.build(bn);
+        }
+    }
+
+    virtual std::optional<Hit> intersect(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
+        Tri::Hit mh;
+        const int mi = intersect_closest(ray, tmin, tmax, mh);
+        if (mi < 0) {
+            return {};
+        }
+        return make_hit(mh, mi);
+    }
+
+    virtual void intersect_stream(const RayStream& rays, Hit* hits) const override {
+        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
+
+        // Traverse the rays in the order sorted by direction.
+        // Consecutive rays visit similar nodes, which improves the cache efficiency.
+        thread_local std::vector<int> order;
+        math::sort_rays_by_direction(rays, order);
+        for (int k : order) {
+            Tri::Hit mh;
+            const int mi = intersect_closest(rays.ray(k), rays.tmin[k], rays.tmax[k], mh);
+            hits[k] = mi < 0 ? Hit{ Inf, Vec2(0_f), Transform(), -1, -1 } : make_hit(mh, mi);
+        }
+    }
+
+    virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+        exception::ScopedDisableFPEx guard_;  // Disable floating point exceptions
+        bool hit = false;
+        const auto isect_leaf = [&](int s, int e, Float& tmax_) {
+            for (int i = s; i < e; i++) {
+                if (trs_[i].intersect(ray, tmin, tmax_)) {
+                    hit = true;
+                    return true;
+                }
+            }
+            return false;
+        };
+        if (width_ == 4) {
+            bvh4_.traverse(ray, tmin, tmax, isect_leaf);
+        }
+        else {
+            bvh8_.traverse(ray, tmin, tmax, isect_leaf);
+        }
+        return hit;
+    }
+
+private:
+    // Finds the closest intersection.
+    // Returns the index of the intersected triangle or -1 if no intersection is found.
+    int intersect_closest(Ray ray, Float tmin, Float tmax, Tri::Hit& mh) const {
+        int mi = -1;
+        const auto isect_leaf = [&](int s, int e, Float& tmax_) {
+            for (int i = s; i < e; i++) {
+                if (const auto h = trs_[i].intersect(ray, tmin, tmax_)) {
+                    mh = *h;
+                    tmax_ = h->t;
+                    mi = i;
+                }
+            }
+            return false;
+        };
+        if (width_ == 4) {
+            bvh4_.traverse(ray, tmin, tmax, isect_leaf);
+        }
+        else {
+            bvh8_.traverse(ray, tmin, tmax, isect_leaf);
+        }
+        return mi;
+    }
+
+    // Makes hit information from the triangle hit
+    Hit make_hit(const Tri::Hit& h, int i) const {
+        const auto& tr = trs_[i];
+        const auto& fn = flattened_nodes_[tr.flattened_node];
+        return Hit{ h.t, Vec2(h.u, h.v), fn.global_transform, fn.primitive, tr.face };
+    }
+
+    // Recursively builds the binary tree for the triangles in [s,e) with binned SAH.
+    // Returns index of the created node.
+    int build_binary(std::vector<BinaryNode>& bn, std::vector<BuildTri>& bts, int s, int e, int depth) {
+        const int index = int(bn.size());
+        bn.emplace_back();
+        Bound b;
+        for (int i = s; i < e; i++) {
+            b = merge(b, bts[i].b);
+        }
+        bn[index].b = b;
+        bn[index].s = s;
+        bn[index].e = e;
+
+        // Create a leaf node if the number of triangles is small enough
+        // or the depth reaches the limit
+        if (e - s <= params_.leaf_size || depth >= MaxDepth) {
+            return index;
+        }
+
+        // Split the triangles according to SAH
+        const auto m = bvh::split_binned(params_, b, &bts[s], e - s,
+            [](const BuildTri& t) { return t.b; },
+            [](const BuildTri& t) { return t.c; });
+        if (!m) {
+            return index;
+        }
+        const int c1 = build_binary(bn, bts, s, s + *m, depth + 1);
+        const int c2 = build_binary(bn, bts, s + *m, e, depth + 1);
+        bn[index].c1 = c1;
+        bn[index].c2 = c2;
+        return index;
+    }
+};
+
+LM_COMP_REG_IMPL(Accel_WBVH, "accel::wbvh");
+
+LM_NAMESPACE_END(LM_NAMESPACE)
@@ -0,0 +1,336 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#pragma once
+
+#include <lm/core.h>
+#include <lm/math.h>
+
+// Building blocks shared by the BVH-based accels (accel::sahbvh, accel::sahbvhinstanced, accel::wbvh)
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+LM_NAMESPACE_BEGIN(bvh)
+
+// Maximum depth of the hierarchies.
+// Deeper nodes are made leaves, which bounds the size of the traversal stacks.
+constexpr int MaxDepth = 64;
+
+// ------------------------------------------------------------------------------------------------
+
+// Primitive node with the global transformation baked in the scene graph traversal
+struct FlattenedPrimitiveNode {
+    Transform global_transform;	// Global transform of the primitive
+    int primitive;              // Primitive node index
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(global_transform, primitive);
+    }
+};
+
+// Hit information of a triangle
+struct TriHit {
+    Float t;     // Distance to the triangle
+    Float u, v;  // Hitpoint in barycentric coordinates
+};
+
+// Checks intersection of a ray with the triangle (p1, p1+e1, p1+e2) [Möller & Trumbore 1997]
+inline std::optional<TriHit> intersect_triangle(Ray r, Vec3 p1, Vec3 e1, Vec3 e2, Float tl, Float th) {
+    auto p = glm::cross(r.d, e2);
+    auto tv = r.o - p1;
+    auto q = glm::cross(tv, e1);
+    auto d = glm::dot(e1, p);
+    auto ad = glm::abs(d);
+    auto s = std::copysign(1_f, d);
+    auto u = glm::dot(tv, p) * s;
+    auto v = glm::dot(r.d, q) * s;
+    if (ad < 1e-8_f || u < 0_f || v < 0_f || u + v > ad) {
+        return {};
+    }
+    auto t = glm::dot(e2, q) / d;
+    if (t < tl || th < t) {
+        return {};
+    }
+    return TriHit{ t, u / ad, v / ad };
+}
+
+// Triangle with the information to make the hit
+struct Tri {
+    Vec3 p1;            // One vertex of the triangle
+    Vec3 e1, e2;        // Two edges incident to p1
+    int flattened_node; // Index of flattened primitive associated to the triangle
+    int face;           // Face index of the mesh associated to the triangle
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(p1, e1, e2, flattened_node, face);
+    }
+
+    using Hit = TriHit;
+
+    Tri() {}
+
+    Tri(Vec3 p1, Vec3 p2, Vec3 p3, int flattened_node, int face)
+        : p1(p1), e1(p2 - p1), e2(p3 - p1), flattened_node(flattened_node), face(face) {}
+
+    // Computes the bound of the triangle
+    Bound bound() const {
+        Bound b;
+        b = merge(b, p1);
+        b = merge(b, p1 + e1);
+        b = merge(b, p1 + e2);
+        return b;
+    }
+
+    std::optional<Hit> intersect(Ray r, Float tl, Float th) const {
+        return intersect_triangle(r, p1, e1, e2, tl, th);
+    }
+};
+
+// ------------------------------------------------------------------------------------------------
+
+// Parameters of the construction
+struct BuildParams {
+    int num_bins;               // Number of bins
+    int leaf_size;              // Number of items always stored in a leaf
+    Float cost_traversal;       // SAH cost of node traversal
+    Float cost_intersection;    // SAH cost of item intersection
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(num_bins, leaf_size, cost_traversal, cost_intersection);
+    }
+
+    // Loads the parameters from the properties of the accel
+    void construct(const Json& prop, int default_leaf_size) {
+        num_bins = json::value<int>(prop, "num_bins", 16);
+        leaf_size = json::value<int>(prop, "leaf_size", default_leaf_size);
+        cost_traversal = json::value<Float>(prop, "cost_traversal", 1_f);
+        cost_intersection = json::value<Float>(prop, "cost_intersection", 1_f);
+        if (num_bins < 2) {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Number of bins must be at least 2 [num_bins={}]", num_bins);
+        }
+    }
+};
+
+// Bin used in the binned construction
+struct Bin {
+    Bound b;    // Bound of the items in the bin
+    int n = 0;  // Number of items in the bin
+};
+
+// Computes the bin index of the centroid c along the axis ax.
+// cb is the bound of the centroids of the node.
+inline int bin_index(const BuildParams& p, const Bound& cb, int ax, Vec3 c) {
+    const auto t = (c[ax] - cb.min[ax]) / (cb.max[ax] - cb.min[ax]);
+    return glm::clamp(int(t * p.num_bins), 0, p.num_bins - 1);
+}
+
+// Evaluates SAH for the boundaries of the bins along an axis for a node with n items.
+// Updates the minimum cost b and the index of the bin bi left to the split
+// and returns true if a cheaper split is found.
+inline bool sweep_bins(const BuildParams& p, const Bin* bins, const Bound& nb, int n, Float& b, int& bi) {
+    // Sweep from right to compute the cost of the right partitions
+    thread_local std::vector<Float> r;
+    r.assign(p.num_bins, 0_f);
+    Bound br;
+    int nr = 0;
+    for (int j = p.num_bins - 1; j > 0; j--) {
+        br = merge(br, bins[j].b);
+        nr += bins[j].n;
+        r[j] = br.surface_area() * nr;
+    }
+
+    // Sweep from left and evaluate the split between j-th and (j+1)-th bins
+    bool found = false;
+    Bound bl;
+    int nl = 0;
+    for (int j = 0; j < p.num_bins - 1; j++) {
+        bl = merge(bl, bins[j].b);
+        nl += bins[j].n;
+        if (nl == 0 || nl == n) {
+            continue;
+        }
+        const auto c = p.cost_traversal + p.cost_intersection * (bl.surface_area() * nl + r[j+1]) / nb.surface_area();
+        if (c < b) {
+            b = c;
+            bi = j;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Evaluates SAH for the boundaries of the bins of the item centroids [Wald 2007]
+// and partitions the n items in linear time.
+// bound(item) and centroid(item) return the bound and the centroid of an item.
+// Returns the number of items in the left partition or nullopt if making a leaf is cheaper.
+template <typename T, typename BoundFunc, typename CentroidFunc>
+std::optional<int> split_binned(const BuildParams& p, const Bound& nb, T* items, int n, const BoundFunc& bound, const CentroidFunc& centroid) {
+    // Bound of the centroids
+    Bound cb;
+    for (int i = 0; i < n; i++) {
+        cb = merge(cb, centroid(items[i]));
+    }
+
+    thread_local std::vector<Bin> bins;
+    Float b = Inf;
+    int bi = -1, ba = -1;
+    for (int a = 0; a < 3; a++) {
+        // Skip the axis if all centroids are on the same position
+        if (cb.max[a] <= cb.min[a]) {
+            continue;
+        }
+
+        // Assign items to bins
+        bins.assign(p.num_bins, {});
+        for (int i = 0; i < n; i++) {
+            auto& bin = bins[bin_index(p, cb, a, centroid(items[i]))];
+            bin.b = merge(bin.b, bound(items[i]));
+            bin.n++;
+        }
+
+        // Evaluate the splits
+        if (sweep_bins(p, bins.data(), nb, n, b, bi)) {
+            ba = a;
+        }
+    }
+    if (ba < 0 || b > p.cost_intersection * n) {
+        return {};
+    }
+
+    // Partition the items according to the selected split
+    const auto* m = std::partition(items, items + n, [&](const T& item) {
+        return bin_index(p, cb, ba, centroid(item)) <= bi;
+    });
+    return int(m - items);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+// Ray with precomputed inverse direction
+struct RayInv {
+    Vec3 o;         // Origin
+    Vec3 d_inv;     // Inverse of the direction
+    int neg[3];     // True if the direction is negative
+
+    RayInv() = default;
+    RayInv(Ray r) : o(r.o), d_inv(1_f / r.d) {
+        for (int i = 0; i < 3; i++) {
+            neg[i] = std::signbit(d_inv[i]);
+        }
+    }
+};
+
+// BVH node packed in 32 bytes.
+// Nodes are stored in depth-first order,
+// so the first child of an inner node is always the next node.
+struct LM_ALIGN_32 Node {
+    float bmin[3];  // Minimum of the bound (rounded down)
+    int offset;     // Start of item indices (leaf) or index of the second child (inner)
+    float bmax[3];  // Maximum of the bound (rounded up)
+    int count;      // Number of items (0 for inner nodes)
+
+    template <typename Archive>
+    void serialize(Archive& ar) {
+        ar(bmin[0], bmin[1], bmin[2], offset, bmax[0], bmax[1], bmax[2], count);
+    }
+
+    bool leaf() const {
+        return count > 0;
+    }
+
+    // Sets the bound rounding outward so that the packed bound contains the original bound
+    void set_bound(const Bound& b) {
+        for (int i = 0; i < 3; i++) {
+            bmin[i] = std::nextafter(float(b.min[i]), -std::numeric_limits<float>::infinity());
+            bmax[i] = std::nextafter(float(b.max[i]), std::numeric_limits<float>::infinity());
+        }
+    }
+
+    // Checks intersection with the ray.
+    // Returns true and the entry distance if the ray intersects with the bound within [tmin,tmax].
+    // Note that the comparisons are ordered so that NaN does not update the range.
+    bool isect(const RayInv& r, Float tmin, Float tmax, Float& t) const {
+        for (int i = 0; i < 3; i++) {
+            const auto t1 = (Float(r.neg[i] ? bmax[i] : bmin[i]) - r.o[i]) * r.d_inv[i];
+            const auto t2 = (Float(r.neg[i] ? bmin[i] : bmax[i]) - r.o[i]) * r.d_inv[i];
+            tmin = t1 > tmin ? t1 : tmin;
+            tmax = t2 < tmax ? t2 : tmax;
+        }
+        t = tmin;
+        return tmin <= tmax;
+    }
+};
+static_assert(sizeof(Node) == 32, "Unexpected size of BVH node");
+
+// Traverses the packed nodes visiting the nearer child first.
+// isect_leaf(node, tmax) is called for each intersected leaf
+// and updates tmax if the closer intersection is found.
+// The traversal terminates when isect_leaf returns true,
+// in which case this function returns true.
+template <typename IsectLeafFunc>
+bool traverse(const Node* nodes, size_t num_nodes, Ray ray, Float tmin, Float& tmax, const IsectLeafFunc& isect_leaf) {
+    if (num_nodes == 0) {
+        return false;
+    }
+    const RayInv r(ray);
+    Float t;
+    if (!nodes[0].isect(r, tmin, tmax, t)) {
+        return false;
+    }
+    struct Entry {
+        int index;  // Node index
+        Float t;    // Entry distance
+    };
+    Entry s[MaxDepth + 1];  // At most one entry is pushed per level
+    int si = 0;
+    int ni = 0;
+    while (true) {
+        const auto& n = nodes[ni];
+        if (n.leaf()) {
+            if (isect_leaf(n, tmax)) {
+                return true;
+            }
+        }
+        else {
+            // Intersect with both children and visit the nearer one first
+            const int c1 = ni + 1;
+            const int c2 = n.offset;
+            Float t1, t2;
+            const bool h1 = nodes[c1].isect(r, tmin, tmax, t1);
+            const bool h2 = nodes[c2].isect(r, tmin, tmax, t2);
+            if (h1 && h2) {
+                assert(si <= MaxDepth);
+                if (t1 <= t2) {
+                    s[si++] = { c2, t2 };
+                    ni = c1;
+                }
+                else {
+                    s[si++] = { c1, t1 };
+                    ni = c2;
+                }
+                continue;
+            }
+            if (h1 || h2) {
+                ni = h1 ? c1 : c2;
+                continue;
+            }
+        }
+
+        // Pop the next node skipping the nodes farther than the current closest hit
+        while (si > 0 && s[si-1].t > tmax) {
+            si--;
+        }
+        if (si == 0) {
+            break;
+        }
+        ni = s[--si].index;
+    }
+    return false;
+}
+
+LM_NAMESPACE_END(bvh)
+LM_NAMESPACE_END(LM_NAMESPACE)
@@ -58,6 +58,47 @@ struct AtomicWrapper {
 
 // Helper functions on image manipulaion
 namespace image {
+    // Calls the function for each row, in parallel if par is true.
+    // The background thread of the asynchronous save uses the serial loop
+    // not to compete with the rendering threads.
+    template <typename Func>
+    void foreach_row(int h, bool par, const Func& func) {
+        if (par) {
+            parallel::foreach(h, [&](long long y, int) {
+                func(int(y));
+            });
+        }
+        else {
+            for (int y = 0; y < h; y++) {
+                func(y);
+            }
+        }
+    }
+
+    // Converts the pixels to the image of the given type.
+    // If flip is true, the rows are stored from the top to bottom.
+    template <typename T, typename GetPixelFunc>
+    std::vector<T> convert(int w, int h, bool flip, bool par, const GetPixelFunc& get_pixel) {
+        std::vector<T> v(size_t(w)*h*3, {});
+        foreach_row(h, par, [&](int y) {
+            const int yy = !flip ? y : h-y-1;
+            for (int x = 0; x < w; x++) {
+                const Vec3 c = get_pixel(y*w+x);
+                for (int i = 0; i < 3; i++) {
+                    const Float t = c[i];
+                    if constexpr (std::is_same_v<T, float>) {
+                        v[3*(yy*w+x)+i] = T(t);
+                    }
+                    if constexpr (std::is_same_v<T, unsigned char>) {
+                        const auto t2 = std::pow(t, 1_f/2.2_f);
+                        v[3*(yy*w+x)+i] = (unsigned char)glm::clamp(int(256_f*t2), 0, 255);
+                    }
+                }
+            }
+        });
+        return v;
+    }
+
     // Write image as .pfm file
     bool writePfm(const std::string& outpath, int w, int h, const std::vector<float>& d) {
         FILE *f;
@@ -81,12 +122,29 @@ namespace image {
 
     // Sanity check of an image. If the image contains invalid values like INF or NAN,
     // this function returns false.
-    bool sanityCheck(int w, int h, const std::vector<float>& d) {
+    bool sanityCheck(int w, int h, bool par, const std::vector<float>& d) {
+        // Count the invalid values first and report the details only if found
+        std::atomic<long long> count = 0;
+        foreach_row(h, par, [&](int y) {
+            long long c = 0;
+            for (int i = 3*y*w; i < 3*(y+1)*w; i++) {
+                if (std::isnan(d[i]) || std::isinf(d[i])) {
+                    c++;
+                }
+            }
+            if (c > 0) {
+                count += c;
+            }
+        });
+        if (count == 0) {
+            return true;
+        }
+
         constexpr int MaxInvalidPixels = 10;
         int invalid_pixels = 0;
-        for (int i = 0; i < w * h; i++) {
-            const int x = i % w;
-            const int y = i / w;
+        for (int i = 0; i < w * h * 3; i++) {
+            const int x = (i / 3) % w;
+            const int y = (i / 3) / w;
             const auto v = d[i];
             if (std::isnan(v)) {
                 LM_WARN("Found an invalid pixel [type='NaN', x={}, y={}]", x, y);
@@ -101,12 +159,70 @@ namespace image {
                 break;
             }
         }
-        return invalid_pixels > 0;
+        return false;
+    }
+
+    // Write the pixels to the file. The format is determined by the extension.
+    template <typename GetPixelFunc>
+    bool write(const std::string& outpath, int w, int h, bool par, const GetPixelFunc& get_pixel) {
+        // Disable floating-point exception for stb_image
+        exception::ScopedDisableFPEx disable_fpex_;
+
+        // Create directory if not found
+        const auto parent = fs::path(outpath).parent_path();
+        if (!parent.empty() && !fs::exists(parent)) {
+            LM_INFO("Creating directory [path='{}']", parent.string());
+            if (!fs::create_directories(parent)) {
+                LM_INFO("Failed to create directory [path='{}']", parent.string());
+                return false;
+            }
+        }
+
+        // Save file
+        // Check extension of the output file
+        const auto ext = fs::path(outpath).extension().string();
+        if (ext == ".png") {
+            const auto data = convert<unsigned char>(w, h, true, par, get_pixel);
+            if (!stbi_write_png(outpath.c_str(), w, h, 3, data.data(), w*3)) {
+                return false;
+            }
+        }
+        else if (ext == ".hdr") {
+            auto data = convert<float>(w, h, true, par, get_pixel);
+            sanityCheck(w, h, par, data);
+            if (!stbi_write_hdr(outpath.c_str(), w, h, 3, data.data())) {
+                return false;
+            }
+        }
+        else if (ext == ".pfm") {
+            const auto data = convert<float>(w, h, false, par, get_pixel);
+            sanityCheck(w, h, par, data);
+            if (!writePfm(outpath, w, h, data)) {
+                return false;
+            }
+        }
+        else {
+            LM_ERROR("Invalid extension [ext='{}']", ext);
+            return false;
+        }
+
+        return true;
     }
 }
 
 // ------------------------------------------------------------------------------------------------
 
+namespace {
+
+// Identifier of the set of the per-thread accumulation buffers.
+// A new identifier is issued whenever the buffers are discarded by clear()
+// so that the threads never refer to the discarded buffers.
+std::atomic<long long> next_buffer_set_id = 0;
+
+}
+
+// ------------------------------------------------------------------------------------------------
+
 /*
 \rst
 .. function:: film::bitmap
@@ -115,9 +231,37 @@ namespace image {
 
    :param int w: Width of the film.
    :param int h: Height of the film.
+   :param str accumulation: Accumulation mode of the splats (``atomic`` or ``per_thread``).
+                            Default: ``atomic``.
 
    This component implements thread-safe bitmap film.
    The invocation of :cpp:func:`lm::Film::setPixel()` function is thread safe.
+
+   With ``accumulation = atomic``, :cpp:func:`lm::Film::splat_pixel` updates the pixel
+   with the compare-and-swap loop on the atomic value of the pixel.
+   With ``accumulation = per_thread``, each thread accumulates the splats
+   into its own float buffer of the film size with plain additions.
+   The pending values in the buffers are moved to the film in parallel
+   when the film is modified other than splatting, e.g.,
+   :cpp:func:`lm::Film::rescale` or :cpp:func:`lm::Film::flush` at the end of the rendering.
+   The functions reading the film, e.g., :cpp:func:`lm::Film::get_pixel`,
+   :cpp:func:`lm::Film::snapshot`, :cpp:func:`lm::Film::buffer`, or :cpp:func:`lm::Film::save`,
+   add up the film and the buffers without moving the values,
+   so they can be called while the other threads are splatting.
+   This mode is suitable for the renderers splatting to random pixels
+   like ``renderer::lt`` or ``renderer::bdpt``,
+   at the cost of the memory of a film-size buffer per thread.
+   Note that the functions modifying the film, that is,
+   :cpp:func:`lm::Film::set_pixel`, :cpp:func:`lm::Film::update_pixel`,
+   :cpp:func:`lm::Film::rescale`, :cpp:func:`lm::Film::flush`, and :cpp:func:`lm::Film::clear`,
+   must not be called while the other threads are splatting in this mode.
+
+   :cpp:func:`lm::Film::snapshot` converts the film into one of two preallocated float buffers
+   alternately, so the previous snapshot stays valid while the next one is taken.
+   The splats done while the snapshot is taken may or may not be included.
+   The splatting threads are never blocked by taking a snapshot.
+   :cpp:func:`lm::Film::save_async` takes a snapshot of the film in double precision
+   and encodes it in a background thread.
 \endrst
 */
 class Film_Bitmap final : public Film {
@@ -125,19 +269,68 @@ private:
     int w_;
     int h_;
     int quality_;
-    std::vector<AtomicWrapper<Vec3>> data_;
+    bool per_thread_;              // True to accumulate splats in per-thread buffers
+    mutable std::vector<AtomicWrapper<Vec3>> data_;
     std::vector<Vec3> data_temp_;  // Temporary buffer for external reference
 
+    // Accumulation buffer owned by a thread.
+    // The buffers form a list and are never deleted until the film is cleared,
+    // so the threads can keep the pointers to their buffers.
+    // Only the owner thread writes to the buffer during the rendering.
+    // The values are accessed with the relaxed atomics compiled to plain loads and stores,
+    // which only make the concurrent reads by get_pixel() or snapshot() well-defined.
+    struct ThreadBuffer {
+        std::thread::id owner;
+        std::unique_ptr<std::atomic<float>[]> data;     // RGB values of the pixels not merged yet
+        std::atomic<bool> dirty = false;                // True if some values are not merged yet
+        ThreadBuffer* next = nullptr;                   // Next buffer in the list
+
+        ThreadBuffer(std::thread::id owner, size_t size)
+            : owner(owner)
+            , data(std::make_unique<std::atomic<float>[]>(size)) {} // Zero-initialized
+    };
+    std::atomic<ThreadBuffer*> buffers_ = nullptr;      // Head of the list of the buffers
+    long long buffer_set_id_ = next_buffer_set_id++;  // Changed only when no thread is splatting
+
+    // Merges are serialized and the sequence number is odd during a merge,
+    // so that the readers can detect the values moved by a merge (seqlock).
+    mutable std::mutex merge_mutex_;
+    mutable std::atomic<long long> merge_seq_ = 0;
+
+    // Double buffer for snapshots
+    std::mutex snapshot_mutex_;
+    std::vector<float> snapshot_data_[2];
+    long long snapshot_version_ = 0;
+
+    // Handles of the asynchronous saves not completed yet
+    std::mutex saves_mutex_;
+    std::vector<std::shared_future<bool>> pending_saves_;
+
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(w_, h_, quality_, data_);
+        flush_pending();
+        ar(w_, h_, quality_, per_thread_, data_);
     }
 
 public:
+    ~Film_Bitmap() {
+        delete_buffers();
+    }
+
     virtual void construct(const Json& prop) override {
         w_ = json::value<int>(prop, "w");
         h_ = json::value<int>(prop, "h");
         quality_ = json::value<int>(prop, "quality", 90);
+        const auto accumulation = json::value<std::string>(prop, "accumulation", "atomic");
+        if (accumulation == "atomic") {
+            per_thread_ = false;
+        }
+        else if (accumulation == "per_thread") {
+            per_thread_ = true;
+        }
+        else {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid accumulation mode [accumulation='{}']", accumulation);
+        }
         data_.assign(w_*h_, {});
     }
 
@@ -150,73 +343,81 @@ public:
     }
 
     virtual void set_pixel(int x, int y, Vec3 v) override {
+        flush_pending();
         data_[y*w_ + x].update(v);
     }
 
-    virtual bool save(const std::string& outpath) const override {
-        // Disable floating-point exception for stb_image
-        exception::ScopedDisableFPEx disable_fpex_;
+    virtual Vec3 get_pixel(int x, int y) const override {
+        return value(y*w_ + x);
+    }
 
+    virtual bool save(const std::string& outpath) const override {
         LM_INFO("Saving image [file='{}']", outpath);
         LM_INDENT();
+        return image::write(outpath, w_, h_, true, [&](int i) -> Vec3 {
+            return value(i);
+        });
+    }
 
-        // Create directory if not found
-        const auto parent = fs::path(outpath).parent_path();
-        if (!parent.empty() && !fs::exists(parent)) {
-            LM_INFO("Creating directory [path='{}']", parent.string());
-            if (!fs::create_directories(parent)) {
-                LM_INFO("Failed to create directory [path='{}']", parent.string());
-                return false;
-            }
-        }
+    virtual std::shared_future<bool> save_async(const std::string& outpath) override {
+        LM_INFO("Saving image asynchronously [file='{}']", outpath);
 
-        // Save file
-        // Check extension of the output file
-        const auto ext = fs::path(outpath).extension().string();
-        if (ext == ".png") {
-            const auto data = copy<unsigned char>(true);
-            if (!stbi_write_png(outpath.c_str(), w_, h_, 3, data.data(), w_*3)) {
-                return false;
-            }
-        }
-        #if 0
-        else if (ext == ".jpg") {
-            const auto data = copy<unsigned char>(true);
-            if (!stbi_write_jpg(outpath.c_str(), w_, h_, 3, data.data(), quality_)) {
-                return false;
-            }
-        }
-        #endif
-        else if (ext == ".hdr") {
-            auto data = copy<float>(true);
-            image::sanityCheck(w_, h_, data);
-            if (!stbi_write_hdr(outpath.c_str(), w_, h_, 3, data.data())) {
-                return false;
-            }
-        }
-        else if (ext == ".pfm") {
-            const auto data = copy<float>(false);
-            image::sanityCheck(w_, h_, data);
-            if (!image::writePfm(outpath, w_, h_, data)) {
-                return false;
-            }
-        }
-        else {
-            LM_ERROR("Invalid extension [ext='{}']", ext);
-            return false;
-        }
+        // Take the snapshot of the film in parallel.
+        // Reading the per-thread buffers is safe while the other threads are splatting.
+        auto data = std::make_shared<std::vector<Vec3>>(data_.size());
+        parallel::foreach(w_ * h_, [&](long long i, int) {
+            (*data)[i] = value(i);
+        });
 
-        return true;
+        // Encode the snapshot in the background thread.
+        // The film keeps the handles so that the pending saves are completed
+        // before the film is deleted even if the caller discards the handle.
+        std::unique_lock<std::mutex> lock(saves_mutex_);
+        pending_saves_.erase(
+            std::remove_if(pending_saves_.begin(), pending_saves_.end(), [](const std::shared_future<bool>& f) {
+                return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            }),
+            pending_saves_.end());
+        auto f = std::async(std::launch::async, [outpath, w = w_, h = h_, data]() {
+            return image::write(outpath, w, h, false, [&](int i) -> Vec3 {
+                return (*data)[i];
+            });
+        }).share();
+        pending_saves_.push_back(f);
+        return f;
     }
 
     virtual FilmBuffer buffer() override {
-        data_temp_.clear();
-        for (const auto& v : data_) {
-            data_temp_.push_back(v.v_);
+        data_temp_.resize(data_.size());
+        for (size_t i = 0; i < data_.size(); i++) {
+            data_temp_[i] = value(i);
         }
         return FilmBuffer{ w_, h_, &data_temp_[0].x };
     }
 
+    virtual FilmSnapshot snapshot() override {
+        // Concurrent snapshots are serialized
+        std::unique_lock<std::mutex> lock(snapshot_mutex_);
+
+        // Write to the buffer not used by the previous snapshot
+        const auto version = snapshot_version_ + 1;
+        auto& d = snapshot_data_[version % 2];
+        d.resize(3*size_t(w_)*h_);
+
+        // Copy the film including the values in the per-thread buffers
+        parallel::foreach(h_, [&](long long y, int) {
+            for (long long i = y*w_; i < (y+1)*w_; i++) {
+                const auto v = value(i);
+                d[3*i]   = float(v.x);
+                d[3*i+1] = float(v.y);
+                d[3*i+2] = float(v.z);
+            }
+        });
+        snapshot_version_ = version;
+
+        return FilmSnapshot{ w_, h_, d.data(), version };
+    }
+
     virtual void accum(const Film* film_) override {
         const auto* film = dynamic_cast<const Film_Bitmap*>(film_);
         if (!film) {
@@ -227,50 +428,197 @@ public:
             LM_ERROR("Film size is different [expected='({},{})', actual='({},{})']", w_, h_, film->w_, film->h_);
             return;
         }
+        // Pending values of this film are kept in the buffers since the addition commutes
         for (int i = 0; i < w_*h_; i++) {
-            const auto v = film->data_[i].v_.load();
-            data_[i].add(v);
+            data_[i].add(film->value(i));
         }
     }
 
     virtual void splat_pixel(int x, int y, Vec3 v) override {
-        data_[y*w_+x].add(v);
+        if (!per_thread_) {
+            data_[y*w_+x].add(v);
+            return;
+        }
+        // Only the owner thread writes to the buffer and the merges never run during the splatting,
+        // so the addition needs no read-modify-write operation.
+        // The merge observes the values and the flag after the parallel loop is joined.
+        auto& b = thread_buffer();
+        auto* p = &b.data[3*(y*w_+x)];
+        for (int i = 0; i < 3; i++) {
+            p[i].store(p[i].load(std::memory_order_relaxed) + float(v[i]), std::memory_order_relaxed);
+        }
+        if (!b.dirty.load(std::memory_order_relaxed)) {
+            b.dirty.store(true, std::memory_order_relaxed);
+        }
     }
 
     virtual void update_pixel(int x, int y, const PixelUpdateFunc& update_func) override {
+        flush_pending();
         data_[y*w_+x].update_with_func(update_func);
     }
 
     virtual void rescale(Float s) override {
+        flush_pending();
         parallel::foreach(w_ * h_, [&](long long i, int) {
             data_[i].v_ = data_[i].v_.load() * s;
         });
     }
 
+    virtual void flush() override {
+        flush_pending();
+    }
+
     virtual void clear() override {
+        buffer_set_id_ = next_buffer_set_id++;
+        delete_buffers();
         data_.assign(w_*h_, {});
     }
 
 private:
-    template <typename T>
-    std::vector<T> copy(bool flip) const {
-        std::vector<T> v(w_*h_*3, {});
-        for (int y = 0; y < h_; y++) {
-            const int yy = !flip ? y : h_-y-1;
-            for (int x = 0; x < w_; x++) {
-                for (int i = 0; i < 3; i++) {
-                    const Float t = data_[y*w_+x].v_.load()[i];
-                    if constexpr (std::is_same_v<T, float>) {
-                        v[3*(yy*w_+x)+i] = T(t);
-                    }
-                    if constexpr (std::is_same_v<T, unsigned char>) {
-                        const auto t2 = std::pow(t, 1_f/2.2_f);
-                        v[3*(yy*w_+x)+i] = (unsigned char)glm::clamp(int(256_f*t2), 0, 255);
+    // Gets the accumulation buffer of the current thread.
+    // The buffer is allocated at the first splat of the thread.
+    ThreadBuffer& thread_buffer() {
+        // Small direct-mapped cache of the buffers of the current thread.
+        // The key is the identifier of the buffer set, which is unique among the films and never reused,
+        // so a thread splatting to a few films alternately, e.g., strategy films of renderer::bdpt,
+        // rarely misses the cache.
+        struct CacheEntry {
+            long long id = -1;
+            ThreadBuffer* buffer = nullptr;
+        };
+        thread_local CacheEntry cache[4];
+        const long long id = buffer_set_id_;
+        auto& entry = cache[id & 3];
+        if (entry.id == id) {
+            return *entry.buffer;
+        }
+
+        // Find the buffer of the current thread, e.g., after the entry is evicted
+        const auto owner = std::this_thread::get_id();
+        ThreadBuffer* buffer = nullptr;
+        for (auto* b = buffers_.load(); b; b = b->next) {
+            if (b->owner == owner) {
+                buffer = b;
+                break;
+            }
+        }
+        if (!buffer) {
+            // Allocate a buffer and push it to the head of the list
+            buffer = new ThreadBuffer(owner, 3*size_t(w_)*h_);
+            buffer->next = buffers_.load();
+            while (!buffers_.compare_exchange_weak(buffer->next, buffer));
+        }
+
+        entry = { id, buffer };
+        return *buffer;
+    }
+
+    // Deletes the per-thread buffers.
+    // The other threads must not be splatting.
+    void delete_buffers() {
+        auto* b = buffers_.exchange(nullptr);
+        while (b) {
+            auto* next = b->next;
+            delete b;
+            b = next;
+        }
+    }
+
+    // Moves the pending values in the per-thread buffers to the film in parallel.
+    // The other threads must not be splatting.
+    void flush_pending() const {
+        if (!per_thread_) {
+            return;
+        }
+
+        // Check the pending values without locking since the function is called for each modification.
+        // A merge in progress keeps the flags set until the values are moved,
+        // so a concurrent caller, e.g., update_pixel() in a parallel loop, waits for the merge on the lock.
+        bool pending = false;
+        for (auto* b = buffers_.load(); b; b = b->next) {
+            if (b->dirty.load(std::memory_order_acquire)) {
+                pending = true;
+                break;
+            }
+        }
+        if (!pending) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(merge_mutex_);
+        merge();
+    }
+
+    // Moves the pending values in the per-thread buffers to the film.
+    // The caller must hold merge_mutex_.
+    void merge() const {
+        // Collect the buffers having pending values
+        std::vector<ThreadBuffer*> dirty;
+        for (auto* b = buffers_.load(); b; b = b->next) {
+            if (b->dirty.load(std::memory_order_acquire)) {
+                dirty.push_back(b);
+            }
+        }
+        if (dirty.empty()) {
+            return;
+        }
+
+        // Move the values.
+        // The operations are sequentially consistent to pair with the reads in value().
+        merge_seq_.fetch_add(1);
+        parallel::foreach(w_ * h_, [&](long long i, int) {
+            Vec3 v(0_f);
+            bool found = false;
+            for (auto* b : dirty) {
+                for (int j = 0; j < 3; j++) {
+                    auto& d = b->data[3*i+j];
+                    const auto t = d.load();
+                    if (t != 0.f) {
+                        v[j] += t;
+                        d.store(0.f);
+                        found = true;
                     }
                 }
             }
+            if (found) {
+                data_[i].add(v);
+            }
+        });
+        merge_seq_.fetch_add(1);
+
+        // Cleared after the values are moved,
+        // so that flush_pending() observing no pending values also observes the moved values
+        for (auto* b : dirty) {
+            b->dirty.store(false, std::memory_order_release);
+        }
+    }
+
+    // Sum of the values of a pixel in the per-thread buffers
+    Vec3 buffered_value(long long i) const {
+        Vec3 v(0_f);
+        for (auto* b = buffers_.load(); b; b = b->next) {
+            for (int j = 0; j < 3; j++) {
+                v[j] += b->data[3*i+j].load();
+            }
+        }
+        return v;
+    }
+
+    // Current value of a pixel including the values not merged yet.
+    // The read is retried if a merge moves the values during the read.
+    Vec3 value(long long i) const {
+        if (!per_thread_) {
+            return data_[i].v_.load();
+        }
+        while (true) {
+            const auto seq = merge_seq_.load();
+            if (seq % 2 == 0) {
+                const auto v = data_[i].v_.load() + buffered_value(i);
+                if (merge_seq_.load() == seq) {
+                    return v;
+                }
+            }
+            std::this_thread::yield();
         }
-        return std::move(v);
     }
 };
 
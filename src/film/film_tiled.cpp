@@ -0,0 +1,649 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include <lm/core.h>
+#include <lm/film.h>
+#include <lm/parallel.h>
+#include <lm/mappedfile.h>
+#include <stb/stb_image_write.h>
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+
+// Helper functions on half-precision floating-point numbers (IEEE 754 binary16)
+namespace half {
+    // Convert single-precision value to half-precision with round-to-nearest-even
+    std::uint16_t from_float(float f) {
+        std::uint32_t x;
+        std::memcpy(&x, &f, sizeof(float));
+        const std::uint32_t sign = (x >> 16) & 0x8000u;
+        const std::uint32_t e = (x >> 23) & 0xffu;
+        std::uint32_t m = x & 0x7fffffu;
+        if (e == 0xffu) {
+            // Inf or NaN
+            return std::uint16_t(sign | 0x7c00u | (m ? 0x200u : 0u));
+        }
+        const int exp = int(e) - 127 + 15;
+        if (exp >= 31) {
+            // Overflow
+            return std::uint16_t(sign | 0x7c00u);
+        }
+        if (exp <= 0) {
+            // Subnormal or zero
+            if (exp < -10) {
+                return std::uint16_t(sign);
+            }
+            m |= 0x800000u;
+            const int shift = 14 - exp;
+            std::uint32_t h = m >> shift;
+            const std::uint32_t rem = m & ((1u << shift) - 1);
+            const std::uint32_t halfway = 1u << (shift - 1);
+            if (rem > halfway || (rem == halfway && (h & 1))) {
+                h++;
+            }
+            return std::uint16_t(sign | h);
+        }
+        // Carry of the rounding propagates to the exponent
+        std::uint32_t h = (std::uint32_t(exp) << 10) | (m >> 13);
+        const std::uint32_t rem = m & 0x1fffu;
+        if (rem > 0x1000u || (rem == 0x1000u && (h & 1))) {
+            h++;
+        }
+        return std::uint16_t(sign | h);
+    }
+
+    // Convert half-precision value to single-precision
+    float to_float(std::uint16_t h) {
+        const std::uint32_t sign = std::uint32_t(h & 0x8000u) << 16;
+        const std::uint32_t e = (h >> 10) & 0x1fu;
+        const std::uint32_t m = h & 0x3ffu;
+        std::uint32_t x;
+        if (e == 0) {
+            // Subnormal or zero
+            const float f = std::ldexp(float(m), -24);
+            return sign ? -f : f;
+        }
+        else if (e == 31) {
+            x = sign | 0x7f800000u | (m << 13);
+        }
+        else {
+            x = sign | ((e + 112) << 23) | (m << 13);
+        }
+        float f;
+        std::memcpy(&f, &x, sizeof(float));
+        return f;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+\rst
+.. function:: film::tiled
+
+   Tiled film for very large resolutions.
+
+   :param int w: Width of the film.
+   :param int h: Height of the film.
+   :param int tile_size: Width and height of a tile in pixels. Default: ``64``.
+   :param str precision: Precision of the pixel values (``float`` or ``half``). Default: ``float``.
+   :param str path: Path to the file backing the film. If empty, the film is stored in memory.
+                    Default: empty.
+
+   This component stores the pixels in tiles with single or half precision,
+   which needs 12 or 6 bytes per pixel compared to 24 bytes of ``film::bitmap``.
+   The tiles are allocated at the first write to the tile,
+   so that the tiles not touched by the renderer are never resident.
+   If ``path`` is specified, the film is stored in the memory-mapped file
+   and the pages of the inactive tiles can be written back to the file
+   and evicted from the memory by the operating system.
+   The file is kept after the film is deleted.
+   The path is not serialized and the deserialized film is stored in memory,
+   so that loading the film never overwrites the file still used by the original film.
+
+   The film is saved tile row by tile row without creating a copy of the whole film
+   if the extension of the output path is ``.pfm`` or ``.hdr``.
+   The ``.png`` output needs a copy of the film with 3 bytes per pixel.
+   :cpp:func:`lm::Film::save_async` does not take a snapshot of the film
+   to avoid doubling the memory usage. The background thread reads the current values of the film
+   while it is being saved, so the film should not be modified until the save completes
+   to get a consistent image.
+
+   :cpp:func:`lm::Film::snapshot` copies the film in parallel without blocking the rendering threads,
+   thus the values written during the copy may or may not be included.
+
+   The channels of a pixel are updated atomically and independently.
+   :cpp:func:`lm::Film::update_pixel` is atomic only with respect to the other calls
+   of :cpp:func:`lm::Film::update_pixel` or :cpp:func:`lm::Film::set_pixel`.
+   In ``float`` precision, these functions apply the change as the atomic addition of the difference,
+   so the concurrent splats by :cpp:func:`lm::Film::splat_pixel` are never overwritten.
+   Note that ``half`` precision has only 11 bits of significand and the maximum value 65504,
+   thus rounding each addition would lose the small contributions.
+   The film with ``half`` precision only supports the renderers writing the final values
+   of the pixels like ``renderer::raycast``, and :cpp:func:`lm::Film::splat_pixel` and
+   :cpp:func:`lm::Film::accum` throw an exception with ``Error::Unsupported``.
+\endrst
+*/
+class Film_Tiled final : public Film {
+private:
+    static_assert(sizeof(std::atomic<std::uint32_t>) == 4 && std::atomic<std::uint32_t>::is_always_lock_free);
+    static_assert(sizeof(std::atomic<std::uint16_t>) == 2 && std::atomic<std::uint16_t>::is_always_lock_free);
+
+    int w_;
+    int h_;
+    int tile_size_;                 // Width and height of a tile
+    bool half_;                     // True to store the values in half precision
+    std::string path_;              // Path to the backing file (empty if in-memory)
+    int tiles_x_;                   // Number of tiles in x direction
+    int tiles_y_;                   // Number of tiles in y direction
+    size_t tile_bytes_;             // Size of a tile in bytes
+
+    // Storage of the tiles.
+    // The values in a tile are stored in row-major order with 3 channels per pixel.
+    // A channel is accessed as std::atomic of 32-bit or 16-bit integer.
+    std::unique_ptr<std::atomic<unsigned char*>[]> tiles_;  // Pointer to the tiles (nullptr if not touched)
+    std::unique_ptr<MappedFile> file_;                     // Backing file
+
+    // Mutexes for update_pixel() shared by the pixels with the same index modulo the count
+    static constexpr int NumUpdateMutexes = 64;
+    std::mutex update_mutexes_[NumUpdateMutexes];
+
+    std::vector<Vec3> data_temp_;           // Temporary buffer for external reference
+    std::vector<float> snapshot_data_[2];   // Double buffer for snapshots
+    long long snapshot_version_ = 0;
+    std::mutex snapshot_mutex_;
+
+    // Handles of the asynchronous saves not completed yet
+    std::mutex saves_mutex_;
+    std::vector<std::shared_future<bool>> pending_saves_;
+
+public:
+    ~Film_Tiled() {
+        wait_pending_saves();
+        release();
+    }
+
+public:
+    virtual void construct(const Json& prop) override {
+        w_ = json::value<int>(prop, "w");
+        h_ = json::value<int>(prop, "h");
+        tile_size_ = json::value<int>(prop, "tile_size", 64);
+        if (tile_size_ <= 0) {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Tile size must be positive [tile_size={}]", tile_size_);
+        }
+        const auto precision = json::value<std::string>(prop, "precision", "float");
+        if (precision == "float") {
+            half_ = false;
+        }
+        else if (precision == "half") {
+            half_ = true;
+        }
+        else {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid precision [precision='{}']", precision);
+        }
+        path_ = json::value<std::string>(prop, "path", "");
+        init();
+    }
+
+    virtual void load(InputArchive& ar) override {
+        ar(w_, h_, tile_size_, half_);
+        release();
+        path_.clear();
+        init();
+        for (int t = 0; t < tiles_x_*tiles_y_; t++) {
+            bool touched;
+            ar(touched);
+            if (!touched) {
+                continue;
+            }
+            std::vector<float> values;
+            ar(values);
+            unsigned char* tile = tile_for_write(t);
+            for (size_t i = 0; i < values.size(); i++) {
+                store_value(tile, i, values[i]);
+            }
+        }
+    }
+
+    virtual void save(OutputArchive& ar) override {
+        ar(w_, h_, tile_size_, half_);
+        const size_t n = size_t(tile_size_) * tile_size_ * 3;
+        for (int t = 0; t < tiles_x_*tiles_y_; t++) {
+            const unsigned char* tile = tiles_[t].load();
+            ar(tile != nullptr);
+            if (!tile) {
+                continue;
+            }
+            std::vector<float> values(n);
+            for (size_t i = 0; i < n; i++) {
+                values[i] = load_value(tile, i);
+            }
+            ar(values);
+        }
+    }
+
+    virtual FilmSize size() const override {
+        return { w_, h_ };
+    }
+
+    virtual long long num_pixels() const override {
+        return (long long)(w_) * h_;
+    }
+
+    virtual void set_pixel(int x, int y, Vec3 v) override {
+        update_pixel(x, y, [&](Vec3) -> Vec3 {
+            return v;
+        });
+    }
+
+    virtual Vec3 get_pixel(int x, int y) const override {
+        const auto [tile, i] = locate(x, y);
+        if (!tile) {
+            return Vec3(0_f);
+        }
+        return Vec3(load_value(tile, i), load_value(tile, i + 1), load_value(tile, i + 2));
+    }
+
+    virtual bool save(const std::string& outpath) const override {
+        LM_INFO("Saving image [file='{}']", outpath);
+        LM_INDENT();
+        return save_impl(outpath, true);
+    }
+
+    virtual std::shared_future<bool> save_async(const std::string& outpath) override {
+        LM_INFO("Saving image asynchronously [file='{}']", outpath);
+        std::unique_lock<std::mutex> lock(saves_mutex_);
+        pending_saves_.erase(
+            std::remove_if(pending_saves_.begin(), pending_saves_.end(), [](const std::shared_future<bool>& f) {
+                return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            }),
+            pending_saves_.end());
+        auto f = std::async(std::launch::async, [this, outpath]() {
+            return save_impl(outpath, false);
+        }).share();
+        pending_saves_.push_back(f);
+        return f;
+    }
+
+    virtual FilmBuffer buffer() override {
+        data_temp_.resize(size_t(w_) * h_);
+        parallel::foreach(h_, [&](long long y, int) {
+            for (int x = 0; x < w_; x++) {
+                data_temp_[y*w_ + x] = get_pixel(x, int(y));
+            }
+        });
+        return FilmBuffer{ w_, h_, &data_temp_[0].x };
+    }
+
+    virtual FilmSnapshot snapshot() override {
+        // Concurrent snapshots are serialized by the lock only used by this function.
+        // The film has no pending values to merge, so the rows are copied in parallel
+        // while the rendering threads keep writing to the film.
+        std::unique_lock<std::mutex> lock(snapshot_mutex_);
+        const auto version = snapshot_version_ + 1;
+        auto& d = snapshot_data_[version % 2];
+        d.resize(size_t(w_) * h_ * 3);
+        parallel::foreach(h_, [&](long long y, int) {
+            for (int x = 0; x < w_; x++) {
+                const auto v = get_pixel(x, int(y));
+                for (int j = 0; j < 3; j++) {
+                    d[3*(size_t(y)*w_ + x) + j] = float(v[j]);
+                }
+            }
+        });
+        snapshot_version_ = version;
+        return FilmSnapshot{ w_, h_, d.data(), version };
+    }
+
+    virtual void accum(const Film* film) override {
+        if (half_) {
+            LM_THROW_EXCEPTION(Error::Unsupported, "Accumulation is not supported in half precision");
+        }
+        const auto [w, h] = film->size();
+        if (w_ != w || h_ != h) {
+            LM_ERROR("Film size is different [expected='({},{})', actual='({},{})']", w_, h_, w, h);
+            return;
+        }
+        parallel::foreach(h_, [&](long long y, int) {
+            for (int x = 0; x < w_; x++) {
+                splat_pixel(x, int(y), film->get_pixel(x, int(y)));
+            }
+        });
+    }
+
+    virtual void splat_pixel(int x, int y, Vec3 v) override {
+        if (half_) {
+            LM_THROW_EXCEPTION(Error::Unsupported, "Splatting is not supported in half precision");
+        }
+        auto [tile, i] = locate_for_write(x, y);
+        for (int j = 0; j < 3; j++) {
+            add_value(tile, i + j, float(v[j]));
+        }
+    }
+
+    virtual void update_pixel(int x, int y, const PixelUpdateFunc& update_func) override {
+        // The updates of a pixel are serialized by the mutex.
+        // In float precision, the difference is added atomically to keep the concurrent splats,
+        // which do not acquire the mutex.
+        std::unique_lock<std::mutex> lock(update_mutex(x, y));
+        auto [tile, i] = locate_for_write(x, y);
+        const float curr[3] = { load_value(tile, i), load_value(tile, i + 1), load_value(tile, i + 2) };
+        const auto v = update_func(Vec3(curr[0], curr[1], curr[2]));
+        for (int j = 0; j < 3; j++) {
+            if (half_) {
+                store_value(tile, i + j, float(v[j]));
+            }
+            else {
+                add_value(tile, i + j, float(v[j]) - curr[j]);
+            }
+        }
+    }
+
+    virtual void rescale(Float s) override {
+        // Rescale only the touched tiles
+        const size_t n = size_t(tile_size_) * tile_size_ * 3;
+        parallel::foreach(tiles_x_*tiles_y_, [&](long long t, int) {
+            unsigned char* tile = tiles_[t].load();
+            if (!tile) {
+                return;
+            }
+            for (size_t i = 0; i < n; i++) {
+                store_value(tile, i, float(load_value(tile, i) * s));
+            }
+        });
+    }
+
+    virtual void clear() override {
+        wait_pending_saves();
+        release();
+        init();
+    }
+
+private:
+    // Saves the film. If par is false, the conversion runs serially in the calling thread,
+    // which is the case of the background thread of the asynchronous save.
+    bool save_impl(const std::string& outpath, bool par) const {
+        // Disable floating-point exception for stb_image
+        exception::ScopedDisableFPEx disable_fpex_;
+
+        // Create directory if not found
+        const auto parent = fs::path(outpath).parent_path();
+        if (!parent.empty() && !fs::exists(parent)) {
+            LM_INFO("Creating directory [path='{}']", parent.string());
+            if (!fs::create_directories(parent)) {
+                LM_INFO("Failed to create directory [path='{}']", parent.string());
+                return false;
+            }
+        }
+
+        // Save file
+        const auto ext = fs::path(outpath).extension().string();
+        if (ext == ".png") {
+            return save_png(outpath, par);
+        }
+        else if (ext == ".hdr") {
+            return save_hdr(outpath);
+        }
+        else if (ext == ".pfm") {
+            return save_pfm(outpath);
+        }
+        LM_ERROR("Invalid extension [ext='{}']", ext);
+        return false;
+    }
+
+    // Initializes the storage of the tiles
+    void init() {
+        tiles_x_ = (w_ + tile_size_ - 1) / tile_size_;
+        tiles_y_ = (h_ + tile_size_ - 1) / tile_size_;
+        tile_bytes_ = size_t(tile_size_) * tile_size_ * 3 * (half_ ? 2 : 4);
+        const int num_tiles = tiles_x_ * tiles_y_;
+        tiles_ = std::make_unique<std::atomic<unsigned char*>[]>(num_tiles);
+        for (int t = 0; t < num_tiles; t++) {
+            tiles_[t] = nullptr;
+        }
+        if (!path_.empty()) {
+            // Discard the previous contents so that the whole file reads as zero
+            file_.reset();
+            file_ = std::make_unique<MappedFile>(path_, tile_bytes_ * num_tiles, true);
+        }
+    }
+
+    // Waits for the completion of the asynchronous saves
+    void wait_pending_saves() {
+        std::unique_lock<std::mutex> lock(saves_mutex_);
+        for (const auto& f : pending_saves_) {
+            f.wait();
+        }
+        pending_saves_.clear();
+    }
+
+    // Releases the storage of the tiles
+    void release() {
+        if (tiles_ && !file_) {
+            for (int t = 0; t < tiles_x_*tiles_y_; t++) {
+                delete[] tiles_[t].load();
+            }
+        }
+        tiles_.reset();
+        file_.reset();
+    }
+
+    // Gets the tile for writing. The tile is allocated if not touched yet.
+    unsigned char* tile_for_write(int t) {
+        auto* tile = tiles_[t].load(std::memory_order_acquire);
+        if (tile) {
+            return tile;
+        }
+        unsigned char* new_tile = file_
+            ? static_cast<unsigned char*>(file_->data()) + tile_bytes_ * t
+            : new unsigned char[tile_bytes_]();
+        if (!tiles_[t].compare_exchange_strong(tile, new_tile, std::memory_order_acq_rel)) {
+            // The other thread allocated the tile first
+            if (!file_) {
+                delete[] new_tile;
+            }
+            return tile;
+        }
+        return new_tile;
+    }
+
+    // Gets the tile and the index of the first channel of the pixel
+    std::pair<const unsigned char*, size_t> locate(int x, int y) const {
+        const int t = (y / tile_size_) * tiles_x_ + x / tile_size_;
+        const size_t i = 3 * (size_t(y % tile_size_) * tile_size_ + x % tile_size_);
+        return { tiles_[t].load(std::memory_order_acquire), i };
+    }
+    std::pair<unsigned char*, size_t> locate_for_write(int x, int y) {
+        const int t = (y / tile_size_) * tiles_x_ + x / tile_size_;
+        const size_t i = 3 * (size_t(y % tile_size_) * tile_size_ + x % tile_size_);
+        return { tile_for_write(t), i };
+    }
+
+    // Gets the mutex for update_pixel() of the pixel
+    std::mutex& update_mutex(int x, int y) {
+        return update_mutexes_[(size_t(y) * w_ + x) % NumUpdateMutexes];
+    }
+
+    // Loads i-th channel of the tile
+    float load_value(const unsigned char* tile, size_t i) const {
+        if (half_) {
+            const auto* p = reinterpret_cast<const std::atomic<std::uint16_t>*>(tile) + i;
+            return half::to_float(p->load(std::memory_order_relaxed));
+        }
+        const auto* p = reinterpret_cast<const std::atomic<std::uint32_t>*>(tile) + i;
+        const std::uint32_t bits = p->load(std::memory_order_relaxed);
+        float f;
+        std::memcpy(&f, &bits, sizeof(float));
+        return f;
+    }
+
+    // Stores the value to i-th channel of the tile
+    void store_value(unsigned char* tile, size_t i, float v) const {
+        if (half_) {
+            auto* p = reinterpret_cast<std::atomic<std::uint16_t>*>(tile) + i;
+            p->store(half::from_float(v), std::memory_order_relaxed);
+            return;
+        }
+        auto* p = reinterpret_cast<std::atomic<std::uint32_t>*>(tile) + i;
+        std::uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(float));
+        p->store(bits, std::memory_order_relaxed);
+    }
+
+    // Atomically adds the value to i-th channel of the tile. Only for float precision.
+    void add_value(unsigned char* tile, size_t i, float v) const {
+        assert(!half_);
+        auto* p = reinterpret_cast<std::atomic<std::uint32_t>*>(tile) + i;
+        auto expected = p->load(std::memory_order_relaxed);
+        while (true) {
+            float f;
+            std::memcpy(&f, &expected, sizeof(float));
+            f += v;
+            std::uint32_t desired;
+            std::memcpy(&desired, &f, sizeof(float));
+            if (p->compare_exchange_weak(expected, desired, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+    }
+
+    // Copies the rows [y0,y1) to the buffer in RGB float format.
+    // Returns the number of the invalid values.
+    int copy_rows(int y0, int y1, std::vector<float>& d) const {
+        d.resize(size_t(y1 - y0) * w_ * 3);
+        int invalid = 0;
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < w_; x++) {
+                const auto v = get_pixel(x, y);
+                for (int j = 0; j < 3; j++) {
+                    const auto f = float(v[j]);
+                    if (std::isnan(f) || std::isinf(f)) {
+                        invalid++;
+                    }
+                    d[3*(size_t(y - y0)*w_ + x) + j] = f;
+                }
+            }
+        }
+        return invalid;
+    }
+
+    // Writes the film as .pfm file streaming a tile row at a time.
+    // The rows of .pfm file are stored from bottom to top.
+    bool save_pfm(const std::string& outpath) const {
+        std::ofstream out(outpath, std::ios::out | std::ios::binary);
+        if (!out) {
+            LM_ERROR("Failed to open [file='{}']", outpath);
+            return false;
+        }
+        out << "PF\n" << w_ << " " << h_ << "\n-1\n";
+        std::vector<float> d;
+        int invalid = 0;
+        for (int ty = 0; ty < tiles_y_; ty++) {
+            const int y0 = ty * tile_size_;
+            const int y1 = std::min(y0 + tile_size_, h_);
+            invalid += copy_rows(y0, y1, d);
+            out.write(reinterpret_cast<const char*>(d.data()), d.size() * sizeof(float));
+        }
+        if (invalid > 0) {
+            LM_WARN("Found invalid pixel values [count={}]", invalid);
+        }
+        return bool(out);
+    }
+
+    // Writes the film as Radiance .hdr file streaming a tile row at a time.
+    // The rows of .hdr file are stored from top to bottom.
+    bool save_hdr(const std::string& outpath) const {
+        std::ofstream out(outpath, std::ios::out | std::ios::binary);
+        if (!out) {
+            LM_ERROR("Failed to open [file='{}']", outpath);
+            return false;
+        }
+        out << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << h_ << " +X " << w_ << "\n";
+
+        // Run-length encoding is only valid for the widths in [8,32768)
+        const bool rle = w_ >= 8 && w_ < 32768;
+        std::vector<float> d;
+        std::vector<unsigned char> rgbe(size_t(w_) * 4);
+        std::vector<unsigned char> line;
+        int invalid = 0;
+        for (int ty = tiles_y_ - 1; ty >= 0; ty--) {
+            const int y0 = ty * tile_size_;
+            const int y1 = std::min(y0 + tile_size_, h_);
+            invalid += copy_rows(y0, y1, d);
+            for (int y = y1 - 1; y >= y0; y--) {
+                // Convert the row to RGBE
+                for (int x = 0; x < w_; x++) {
+                    const float* c = &d[3*(size_t(y - y0)*w_ + x)];
+                    const float m = std::max({ c[0], c[1], c[2] });
+                    unsigned char* p = &rgbe[4*size_t(x)];
+                    if (!(m >= 1e-32f) || std::isinf(m)) {
+                        p[0] = p[1] = p[2] = p[3] = 0;
+                        continue;
+                    }
+                    int e;
+                    const float s = std::frexp(m, &e) * 256.f / m;
+                    for (int j = 0; j < 3; j++) {
+                        p[j] = (unsigned char)std::clamp(int(c[j] * s), 0, 255);
+                    }
+                    p[3] = (unsigned char)(e + 128);
+                }
+                if (!rle) {
+                    out.write(reinterpret_cast<const char*>(rgbe.data()), rgbe.size());
+                    continue;
+                }
+
+                // Write the scanline with the channels separated,
+                // encoded as a sequence of non-run chunks of at most 128 bytes
+                line.clear();
+                line.insert(line.end(), { 2, 2, (unsigned char)(w_ >> 8), (unsigned char)(w_ & 0xff) });
+                for (int j = 0; j < 4; j++) {
+                    for (int x = 0; x < w_; x += 128) {
+                        const int n = std::min(128, w_ - x);
+                        line.push_back((unsigned char)n);
+                        for (int k = 0; k < n; k++) {
+                            line.push_back(rgbe[4*size_t(x + k) + j]);
+                        }
+                    }
+                }
+                out.write(reinterpret_cast<const char*>(line.data()), line.size());
+            }
+        }
+        if (invalid > 0) {
+            LM_WARN("Found invalid pixel values [count={}]", invalid);
+        }
+        return bool(out);
+    }
+
+    // Writes the film as .png file.
+    // We need the whole image because stb_image_write does not support streaming.
+    bool save_png(const std::string& outpath, bool par) const {
+        std::vector<unsigned char> data(size_t(w_) * h_ * 3);
+        const auto convert_row = [&](int y) {
+            const auto yy = h_ - y - 1;
+            for (int x = 0; x < w_; x++) {
+                const auto v = get_pixel(x, y);
+                for (int j = 0; j < 3; j++) {
+                    const auto t = std::pow(v[j], 1_f/2.2_f);
+                    data[3*(size_t(yy)*w_ + x) + j] = (unsigned char)glm::clamp(int(256_f*t), 0, 255);
+                }
+            }
+        };
+        if (par) {
+            parallel::foreach(h_, [&](long long y, int) {
+                convert_row(int(y));
+            });
+        }
+        else {
+            for (int y = 0; y < h_; y++) {
+                convert_row(y);
+            }
+        }
+        return stbi_write_png(outpath.c_str(), w_, h_, 3, data.data(), w_*3) != 0;
+    }
+};
+
+LM_COMP_REG_IMPL(Film_Tiled, "film::tiled");
+
+LM_NAMESPACE_END(LM_NAMESPACE)
@@ -0,0 +1,161 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include <lm/mappedfile.h>
+#include <lm/exception.h>
+#include <lm/logger.h>
+
+#if LM_PLATFORM_WINDOWS
+#include <Windows.h>
+#elif LM_PLATFORM_LINUX || LM_PLATFORM_APPLE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+
+LM_PUBLIC_API MappedFile::MappedFile(const std::string& path) {
+    // Release the resources acquired so far if mapping fails,
+    // because the destructor is not called when the constructor throws.
+    try {
+        map_read(path);
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+}
+
+LM_PUBLIC_API MappedFile::MappedFile(const std::string& path, size_t size, bool truncate) {
+    try {
+        map_write(path, size, truncate);
+    }
+    catch (...) {
+        release();
+        throw;
+    }
+}
+
+LM_PUBLIC_API MappedFile::~MappedFile() {
+    release();
+}
+
+void MappedFile::map_read(const std::string& path) {
+    #if LM_PLATFORM_WINDOWS
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        file_ = nullptr;
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to open file [path='{}']", path);
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file_, &size);
+    size_ = size_t(size.QuadPart);
+    if (size_ == 0) {
+        return;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to map file [path='{}']", path);
+    }
+    data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    if (!data_) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to map file [path='{}']", path);
+    }
+    #elif LM_PLATFORM_LINUX || LM_PLATFORM_APPLE
+    fd_ = open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to open file [path='{}']", path);
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to get file size [path='{}']", path);
+    }
+    size_ = size_t(st.st_size);
+    if (size_ == 0) {
+        return;
+    }
+    data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (data_ == MAP_FAILED) {
+        data_ = nullptr;
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to map file [path='{}']", path);
+    }
+    #endif
+}
+
+void MappedFile::map_write(const std::string& path, size_t size, bool truncate) {
+    size_ = size;
+    #if LM_PLATFORM_WINDOWS
+    file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        file_ = nullptr;
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to open file [path='{}']", path);
+    }
+    LARGE_INTEGER li;
+    li.QuadPart = LONGLONG(size);
+    if (!SetFilePointerEx(file_, li, nullptr, FILE_BEGIN) || !SetEndOfFile(file_)) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to resize file [path='{}']", path);
+    }
+    if (size_ == 0) {
+        return;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    if (!mapping_) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to map file [path='{}']", path);
+    }
+    data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!data_) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to map file [path='{}']", path);
+    }
+    #elif LM_PLATFORM_LINUX || LM_PLATFORM_APPLE
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (fd_ < 0) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to open file [path='{}']", path);
+    }
+    if (ftruncate(fd_, off_t(size)) != 0) {
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to resize file [path='{}']", path);
+    }
+    if (size_ == 0) {
+        return;
+    }
+    data_ = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data_ == MAP_FAILED) {
+        data_ = nullptr;
+        LM_THROW_EXCEPTION(Error::IOError, "Failed to map file [path='{}']", path);
+    }
+    #endif
+}
+
+void MappedFile::release() {
+    #if LM_PLATFORM_WINDOWS
+    if (data_) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_) {
+        CloseHandle(mapping_);
+    }
+    if (file_) {
+        CloseHandle(file_);
+    }
+    data_ = nullptr;
+    mapping_ = nullptr;
+    file_ = nullptr;
+    #elif LM_PLATFORM_LINUX || LM_PLATFORM_APPLE
+    if (data_) {
+        ::munmap(data_, size_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    data_ = nullptr;
+    fd_ = -1;
+    #endif
+}
+
+LM_NAMESPACE_END(LM_NAMESPACE)
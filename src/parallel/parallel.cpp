@@ -5,11 +5,191 @@
 
 #include <pch.h>
 #include <lm/parallelcontext.h>
+#include <lm/exception.h>
+#include <lm/logger.h>
+#if LM_PLATFORM_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE::parallel)
 
 using Instance = comp::detail::ContextInstance<ParallelContext>;
 
+// ------------------------------------------------------------------------------------------------
+
+#if LM_PLATFORM_LINUX
+namespace {
+
+// Reads a list of integers in the format of sysfs, e.g., "0-3,8-11"
+std::vector<int> read_list(const std::string& path) {
+    std::vector<int> result;
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line)) {
+        return result;
+    }
+    std::stringstream ss(line);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        const auto dash = item.find('-');
+        const int b = std::stoi(item.substr(0, dash));
+        const int e = dash == std::string::npos ? b : std::stoi(item.substr(dash + 1));
+        for (int i = b; i <= e; i++) {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+// NUMA topology of the machine
+struct Topology {
+    std::vector<int> nodes;                 // Online NUMA nodes
+    std::vector<std::vector<int>> cpus;     // Logical processors of the nodes having processors
+
+    Topology() {
+        nodes = read_list("/sys/devices/system/node/online");
+        for (int node : nodes) {
+            auto c = read_list(fmt::format("/sys/devices/system/node/node{}/cpulist", node));
+            if (!c.empty()) {
+                cpus.push_back(std::move(c));
+            }
+        }
+        if (cpus.empty()) {
+            // NUMA information is not available. Treat the machine as a single node.
+            auto c = read_list("/sys/devices/system/cpu/online");
+            if (!c.empty()) {
+                cpus.push_back(std::move(c));
+            }
+        }
+    }
+};
+
+const Topology& topology() {
+    static const Topology topology;
+    return topology;
+}
+
+}
+#endif
+
+LM_PUBLIC_API void pin_thread(const std::string& policy, int index) {
+    if (policy == "none") {
+        return;
+    }
+    if (policy != "compact" && policy != "scatter") {
+        LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid affinity policy [policy='{}']", policy);
+    }
+    #if LM_PLATFORM_LINUX
+    const auto& t = topology();
+    if (t.cpus.empty()) {
+        return;
+    }
+    int cpu = -1;
+    if (policy == "compact") {
+        // Fill the processors of a node before moving to the next node
+        int num_cpus = 0;
+        for (const auto& c : t.cpus) {
+            num_cpus += int(c.size());
+        }
+        int i = index % num_cpus;
+        for (const auto& c : t.cpus) {
+            if (i < int(c.size())) {
+                cpu = c[i];
+                break;
+            }
+            i -= int(c.size());
+        }
+    }
+    else {
+        // Assign consecutive threads to different nodes
+        const int num_nodes = int(t.cpus.size());
+        const auto& c = t.cpus[index % num_nodes];
+        cpu = c[(index / num_nodes) % c.size()];
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0) {
+        LM_WARN("Failed to set thread affinity [index={}, cpu={}]", index, cpu);
+    }
+    #else
+    LM_UNUSED(index);
+    #endif
+}
+
+LM_PUBLIC_API std::vector<int> thread_affinity() {
+    std::vector<int> cpus;
+    #if LM_PLATFORM_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0) {
+        return cpus;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus.push_back(cpu);
+        }
+    }
+    #endif
+    return cpus;
+}
+
+LM_PUBLIC_API void set_thread_affinity(const std::vector<int>& cpus) {
+    #if LM_PLATFORM_LINUX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0) {
+        LM_WARN("Failed to restore thread affinity");
+    }
+    #else
+    LM_UNUSED(cpus);
+    #endif
+}
+
+LM_PUBLIC_API void interleave_memory(const void* data, size_t size) {
+    #if LM_PLATFORM_LINUX && defined(SYS_mbind)
+    const auto& t = topology();
+    if (t.nodes.size() <= 1 || !data || size == 0) {
+        return;
+    }
+
+    // Node mask of the online nodes
+    constexpr int MpolInterleave = 3;       // MPOL_INTERLEAVE
+    constexpr unsigned MpolMfMove = 1 << 1; // MPOL_MF_MOVE
+    constexpr int Bits = 8 * sizeof(unsigned long);
+    const int max_node = *std::max_element(t.nodes.begin(), t.nodes.end());
+    std::vector<unsigned long> mask(max_node / Bits + 1);
+    for (int node : t.nodes) {
+        mask[node / Bits] |= 1UL << (node % Bits);
+    }
+
+    // Apply the policy to the pages entirely inside the region.
+    // The partial pages at both ends are left as they are,
+    // because they can be shared with the other heap objects.
+    // The pages already touched are migrated. This is best effort so we ignore the failure.
+    const auto page = (uintptr_t)(sysconf(_SC_PAGESIZE));
+    const auto begin = ((uintptr_t)(data) + page - 1) & ~(page - 1);
+    const auto end = ((uintptr_t)(data) + size) & ~(page - 1);
+    if (begin >= end) {
+        return;
+    }
+    syscall(SYS_mbind, begin, end - begin, MpolInterleave, mask.data(), mask.size() * Bits + 1, MpolMfMove);
+    #else
+    LM_UNUSED(data, size);
+    #endif
+}
+
+// ------------------------------------------------------------------------------------------------
+
 LM_PUBLIC_API void init(const std::string& type, const Json& prop) {
     Instance::init("parallel::" + type, prop);
 }
@@ -26,8 +206,24 @@ LM_PUBLIC_API bool main_thread() {
     return Instance::get().main_thread();
 }
 
+LM_PUBLIC_API void foreach_range(long long num_samples, const ParallelRangeProcessFunc& process_func, const ProgressUpdateFunc& progress_func) {
+    Instance::get().foreach_range(num_samples, process_func, progress_func);
+}
+
 LM_PUBLIC_API void foreach(long long num_samples, const ParallelProcessFunc& process_func, const ProgressUpdateFunc& progress_func) {
-	Instance::get().foreach(num_samples, process_func, progress_func);
+    Instance::get().foreach_range(num_samples, [&](long long begin, long long end, int threadid) {
+        for (long long i = begin; i < end; i++) {
+            process_func(i, threadid);
+        }
+    }, progress_func);
+}
+
+LM_PUBLIC_API void cancel() {
+    Instance::get().cancel();
+}
+
+LM_PUBLIC_API bool cancelled() {
+    return Instance::get().cancelled();
 }
 
 LM_NAMESPACE_END(LM_NAMESPACE::parallel)
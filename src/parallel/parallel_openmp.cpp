@@ -14,19 +14,61 @@
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE::parallel)
 
+namespace {
+
+// Cancellation flag of the parallel loop processed by the current thread.
+// The flag is owned by each invocation of foreach_range() so that
+// the cancellation never affects the other loops running concurrently.
+thread_local std::atomic<bool>* current_cancelled = nullptr;
+
+// Sets the cancellation flag of the current thread in the scope
+class ScopedCancelFlag {
+public:
+    ScopedCancelFlag(std::atomic<bool>* flag) : prev_(current_cancelled) { current_cancelled = flag; }
+    ~ScopedCancelFlag() { current_cancelled = prev_; }
+    LM_DISABLE_COPY_AND_MOVE(ScopedCancelFlag)
+
+private:
+    std::atomic<bool>* prev_;
+};
+
+}
+
+// ------------------------------------------------------------------------------------------------
+
 class ParallelContext_OpenMP final : public ParallelContext {
 private:
     long long progress_update_interval_;	// Number of samples per progress update
+    long long block_size_;              // Number of samples per block (0: auto)
     int num_threads_;					// Number of threads
+    std::string affinity_;              // Thread affinity policy
 
 public:
     virtual void construct(const Json& prop) override {
         progress_update_interval_ = json::value<long long>(prop, "progress_update_interval", 100);
+        block_size_ = json::value<long long>(prop, "block_size", 0);
         num_threads_ = json::value(prop, "num_threads", std::thread::hardware_concurrency());
         if (num_threads_ <= 0) {
             num_threads_ = std::thread::hardware_concurrency() + num_threads_;
         }
         omp_set_num_threads(num_threads_);
+
+        // Pin the threads of the OpenMP thread pool.
+        // The calling thread works as the thread 0 in the parallel region,
+        // which is pinned only during the parallel loops.
+        affinity_ = json::value<std::string>(prop, "affinity", "none");
+        if (affinity_ != "none" && affinity_ != "compact" && affinity_ != "scatter") {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid affinity policy [policy='{}']", affinity_);
+        }
+        if (affinity_ != "none") {
+            #pragma omp parallel
+            {
+                const int thread_id = omp_get_thread_num();
+                if (thread_id > 0) {
+                    pin_thread(affinity_, thread_id);
+                }
+            }
+        }
     }
 
     virtual int num_threads() const override {
@@ -37,18 +79,32 @@ public:
         return omp_get_thread_num() == 0;
     }
 
-    virtual void foreach(long long numSamples, const ParallelProcessFunc& processFunc, const ProgressUpdateFunc& progressUpdateFunc) const override {
+    virtual void foreach_range(long long numSamples, const ParallelRangeProcessFunc& processFunc, const ProgressUpdateFunc& progressUpdateFunc) const override {
         // Captured exceptions inside the parallel loop
         std::atomic<bool> done = false;
         std::exception_ptr exp;
         std::mutex explock;
 
+        // Cancellation flag of this loop
+        std::atomic<bool> loop_cancelled = false;
+
+        // Pin the calling thread during the loop unless called inside the parallel region.
+        // The affinity of the caller is restored after the loop.
+        ScopedPinThread pin(omp_in_parallel() ? "none" : affinity_, 0);
+
+        // Split the samples into blocks.
+        // By default we make enough number of blocks per thread for load balancing.
+        const auto block_size = block_size_ > 0
+            ? block_size_
+            : std::max(1LL, numSamples / (num_threads_ * 32LL));
+        const auto num_blocks = (numSamples + block_size - 1) / block_size;
+
         // Execute parallel loop
         std::atomic<long long> processed = 0;
         #pragma omp parallel for schedule(dynamic, 1)
-        for (long long i = 0; i < numSamples; i++) {
+        for (long long b = 0; b < num_blocks; b++) {
             // Spin the loop if cancellation is requested
-            if (done) {
+            if (done || loop_cancelled) {
                 continue;
             }
 
@@ -61,6 +117,7 @@ public:
             // same thread that threw the exception.
             try {
                 const int thread_id = omp_get_thread_num();
+                ScopedCancelFlag cancel_flag(&loop_cancelled);
 
                 #if LM_PLATFORM_WINDOWS
                 // Set process group
@@ -71,10 +128,12 @@ public:
                 #endif
 
                 // Dispatch user-defined process
-                processFunc(i, thread_id);
+                const auto begin = b * block_size;
+                const auto end = std::min(begin + block_size, numSamples);
+                processFunc(begin, end, thread_id);
 
                 // Update processed number of samples
-                if (thread_local long long count = 0; ++count >= progress_update_interval_) {
+                if (thread_local long long count = 0; (count += end - begin) >= progress_update_interval_) {
                     processed += count;
                     count = 0;
                 }
@@ -98,6 +157,16 @@ public:
             std::rethrow_exception(exp);
         }
     }
+
+    virtual void cancel() const override {
+        if (current_cancelled) {
+            *current_cancelled = true;
+        }
+    }
+
+    virtual bool cancelled() const override {
+        return current_cancelled && *current_cancelled;
+    }
 };
 
 LM_COMP_REG_IMPL(ParallelContext_OpenMP, "parallel::openmp");
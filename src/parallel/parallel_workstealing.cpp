@@ -0,0 +1,418 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include <lm/core.h>
+#include <lm/parallelcontext.h>
+#if LM_ARCH_X86 || LM_ARCH_X64
+#include <immintrin.h>
+#endif
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE::parallel)
+
+namespace {
+
+// Number of failed attempts to get a range before an idle worker yields or parks.
+// The idle worker first spins with pause instructions increasing the duration exponentially,
+// then yields the processor, and finally parks on the condition variable,
+// so that it does not take the cycles from the sibling hyper-thread processing the last chunks.
+constexpr int SpinRounds = 8;
+constexpr int YieldRounds = 8;
+
+// Maximum duration of a park.
+// The workers are notified when a range is pushed or the job is completed,
+// and the timeout only bounds the delay of the notifications missed by the race.
+constexpr auto MaxParkDuration = std::chrono::microseconds(500);
+
+// Hints the processor that the thread is spinning
+inline void cpu_relax() {
+    #if LM_ARCH_X86 || LM_ARCH_X64
+    _mm_pause();
+    #else
+    std::this_thread::yield();
+    #endif
+}
+
+// Index of the worker associated to the current thread.
+// The thread calling foreach_range() works as the worker 0.
+thread_local int worker_id = 0;
+
+// Cancellation flag of the parallel loop processed by the current thread.
+// The flag is owned by each invocation of foreach_range() so that
+// the cancellation never affects the other loops running concurrently.
+thread_local std::atomic<bool>* current_cancelled = nullptr;
+
+// Sets the cancellation flag of the current thread in the scope
+class ScopedCancelFlag {
+public:
+    ScopedCancelFlag(std::atomic<bool>* flag) : prev_(current_cancelled) { current_cancelled = flag; }
+    ~ScopedCancelFlag() { current_cancelled = prev_; }
+    LM_DISABLE_COPY_AND_MOVE(ScopedCancelFlag)
+
+private:
+    std::atomic<bool>* prev_;
+};
+
+// Range of sample indices [begin, end)
+struct Range {
+    long long begin;
+    long long end;
+};
+
+// Deque of ranges owned by a worker.
+// The owner pushes and pops the ranges at the back,
+// and the other workers steal the ranges from the front.
+struct LM_ALIGN(64) Worker {
+    std::mutex mu;
+    std::deque<Range> q;
+};
+
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+    Parallel context with work-stealing thread pool.
+    The range of the samples is initially distributed evenly to the workers.
+    A worker recursively splits its range in halves pushing the upper halves to its deque,
+    and processes the remaining range of at most grain_size samples.
+    Idle workers steal the largest ranges from the front of the deques of the other workers,
+    so contiguous chunks of the samples stay on a thread unless the load is imbalanced.
+*/
+class ParallelContext_WorkStealing final : public ParallelContext {
+private:
+    long long progress_update_interval_;    // Number of samples per progress update
+    long long grain_size_;                  // Maximum number of samples processed as a chunk (0: auto)
+    int num_threads_;                       // Number of threads
+    std::string affinity_;                  // Thread affinity policy
+
+    // Thread pool
+    struct Pool {
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+        std::mutex mu;                      // For the states below
+        std::condition_variable cv;         // Notifies start of a job or shutdown
+        std::condition_variable cv_done;    // Notifies completion of a job
+        long long generation = 0;           // Incremented for each job
+        int running = 0;                    // Number of running pool threads
+        bool shutdown = false;              // True if the pool is shutting down
+        std::atomic<bool> busy = false;     // True during foreach_range()
+
+        // Parking of the idle workers
+        std::mutex idle_mu;
+        std::condition_variable idle_cv;    // Notifies a new range or completion of a job
+        std::atomic<int> idle = 0;          // Number of parked workers
+
+        // States of the current job
+        const ParallelRangeProcessFunc* process_func = nullptr;
+        const ProgressUpdateFunc* progress_func = nullptr;
+        long long grain = 1;                // Grain size of the job
+        std::atomic<long long> remaining;   // Number of samples not processed yet
+        std::atomic<long long> processed;   // Number of processed samples reported to progress
+        std::atomic<bool> done = false;     // True if an exception is captured
+        std::atomic<bool> cancelled = false;    // Cancellation flag of the job
+        std::exception_ptr exp;             // Captured exception
+        std::mutex explock;
+    };
+    std::unique_ptr<Pool> pool_;
+
+public:
+    ~ParallelContext_WorkStealing() {
+        if (!pool_) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lk(pool_->mu);
+            pool_->shutdown = true;
+        }
+        pool_->cv.notify_all();
+        for (auto& th : pool_->threads) {
+            th.join();
+        }
+    }
+
+    virtual void construct(const Json& prop) override {
+        progress_update_interval_ = json::value<long long>(prop, "progress_update_interval", 100);
+        grain_size_ = json::value<long long>(prop, "grain_size", 0);
+        num_threads_ = json::value(prop, "num_threads", std::thread::hardware_concurrency());
+        if (num_threads_ <= 0) {
+            num_threads_ = std::thread::hardware_concurrency() + num_threads_;
+        }
+
+        // Launch pool threads. The calling thread of foreach_range() works as the worker 0,
+        // which is pinned only during the parallel loops.
+        affinity_ = json::value<std::string>(prop, "affinity", "none");
+        if (affinity_ != "none" && affinity_ != "compact" && affinity_ != "scatter") {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid affinity policy [policy='{}']", affinity_);
+        }
+        pool_ = std::make_unique<Pool>();
+        for (int i = 0; i < num_threads_; i++) {
+            pool_->workers.push_back(std::make_unique<Worker>());
+        }
+        for (int i = 1; i < num_threads_; i++) {
+            pool_->threads.emplace_back([this, i]() {
+                worker_id = i;
+                pin_thread(affinity_, i);
+                worker_loop(i);
+            });
+        }
+    }
+
+    virtual int num_threads() const override {
+        return num_threads_;
+    }
+
+    virtual bool main_thread() const override {
+        return worker_id == 0;
+    }
+
+    virtual void foreach_range(long long numSamples, const ParallelRangeProcessFunc& processFunc, const ProgressUpdateFunc& progressUpdateFunc) const override {
+        auto& p = *pool_;
+
+        // Process the samples in the current thread without the pool
+        if (num_threads_ == 1) {
+            std::atomic<bool> loop_cancelled = false;
+            ScopedCancelFlag cancel_flag(&loop_cancelled);
+            if (numSamples > 0) {
+                processFunc(0, numSamples, worker_id);
+            }
+            progressUpdateFunc(numSamples);
+            return;
+        }
+
+        // Process the samples in the current thread if the pool is occupied,
+        // e.g., when foreach_range() is called inside the parallel loop
+        // or concurrently from another thread.
+        if (p.busy.exchange(true)) {
+            std::atomic<bool> loop_cancelled = false;
+            ScopedCancelFlag cancel_flag(&loop_cancelled);
+            if (numSamples > 0) {
+                processFunc(0, numSamples, worker_id);
+            }
+            return;
+        }
+
+        // Distribute the range evenly to the workers
+        for (int i = 0; i < num_threads_; i++) {
+            const auto begin = numSamples * i / num_threads_;
+            const auto end = numSamples * (i + 1) / num_threads_;
+            if (begin < end) {
+                p.workers[i]->q.push_back({ begin, end });
+            }
+        }
+
+        // Start the job
+        p.process_func = &processFunc;
+        p.progress_func = &progressUpdateFunc;
+        p.grain = grain_size_ > 0
+            ? grain_size_
+            : std::max(1LL, numSamples / (num_threads_ * 32LL));
+        p.remaining = numSamples;
+        p.processed = 0;
+        p.done = false;
+        p.cancelled = false;
+        p.exp = nullptr;
+        {
+            std::unique_lock<std::mutex> lk(p.mu);
+            p.running = num_threads_ - 1;
+            p.generation++;
+        }
+        p.cv.notify_all();
+
+        // Work as the worker 0 and wait for the other workers.
+        // The affinity of the caller is restored after the loop.
+        {
+            ScopedPinThread pin(affinity_, 0);
+            run(0);
+        }
+        {
+            std::unique_lock<std::mutex> lk(p.mu);
+            p.cv_done.wait(lk, [&]() { return p.running == 0; });
+        }
+
+        // Discard the ranges left by cancellation or exception
+        for (auto& w : p.workers) {
+            w->q.clear();
+        }
+        p.busy = false;
+
+        // Rethrow exception if available
+        if (p.exp) {
+            std::rethrow_exception(p.exp);
+        }
+    }
+
+    virtual void cancel() const override {
+        if (current_cancelled) {
+            *current_cancelled = true;
+        }
+    }
+
+    virtual bool cancelled() const override {
+        return current_cancelled && *current_cancelled;
+    }
+
+private:
+    // Main loop of the pool threads
+    void worker_loop(int id) const {
+        auto& p = *pool_;
+        long long generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lk(p.mu);
+                p.cv.wait(lk, [&]() { return p.shutdown || p.generation != generation; });
+                if (p.shutdown) {
+                    return;
+                }
+                generation = p.generation;
+            }
+            run(id);
+            {
+                std::unique_lock<std::mutex> lk(p.mu);
+                if (--p.running == 0) {
+                    p.cv_done.notify_all();
+                }
+            }
+        }
+    }
+
+    // Processes the samples of the current job until all samples are processed
+    void run(int id) const {
+        auto& p = *pool_;
+        unsigned int rng = 2463534242u + id;    // State of xorshift for victim selection
+        long long count = 0;                    // Processed samples not reported yet
+        int failures = 0;                       // Number of consecutive failures to get a range
+        ScopedCancelFlag cancel_flag(&p.cancelled);
+        while (p.remaining > 0 && !p.done && !p.cancelled) {
+            // Get a range from the own deque or steal one from the others
+            Range r;
+            if (!pop(id, r) && !steal(id, rng, r)) {
+                backoff(failures++);
+                continue;
+            }
+            failures = 0;
+
+            // Split the range in halves and expose the upper halves to the thieves
+            while (r.end - r.begin > p.grain) {
+                const auto mid = r.begin + (r.end - r.begin) / 2;
+                push(id, { mid, r.end });
+                r.end = mid;
+            }
+
+            // Process the chunk.
+            // We capture the exception inside the worker and rethrow it in foreach_range().
+            try {
+                (*p.process_func)(r.begin, r.end, id);
+
+                // Update processed number of samples
+                count += r.end - r.begin;
+                if (count >= progress_update_interval_) {
+                    p.processed += count;
+                    count = 0;
+                }
+
+                // Update progress
+                if (id == 0) {
+                    (*p.progress_func)(p.processed);
+                }
+            }
+            catch (...) {
+                // Capture exception
+                // pick the last one if some of the threads throw exceptions simultaneously
+                std::unique_lock<std::mutex> lock(p.explock);
+                p.exp = std::current_exception();
+                p.done = true;
+            }
+            // Wake up the parked workers to finish the job
+            if ((p.remaining -= r.end - r.begin) <= 0 || p.done || p.cancelled) {
+                notify_idle(true);
+            }
+        }
+        p.processed += count;
+    }
+
+    // Waits after a failure to get a range
+    void backoff(int failures) const {
+        auto& p = *pool_;
+        if (failures < SpinRounds) {
+            for (int i = 0; i < (1 << failures); i++) {
+                cpu_relax();
+            }
+            return;
+        }
+        if (failures < SpinRounds + YieldRounds) {
+            std::this_thread::yield();
+            return;
+        }
+        std::unique_lock<std::mutex> lk(p.idle_mu);
+        p.idle++;
+        p.idle_cv.wait_for(lk, MaxParkDuration);
+        p.idle--;
+    }
+
+    // Wakes up the parked workers
+    void notify_idle(bool all) const {
+        auto& p = *pool_;
+        if (p.idle.load() == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lk(p.idle_mu);
+        if (all) {
+            p.idle_cv.notify_all();
+        }
+        else {
+            p.idle_cv.notify_one();
+        }
+    }
+
+    // Pushes a range to the back of the own deque
+    void push(int id, Range r) const {
+        {
+            auto& w = *pool_->workers[id];
+            std::unique_lock<std::mutex> lk(w.mu);
+            w.q.push_back(r);
+        }
+        notify_idle(false);
+    }
+
+    // Pops a range from the back of the own deque
+    bool pop(int id, Range& r) const {
+        auto& w = *pool_->workers[id];
+        std::unique_lock<std::mutex> lk(w.mu);
+        if (w.q.empty()) {
+            return false;
+        }
+        r = w.q.back();
+        w.q.pop_back();
+        return true;
+    }
+
+    // Steals a range from the front of the deque of a randomly selected worker
+    bool steal(int id, unsigned int& rng, Range& r) const {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        const int offset = int(rng % unsigned(num_threads_));
+        for (int i = 0; i < num_threads_; i++) {
+            const int victim = (offset + i) % num_threads_;
+            if (victim == id) {
+                continue;
+            }
+            auto& w = *pool_->workers[victim];
+            std::unique_lock<std::mutex> lk(w.mu);
+            if (w.q.empty()) {
+                continue;
+            }
+            r = w.q.front();
+            w.q.pop_front();
+            return true;
+        }
+        return false;
+    }
+};
+
+LM_COMP_REG_IMPL(ParallelContext_WorkStealing, "parallel::workstealing");
+
+LM_NAMESPACE_END(LM_NAMESPACE::parallel)
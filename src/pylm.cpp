@@ -82,6 +82,7 @@ static void bind_math(pybind11::module& m) {
     pybind11::class_<Rng>(m, "Rng")
         .def(pybind11::init<>())
         .def(pybind11::init<int>())
+        .def(pybind11::init<unsigned int, long long, long long>())
         .def("u", &Rng::u);
 
     // Helper functions
@@ -348,6 +349,8 @@ static void bind_parallel(pybind11::module& m) {
             processFunc(index, threadId);
         });
     });
+    sm.def("cancel", &parallel::cancel);
+    sm.def("cancelled", &parallel::cancelled);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -457,6 +460,42 @@ static void bind_film(pybind11::module& m) {
                   sizeof(Float) }
             );
         });
+
+    // Film snapshot
+    pybind11::class_<FilmSnapshot>(m, "FilmSnapshot", pybind11::buffer_protocol(), R"x(
+        Snapshot of a film viewable as a numpy array of shape (h, w, 3) without copying,
+        e.g., ``np.array(snapshot, copy=False)``.
+        The array refers to the buffer owned by the film,
+        which is overwritten by the second next snapshot of the film.
+        That is, the snapshot N+2 overwrites the buffer still viewed by the snapshot N.
+        Copy the array to keep the values longer.
+    )x")
+        .def_readonly("w", &FilmSnapshot::w)
+        .def_readonly("h", &FilmSnapshot::h)
+        .def_readonly("version", &FilmSnapshot::version)
+        // Register buffer description.
+        // The buffer refers to the memory owned by the film without copying.
+        .def_buffer([](FilmSnapshot& snap) -> pybind11::buffer_info {
+            return pybind11::buffer_info(
+                const_cast<float*>(snap.data),
+                sizeof(float),
+                pybind11::format_descriptor<float>::format(),
+                3,
+                { snap.h, snap.w, 3 },
+                { 3 * snap.w * sizeof(float),
+                  3 * sizeof(float),
+                  sizeof(float) }
+            );
+        });
+
+
+    // Handle of asynchronous save
+    pybind11::class_<std::shared_future<bool>>(m, "FilmSaveHandle")
+        .def("wait", &std::shared_future<bool>::wait, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("get", &std::shared_future<bool>::get, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("ready", [](const std::shared_future<bool>& f) {
+            return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        });
     
     // Film
     class Film_Py final : public Film {
@@ -473,12 +512,21 @@ static void bind_film(pybind11::module& m) {
         virtual void set_pixel(int x, int y, Vec3 v) override {
             PYBIND11_OVERLOAD_PURE(void, Film, set_pixel, x, y, v);
         }
+        virtual Vec3 get_pixel(int x, int y) const override {
+            PYBIND11_OVERLOAD_PURE(Vec3, Film, get_pixel, x, y);
+        }
         virtual bool save(const std::string& outpath) const override {
             PYBIND11_OVERLOAD_PURE(bool, Film, save, outpath);
         }
+        virtual std::shared_future<bool> save_async(const std::string& outpath) override {
+            PYBIND11_OVERLOAD_PURE(std::shared_future<bool>, Film, save_async, outpath);
+        }
         virtual FilmBuffer buffer() override {
             PYBIND11_OVERLOAD_PURE(FilmBuffer, Film, buffer);
         }
+        virtual FilmSnapshot snapshot() override {
+            PYBIND11_OVERLOAD_PURE(FilmSnapshot, Film, snapshot);
+        }
         virtual void accum(const Film* film) override {
             PYBIND11_OVERLOAD_PURE(void, Film, accum, film);
         }
@@ -494,6 +542,9 @@ static void bind_film(pybind11::module& m) {
         virtual void clear() override {
             PYBIND11_OVERLOAD_PURE(void, Film, clear);
         }
+        virtual void flush() override {
+            PYBIND11_OVERLOAD(void, Film, flush);
+        }
     };
     pybind11::class_<Film, Film_Py, Component, Component::Ptr<Film>>(m, "Film")
         .def(pybind11::init<>())
@@ -501,9 +552,18 @@ static void bind_film(pybind11::module& m) {
         .def("size", &Film::size)
         .def("num_pixels", &Film::num_pixels)
         .def("set_pixel", &Film::set_pixel)
+        .def("get_pixel", &Film::get_pixel)
         .def("save", &Film::save)
+        .def("save_async", &Film::save_async)
         .def("aspect", &Film::aspect)
-        .def("buffer", &Film::buffer)
+        .def("buffer", &Film::buffer, pybind11::keep_alive<0, 1>())
+        .def("snapshot", &Film::snapshot, pybind11::keep_alive<0, 1>(), R"x(
+            Take a snapshot of the film.
+            The returned snapshot keeps the film alive.
+            The buffer of the snapshot is reused by the second next call,
+            so the snapshot N+2 overwrites the values of the snapshot N.
+        )x")
+        .def("flush", &Film::flush)
         .PYLM_DEF_COMP_BIND(Film);
 }
 
@@ -579,6 +639,52 @@ static void bind_scenenode(pybind11::module& m) {
 
 // ------------------------------------------------------------------------------------------------
 
+// Ray stream made from numpy arrays.
+// Origins and directions are given as arrays of shape (N,3),
+// which are converted into SoA layout.
+class RayStreamArrays {
+private:
+    std::vector<Float> o_[3];
+    std::vector<Float> d_[3];
+    std::vector<Float> tmin_;
+    std::vector<Float> tmax_;
+    RayStream stream_;
+
+public:
+    using Array = pybind11::array_t<Float, pybind11::array::c_style | pybind11::array::forcecast>;
+
+    RayStreamArrays(Array o, Array d, Array tmin, Array tmax) {
+        if (o.ndim() != 2 || d.ndim() != 2 || o.shape(1) != 3 || d.shape(1) != 3 ||
+            d.shape(0) != o.shape(0) || tmin.size() != o.shape(0) || tmax.size() != o.shape(0)) {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid shapes of ray stream arrays");
+        }
+        const int n = int(o.shape(0));
+        const auto o_v = o.unchecked<2>();
+        const auto d_v = d.unchecked<2>();
+        for (int a = 0; a < 3; a++) {
+            o_[a].resize(n);
+            d_[a].resize(n);
+            for (int i = 0; i < n; i++) {
+                o_[a][i] = o_v(i, a);
+                d_[a][i] = d_v(i, a);
+            }
+        }
+        tmin_.assign(tmin.data(), tmin.data() + n);
+        tmax_.assign(tmax.data(), tmax.data() + n);
+        stream_.n = n;
+        for (int a = 0; a < 3; a++) {
+            stream_.o[a] = o_[a].data();
+            stream_.d[a] = d_[a].data();
+        }
+        stream_.tmin = tmin_.data();
+        stream_.tmax = tmax_.data();
+    }
+
+    const RayStream& stream() const {
+        return stream_;
+    }
+};
+
 // Bind scene.h
 static void bind_scene(pybind11::module& m) {
     class Scene_Py final : public Scene {
@@ -602,6 +708,9 @@ static void bind_scene(pybind11::module& m) {
         virtual int create_instance_group_node() override {
             PYBIND11_OVERLOAD_PURE(int, Scene, create_instance_group_node);
         }
+        virtual void set_transform(int node_index, Mat4 transform) override {
+            PYBIND11_OVERLOAD_PURE(void, Scene, set_transform, node_index, transform);
+        }
         virtual void add_child(int parent, int child) override {
             PYBIND11_OVERLOAD_PURE(void, Scene, add_child, parent, child);
         }
@@ -645,9 +754,21 @@ static void bind_scene(pybind11::module& m) {
         virtual void build() override {
             PYBIND11_OVERLOAD_PURE(void, Scene, build);
         }
+        virtual void update() override {
+            PYBIND11_OVERLOAD_PURE(void, Scene, update);
+        }
         virtual std::optional<SceneInteraction> intersect(Ray ray, Float tmin, Float tmax) const override {
             PYBIND11_OVERLOAD_PURE(std::optional<SceneInteraction>, Scene, intersect, ray, tmin, tmax);
         }
+        virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+            PYBIND11_OVERLOAD_PURE(bool, Scene, occluded, ray, tmin, tmax);
+        }
+        virtual void intersect_stream(const RayStream& rays, std::optional<SceneInteraction>* sis) const override {
+            // Stream of rays can not be passed to Python. Fall back to per-ray intersection.
+            for (int i = 0; i < rays.n; i++) {
+                sis[i] = intersect(rays.ray(i), rays.tmin[i], rays.tmax[i]);
+            }
+        }
         // ----------------------------------------------------------------------------------------
         virtual bool is_light(const SceneInteraction& sp) const override {
             PYBIND11_OVERLOAD_PURE(bool, Scene, is_light, sp);
@@ -682,6 +803,7 @@ static void bind_scene(pybind11::module& m) {
         })
         .def("create_group_node", &Scene::create_group_node)
         .def("create_instance_group_node", &Scene::create_instance_group_node)
+        .def("set_transform", &Scene::set_transform)
         .def("add_child", &Scene::add_child)
         .def("add_child_from_model", &Scene::add_child_from_model)
         .def("create_group_from_model", &Scene::create_group_from_model)
@@ -712,7 +834,15 @@ static void bind_scene(pybind11::module& m) {
         .def("accel", &Scene::accel, pybind11::return_value_policy::reference)
         .def("set_accel", &Scene::set_accel)
         .def("build", &Scene::build)
+        .def("update", &Scene::update)
         .def("intersect", &Scene::intersect, "ray"_a = Ray{}, "tmin"_a = Eps, "tmax"_a = Inf)
+        .def("occluded", &Scene::occluded, "ray"_a = Ray{}, "tmin"_a = Eps, "tmax"_a = Inf)
+        .def("intersect_stream", [](const Scene& self, RayStreamArrays::Array o, RayStreamArrays::Array d, RayStreamArrays::Array tmin, RayStreamArrays::Array tmax) {
+            const RayStreamArrays rays(o, d, tmin, tmax);
+            std::vector<std::optional<SceneInteraction>> sis(rays.stream().n);
+            self.intersect_stream(rays.stream(), sis.data());
+            return sis;
+        })
         .def("visible", &Scene::visible)
         //
         .def("is_light", &Scene::is_light)
@@ -746,11 +876,43 @@ static void bind_accel(pybind11::module& m) {
         virtual std::optional<Hit> intersect(Ray ray, Float tmin, Float tmax) const override {
             PYBIND11_OVERLOAD_PURE(std::optional<Hit>, Accel, intersect, ray, tmin, tmax);
         }
+        virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+            PYBIND11_OVERLOAD(bool, Accel, occluded, ray, tmin, tmax);
+        }
+        virtual bool refit(const Scene& scene) override {
+            PYBIND11_OVERLOAD(bool, Accel, refit, scene);
+        }
     };
     pybind11::class_<Accel, Accel_Py, Component, Component::Ptr<Accel>>(m, "Accel")
         .def(pybind11::init<>())
         .def("build", &Accel::build)
+        .def("refit", &Accel::refit)
         .def("intersect", &Accel::intersect)
+        .def("occluded", &Accel::occluded)
+        .def("intersect_stream", [](const Accel& self, RayStreamArrays::Array o, RayStreamArrays::Array d, RayStreamArrays::Array tmin, RayStreamArrays::Array tmax) {
+            // Returns a tuple of arrays (t, uv, primitive, face).
+            // Primitive index is -1 for rays without intersection.
+            const RayStreamArrays rays(o, d, tmin, tmax);
+            const auto n = rays.stream().n;
+            std::vector<Accel::Hit> hits(n);
+            self.intersect_stream(rays.stream(), hits.data());
+            pybind11::array_t<Float> t(n);
+            pybind11::array_t<Float> uv(std::vector<size_t>{ size_t(n), 2 });
+            pybind11::array_t<int> primitive(n);
+            pybind11::array_t<int> face(n);
+            auto t_v = t.mutable_unchecked<1>();
+            auto uv_v = uv.mutable_unchecked<2>();
+            auto primitive_v = primitive.mutable_unchecked<1>();
+            auto face_v = face.mutable_unchecked<1>();
+            for (int i = 0; i < n; i++) {
+                t_v(i) = hits[i].t;
+                uv_v(i, 0) = hits[i].uv.x;
+                uv_v(i, 1) = hits[i].uv.y;
+                primitive_v(i) = hits[i].primitive;
+                face_v(i) = hits[i].face;
+            }
+            return pybind11::make_tuple(t, uv, primitive, face);
+        })
         .PYLM_DEF_COMP_BIND(Accel);
 }
 
@@ -766,10 +928,14 @@ static void bind_renderer(pybind11::module& m) {
         virtual Json render() const override {
             PYBIND11_OVERLOAD_PURE(Json, Renderer, render);
         }
+        virtual void reset() override {
+            PYBIND11_OVERLOAD(void, Renderer, reset);
+        }
     };
     pybind11::class_<Renderer, Renderer_Py, Component, Component::Ptr<Renderer>>(m, "Renderer")
         .def(pybind11::init<>())
         .def("render", &Renderer::render, pybind11::call_guard<pybind11::gil_scoped_release>())
+        .def("reset", &Renderer::reset)
         .PYLM_DEF_COMP_BIND(Renderer);
 }
 
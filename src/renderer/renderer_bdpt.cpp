@@ -9,6 +9,7 @@
 #include <lm/scene.h>
 #include <lm/film.h>
 #include <lm/scheduler.h>
+#include <lm/sampler.h>
 #include <lm/bidir.h>
 #include <lm/debug.h>
 #include <lm/timer.h>
@@ -43,6 +44,9 @@ public:
     int max_verts_;                                 // Maximum number of path vertices
     std::optional<unsigned int> seed_;              // Random seed
     Component::Ptr<scheduler::Scheduler> sched_;    // Scheduler for parallel processing
+    Component::Ptr<Sampler> sampler_;               // Sampler (optional)
+    bool progressive_;                              // True to accumulate the samples across renderings
+    mutable ProgressiveAccumulator accum_;          // Accumulated samples (progressive mode)
 
 public:
     virtual void construct(const Json& prop) override {
@@ -51,10 +55,51 @@ public:
         min_verts_ = json::value<int>(prop, "min_verts", 2);
         max_verts_ = json::value<int>(prop, "max_verts");
         seed_ = json::value_or_none<unsigned int>(prop, "seed");
+        progressive_ = json::value<bool>(prop, "progressive", false);
+        if (const auto sampler_name = json::value_or_none<std::string>(prop, "sampler")) {
+            sampler_ = comp::create<Sampler>("sampler::" + *sampler_name, make_loc("sampler"), prop);
+        }
         const auto sched_name = json::value<std::string>(prop, "scheduler");
         sched_ = comp::create<scheduler::Scheduler>(
             "scheduler::spi::" + sched_name, make_loc("scheduler"), prop);
     }
+
+    virtual void reset() override {
+        accum_.reset();
+    }
+
+protected:
+    // Normalization factor of the image
+    Float norm() const {
+        const auto size = film_->size();
+        return Float(size.w * size.h);
+    }
+
+    // Clears film. In progressive mode, the film keeps the samples of the previous renderings.
+    void clear_film() const {
+        if (progressive_) {
+            accum_.begin(film_, norm());
+        }
+        else {
+            film_->clear();
+        }
+    }
+
+    // Offset of the sample indices.
+    // In progressive mode, the sample indices continue from the previous renderings.
+    long long sample_offset() const {
+        return progressive_ ? accum_.count() : 0;
+    }
+
+    // Rescales film and returns the result of the rendering
+    Json finalize_film(long long processed, const timer::ScopedTimer& st) const {
+        if (progressive_) {
+            const auto total_processed = accum_.end(film_, norm(), processed);
+            return { {"processed", processed}, {"total_processed", total_processed}, {"elapsed", st.now()} };
+        }
+        film_->rescale(norm() / processed);
+        return { {"processed", processed}, {"elapsed", st.now()} };
+    }
 };
 
 // ------------------------------------------------------------------------------------------------
@@ -64,16 +109,17 @@ class Renderer_PT_Naive_Path final : public Renderer_Path_Base {
 public:
     virtual Json render() const override {
         scene_->require_renderable();
-        film_->clear();
-        const auto size = film_->size();
+        clear_film();
         timer::ScopedTimer st;
 
-        // Execute parallel process
-        const auto processed = sched_->run([&](long long, long long sample_index, int threadid) {
-            LM_KEEP_UNUSED(sample_index);
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+        const auto offset = sample_offset();
 
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
+        // Execute parallel process
+        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int threadid) {
+            // Random number generator determined by the pixel and sample indices
+            Rng rng(seed, pixel_index, offset + sample_index, sampler_.get());
 
             // Sample eye subpath
             const auto subpathE = path::sample_subpath(rng, scene_, max_verts_, TransDir::EL);
@@ -115,9 +161,7 @@ public:
         });
 
         // Rescale film
-        film_->rescale(Float(size.w * size.h) / processed);
-
-        return { {"processed", processed}, {"elapsed", st.now()} };
+        return finalize_film(processed, st);
     }
 };
 
@@ -130,14 +174,17 @@ class Renderer_PT_NEE_Path final : public Renderer_Path_Base {
 public:
     virtual Json render() const override {
         scene_->require_renderable();
-        film_->clear();
-        const auto size = film_->size();
+        clear_film();
         timer::ScopedTimer st;
 
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+        const auto offset = sample_offset();
+
         // Execute parallel process
-        const auto processed = sched_->run([&](long long, long long, int threadid) {
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
+        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int) {
+            // Random number generator determined by the pixel and sample indices
+            Rng rng(seed, pixel_index, offset + sample_index, sampler_.get());
 
             // Sample subpaths
             const auto subpathE = path::sample_subpath(rng, scene_, max_verts_, TransDir::EL);
@@ -191,9 +238,7 @@ public:
         });
 
         // Rescale film
-        film_->rescale(Float(size.w * size.h) / processed);
-
-        return { {"processed", processed}, {"elapsed", st.now()} };
+        return finalize_film(processed, st);
     }
 };
 
@@ -206,16 +251,17 @@ class Renderer_LT_NEE_Path final : public Renderer_Path_Base {
 public:
     virtual Json render() const override {
         scene_->require_renderable();
-        film_->clear();
-        const auto size = film_->size();
+        clear_film();
         timer::ScopedTimer st;
 
-        // Execute parallel process
-        const auto processed = sched_->run([&](long long, long long sample_index, int threadid) {
-            LM_KEEP_UNUSED(sample_index);
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+        const auto offset = sample_offset();
 
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
+        // Execute parallel process
+        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int threadid) {
+            // Random number generator determined by the pixel and sample indices
+            Rng rng(seed, pixel_index, offset + sample_index, sampler_.get());
 
             // Sample subpaths
             const auto subpathE = path::sample_subpath(rng, scene_, 1, TransDir::EL);
@@ -279,9 +325,7 @@ public:
         });
 
         // Rescale film
-        film_->rescale(Float(size.w * size.h) / processed);
-
-        return { {"processed", processed}, {"elapsed", st.now()} };
+        return finalize_film(processed, st);
     }
 };
 
@@ -329,16 +373,17 @@ public:
 public:
     virtual Json render() const override {
         scene_->require_renderable();
-        film_->clear();
-        const auto size = film_->size();
+        clear_film();
         timer::ScopedTimer st;
 
-        // Execute parallel process
-        const auto processed = sched_->run([&](long long, long long sample_index, int threadid) {
-            LM_KEEP_UNUSED(sample_index);
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+        const auto offset = sample_offset();
 
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
+        // Execute parallel process
+        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int) {
+            // Random number generator determined by the pixel and sample indices
+            Rng rng(seed, pixel_index, offset + sample_index, sampler_.get());
 
             // Sample subpaths
             const auto subpathE = path::sample_subpath(rng, scene_, max_verts_, TransDir::EL);
@@ -395,18 +440,17 @@ public:
             }
         });
 
-        // Rescale film
-        const auto scale = Float(size.w * size.h) / processed;
-        film_->rescale(scale);
+        // Rescale film.
+        // The per-strategy films are not accumulated in progressive mode.
         #if BDPT_PER_STRATEGY_FILM
+        const auto scale = norm() / processed;
         for (int k = 2; k <= max_verts_; k++) {
             for (int s = 0; s <= k; s++) {
                 strategy_films_[k-2][s]->rescale(scale);
             }
         }
         #endif
-
-        return { {"processed", processed}, {"elapsed", st.now()} };
+        return finalize_film(processed, st);
     }
 };
 
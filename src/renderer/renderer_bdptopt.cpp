@@ -9,6 +9,7 @@
 #include <lm/scene.h>
 #include <lm/film.h>
 #include <lm/scheduler.h>
+#include <lm/sampler.h>
 #include <lm/path.h>
 #include <lm/timer.h>
 #include <lm/parallel.h>
@@ -424,6 +425,9 @@ private:
     int max_verts_;                                 // Maximum number of path vertices
     std::optional<unsigned int> seed_;              // Random seed
     Component::Ptr<scheduler::Scheduler> sched_;    // Scheduler for parallel processing
+    Component::Ptr<Sampler> sampler_;               // Sampler (optional)
+    bool progressive_;                              // True to accumulate the samples across renderings
+    mutable ProgressiveAccumulator accum_;          // Accumulated samples (progressive mode)
 
     #if BDPT_PER_STRATEGY_FILM
     // Index: (k, s)
@@ -440,6 +444,10 @@ public:
         min_verts_ = json::value<int>(prop, "min_verts", 2);
         max_verts_ = json::value<int>(prop, "max_verts");
         seed_ = json::value_or_none<unsigned int>(prop, "seed");
+        progressive_ = json::value<bool>(prop, "progressive", false);
+        if (const auto sampler_name = json::value_or_none<std::string>(prop, "sampler")) {
+            sampler_ = comp::create<Sampler>("sampler::" + *sampler_name, make_loc("sampler"), prop);
+        }
         const auto sched_name = json::value<std::string>(prop, "scheduler");
         sched_ = comp::create<scheduler::Scheduler>(
             "scheduler::spi::" + sched_name, make_loc("scheduler"), prop);
@@ -467,19 +475,36 @@ public:
     }
     #endif
 
+    virtual void reset() override {
+        accum_.reset();
+    }
+
     virtual Json render() const override {
         scene_->require_renderable();
-        film_->clear();
         const auto size = film_->size();
+        const auto norm = Float(size.w * size.h);
+
+        // Clear film.
+        // In progressive mode, the film keeps the samples of the previous renderings.
+        if (progressive_) {
+            accum_.begin(film_, norm);
+        }
+        else {
+            film_->clear();
+        }
         timer::ScopedTimer st;
 
 
-        // Execute parallel process
-        const auto processed = sched_->run([&](long long, long long sample_index, int threadid) {
-            LM_KEEP_UNUSED(sample_index);
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+
+        // In progressive mode, the sample indices continue from the previous renderings
+        const auto sample_offset = progressive_ ? accum_.count() : 0;
 
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
+        // Execute parallel process
+        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int) {
+            // Random number generator determined by the pixel and sample indices
+            Rng rng(seed, pixel_index, sample_offset + sample_index, sampler_.get());
 
             // Sample subpaths
             thread_local Path subpathE;
@@ -517,9 +542,9 @@ public:
             }
         });
 
-        // Rescale film
-        const auto scale = Float(size.w * size.h) / processed;
-        film_->rescale(scale);
+        // Rescale film.
+        // The per-strategy films are not accumulated in progressive mode.
+        const auto scale = norm / processed;
         #if BDPT_PER_STRATEGY_FILM
         for (int k = 2; k <= max_verts_; k++) {
             for (int s = 0; s <= k; s++) {
@@ -527,6 +552,11 @@ public:
             }
         }
         #endif
+        if (progressive_) {
+            const auto total_processed = accum_.end(film_, norm, processed);
+            return { {"processed", processed}, {"total_processed", total_processed}, {"elapsed", st.now()} };
+        }
+        film_->rescale(scale);
 
         return { {"processed", processed}, {"elapsed", st.now()} };
     }
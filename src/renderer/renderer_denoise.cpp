@@ -0,0 +1,318 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include <lm/core.h>
+#include <lm/renderer.h>
+#include <lm/film.h>
+#include <lm/parallel.h>
+#include <lm/timer.h>
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+
+namespace {
+
+// Image stored as the planes of the channels
+struct Planes {
+    std::vector<float> c[3];
+};
+
+// Coefficients of B3-spline kernel
+constexpr float Kernel[5] = { 1.f/16.f, 1.f/4.f, 3.f/8.f, 1.f/4.f, 1.f/16.f };
+
+// Edge-stopping function.
+// Rational approximation of exp(-d) for d >= 0, which keeps the inner loop vectorizable.
+inline float edge_stop(float d) {
+    return 1.f / (1.f + d*(1.f + d*(.5f + d*(1.f/6.f))));
+}
+
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+    Edge-avoiding A-Trous wavelet denoiser.
+    cf. H. Dammertz et al., Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination Filtering, HPG 2010.
+
+    The renderer filters the image of `input` film and writes the result to `output` film.
+    The filter is guided by the optional auxiliary films `albedo`, `normal`, and `depth`,
+    e.g., the outputs of the renderers with `aovs` property.
+    Each iteration applies 5x5 B3-spline kernel with the taps placed 2^i pixels apart,
+    weighted by the differences of the color and the guides between the pixels.
+    The tolerance of the color difference is `sigma_color` times the mean luminance of the image,
+    halved for each iteration. If `demodulate` is true and `albedo` is given,
+    the color is divided by the albedo before filtering to preserve the textures.
+    The image is processed in tiles of `tile_size` pixels in parallel,
+    and the pixels in a row of a tile are processed in a vectorizable loop.
+*/
+class Renderer_Denoise_ATrous final : public Renderer {
+private:
+    Film* input_;           // Input film
+    Film* output_;          // Output film
+    Film* albedo_;          // Albedo (optional)
+    Film* normal_;          // Normal (optional)
+    Film* depth_;           // Depth (optional)
+    int iterations_;        // Number of iterations
+    Float sigma_color_;     // Tolerance of color difference relative to mean luminance
+    Float sigma_albedo_;    // Tolerance of albedo difference
+    Float sigma_normal_;    // Tolerance of normal difference
+    Float sigma_depth_;     // Tolerance of depth difference relative to depth
+    bool demodulate_;       // True to filter the color divided by the albedo
+    int tile_size_;         // Width and height of a tile
+
+public:
+    LM_SERIALIZE_IMPL(ar) {
+        ar(input_, output_, albedo_, normal_, depth_, iterations_,
+            sigma_color_, sigma_albedo_, sigma_normal_, sigma_depth_, demodulate_, tile_size_);
+    }
+
+    virtual void foreach_underlying(const ComponentVisitor& visit) override {
+        comp::visit(visit, input_);
+        comp::visit(visit, output_);
+        comp::visit(visit, albedo_);
+        comp::visit(visit, normal_);
+        comp::visit(visit, depth_);
+    }
+
+public:
+    virtual void construct(const Json& prop) override {
+        input_ = json::comp_ref<Film>(prop, "input");
+        output_ = json::comp_ref<Film>(prop, "output");
+        albedo_ = json::comp_ref_or_nullptr<Film>(prop, "albedo");
+        normal_ = json::comp_ref_or_nullptr<Film>(prop, "normal");
+        depth_ = json::comp_ref_or_nullptr<Film>(prop, "depth");
+        iterations_ = json::value<int>(prop, "iterations", 5);
+        sigma_color_ = json::value<Float>(prop, "sigma_color", 1_f);
+        sigma_albedo_ = json::value<Float>(prop, "sigma_albedo", .1_f);
+        sigma_normal_ = json::value<Float>(prop, "sigma_normal", .1_f);
+        sigma_depth_ = json::value<Float>(prop, "sigma_depth", .1_f);
+        demodulate_ = json::value<bool>(prop, "demodulate", true);
+        tile_size_ = json::value<int>(prop, "tile_size", 64);
+        if (tile_size_ <= 0) {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Tile size must be positive [tile_size={}]", tile_size_);
+        }
+    }
+
+    virtual Json render() const override {
+        timer::ScopedTimer st;
+        const int w = input_->size().w;
+        const int h = input_->size().h;
+        for (const auto* film : { output_, albedo_, normal_, depth_ }) {
+            if (film && (film->size().w != w || film->size().h != h)) {
+                LM_THROW_EXCEPTION(Error::InvalidArgument,
+                    "Film size is different [expected='({},{})', actual='({},{})']",
+                    w, h, film->size().w, film->size().h);
+            }
+        }
+
+        // Load the images
+        auto color = read(input_);
+        const auto albedo = albedo_ ? read(albedo_) : Planes{};
+        const auto normal = normal_ ? read(normal_) : Planes{};
+        const auto depth = depth_ ? read(depth_) : Planes{};
+        const bool demodulate = demodulate_ && albedo_;
+        if (demodulate) {
+            modulate(color, albedo, false);
+        }
+
+        // Tolerance of the color difference
+        double sum_lum = 0;
+        for (size_t i = 0; i < color.c[0].size(); i++) {
+            sum_lum += .2126 * color.c[0][i] + .7152 * color.c[1][i] + .0722 * color.c[2][i];
+        }
+        const auto mean_lum = std::max(sum_lum / std::max(size_t(1), color.c[0].size()), 1e-6);
+
+        // Apply the filter
+        auto temp = color;
+        for (int it = 0; it < iterations_; it++) {
+            // Squared tolerances are stored as the inverses
+            Params p;
+            p.step = 1 << it;
+            const auto sigma_color = sigma_color_ * mean_lum / double(1 << it);
+            p.inv_sc2 = float(1. / (sigma_color * sigma_color));
+            p.inv_sa2 = float(1. / (sigma_albedo_ * sigma_albedo_));
+            p.inv_sn2 = float(1. / (sigma_normal_ * sigma_normal_));
+            p.inv_sz2 = float(1. / (sigma_depth_ * sigma_depth_));
+            dispatch(w, h, p, color, temp, albedo, normal, depth);
+            std::swap(color, temp);
+        }
+
+        // Write the result
+        if (demodulate) {
+            modulate(color, albedo, true);
+        }
+        parallel::foreach(h, [&](long long y, int) {
+            for (int x = 0; x < w; x++) {
+                const auto i = y*w + x;
+                output_->set_pixel(x, int(y), Vec3(color.c[0][i], color.c[1][i], color.c[2][i]));
+            }
+        });
+
+        return { {"elapsed", st.now()} };
+    }
+
+private:
+    // Parameters of an iteration
+    struct Params {
+        int step;       // Distance between the taps
+        float inv_sc2;  // Inverse of squared tolerance of color
+        float inv_sa2;  // Inverse of squared tolerance of albedo
+        float inv_sn2;  // Inverse of squared tolerance of normal
+        float inv_sz2;  // Inverse of squared tolerance of relative depth
+    };
+
+    // Reads the film into the planes
+    Planes read(const Film* film) const {
+        const int w = film->size().w;
+        const int h = film->size().h;
+        Planes p;
+        for (auto& c : p.c) {
+            c.resize(size_t(w) * h);
+        }
+        parallel::foreach(h, [&](long long y, int) {
+            for (int x = 0; x < w; x++) {
+                const auto v = film->get_pixel(x, int(y));
+                for (int j = 0; j < 3; j++) {
+                    p.c[j][y*w + x] = float(v[j]);
+                }
+            }
+        });
+        return p;
+    }
+
+    // Divides (inverse = false) or multiplies (inverse = true) the color by the albedo.
+    // The channels with zero albedo are kept as they are.
+    void modulate(Planes& color, const Planes& albedo, bool inverse) const {
+        parallel::foreach(3, [&](long long j, int) {
+            auto& c = color.c[j];
+            const auto& a = albedo.c[j];
+            for (size_t i = 0; i < c.size(); i++) {
+                if (a[i] > 1e-3f) {
+                    c[i] = inverse ? c[i] * a[i] : c[i] / a[i];
+                }
+            }
+        });
+    }
+
+    // Selects the instantiation of the filter for the available guides
+    void dispatch(int w, int h, const Params& p, const Planes& src, Planes& dst,
+        const Planes& albedo, const Planes& normal, const Planes& depth) const
+    {
+        const int index = (albedo_ ? 1 : 0) | (normal_ ? 2 : 0) | (depth_ ? 4 : 0);
+        switch (index) {
+            case 0: filter<false, false, false>(w, h, p, src, dst, albedo, normal, depth); break;
+            case 1: filter<true,  false, false>(w, h, p, src, dst, albedo, normal, depth); break;
+            case 2: filter<false, true,  false>(w, h, p, src, dst, albedo, normal, depth); break;
+            case 3: filter<true,  true,  false>(w, h, p, src, dst, albedo, normal, depth); break;
+            case 4: filter<false, false, true >(w, h, p, src, dst, albedo, normal, depth); break;
+            case 5: filter<true,  false, true >(w, h, p, src, dst, albedo, normal, depth); break;
+            case 6: filter<false, true,  true >(w, h, p, src, dst, albedo, normal, depth); break;
+            case 7: filter<true,  true,  true >(w, h, p, src, dst, albedo, normal, depth); break;
+        }
+    }
+
+    // Applies an iteration of the filter
+    template <bool UseAlbedo, bool UseNormal, bool UseDepth>
+    void filter(int w, int h, const Params& p, const Planes& src, Planes& dst,
+        const Planes& albedo, const Planes& normal, const Planes& depth) const
+    {
+        // Raw pointers to the planes so that the compiler can vectorize the inner loop
+        const float* s0 = src.c[0].data();
+        const float* s1 = src.c[1].data();
+        const float* s2 = src.c[2].data();
+        const float* a0 = albedo.c[0].data();
+        const float* a1 = albedo.c[1].data();
+        const float* a2 = albedo.c[2].data();
+        const float* n0 = normal.c[0].data();
+        const float* n1 = normal.c[1].data();
+        const float* n2 = normal.c[2].data();
+        const float* z = depth.c[0].data();
+        float* d0 = dst.c[0].data();
+        float* d1 = dst.c[1].data();
+        float* d2 = dst.c[2].data();
+        LM_UNUSED(a0, a1, a2, n0, n1, n2, z);   // Unused if the guide is not available
+
+        const int tiles_x = (w + tile_size_ - 1) / tile_size_;
+        const int tiles_y = (h + tile_size_ - 1) / tile_size_;
+        parallel::foreach(tiles_x * tiles_y, [&](long long t, int) {
+            const int x0 = int(t % tiles_x) * tile_size_;
+            const int y0 = int(t / tiles_x) * tile_size_;
+            const int x1 = std::min(x0 + tile_size_, w);
+            const int y1 = std::min(y0 + tile_size_, h);
+            const int tw = x1 - x0;
+
+            // Weighted sums of a row of the tile
+            std::vector<float> sums(4 * size_t(tw));
+            float* sum_r = sums.data();
+            float* sum_g = sum_r + tw;
+            float* sum_b = sum_g + tw;
+            float* sum_w = sum_b + tw;
+
+            for (int y = y0; y < y1; y++) {
+                std::fill(sums.begin(), sums.end(), 0.f);
+                for (int ky = 0; ky < 5; ky++) {
+                    const int yy = y + (ky - 2) * p.step;
+                    if (yy < 0 || yy >= h) {
+                        continue;
+                    }
+                    for (int kx = 0; kx < 5; kx++) {
+                        // Range of the pixels in the row whose tap is inside the image
+                        const int dx = (kx - 2) * p.step;
+                        const int xs = std::max(x0, -dx);
+                        const int xe = std::min(x1, w - dx);
+                        const float hk = Kernel[ky] * Kernel[kx];
+                        const size_t op = size_t(y) * w;         // Offset of the center pixels
+                        const size_t oq = size_t(yy) * w + dx;   // Offset of the tap pixels
+
+                        // Vectorizable loop over the pixels
+                        for (int x = xs; x < xe; x++) {
+                            const size_t ip = op + x;
+                            const size_t iq = oq + x;
+                            const float dr = s0[ip] - s0[iq];
+                            const float dg = s1[ip] - s1[iq];
+                            const float db = s2[ip] - s2[iq];
+                            float d = (dr*dr + dg*dg + db*db) * p.inv_sc2;
+                            if constexpr (UseAlbedo) {
+                                const float ar = a0[ip] - a0[iq];
+                                const float ag = a1[ip] - a1[iq];
+                                const float ab = a2[ip] - a2[iq];
+                                d += (ar*ar + ag*ag + ab*ab) * p.inv_sa2;
+                            }
+                            if constexpr (UseNormal) {
+                                const float nx = n0[ip] - n0[iq];
+                                const float ny = n1[ip] - n1[iq];
+                                const float nz = n2[ip] - n2[iq];
+                                d += (nx*nx + ny*ny + nz*nz) * p.inv_sn2;
+                            }
+                            if constexpr (UseDepth) {
+                                const float dz = z[ip] - z[iq];
+                                d += dz * dz * p.inv_sz2 / (z[ip] * z[ip] + 1e-6f);
+                            }
+                            const float wq = hk * edge_stop(d);
+                            const int k = x - x0;
+                            sum_r[k] += wq * s0[iq];
+                            sum_g[k] += wq * s1[iq];
+                            sum_b[k] += wq * s2[iq];
+                            sum_w[k] += wq;
+                        }
+                    }
+                }
+
+                // Normalize. The weight of the center tap is always positive.
+                const size_t op = size_t(y) * w + x0;
+                for (int k = 0; k < tw; k++) {
+                    const float inv = 1.f / sum_w[k];
+                    d0[op + k] = sum_r[k] * inv;
+                    d1[op + k] = sum_g[k] * inv;
+                    d2[op + k] = sum_b[k] * inv;
+                }
+            }
+        });
+    }
+};
+
+LM_COMP_REG_IMPL(Renderer_Denoise_ATrous, "renderer::denoise_atrous");
+
+LM_NAMESPACE_END(LM_NAMESPACE)
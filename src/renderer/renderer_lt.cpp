@@ -9,6 +9,7 @@
 #include <lm/scene.h>
 #include <lm/film.h>
 #include <lm/scheduler.h>
+#include <lm/sampler.h>
 #include <lm/path.h>
 #include <lm/timer.h>
 
@@ -22,16 +23,20 @@ private:
     int max_verts_;                                 // Maximum number of path vertices
     std::optional<unsigned int> seed_;              // Random seed
     Component::Ptr<scheduler::Scheduler> sched_;    // Scheduler for parallel processing
+    Component::Ptr<Sampler> sampler_;               // Sampler (optional)
+    bool progressive_;                              // True to accumulate the samples across renderings
+    mutable ProgressiveAccumulator accum_;          // Accumulated samples (progressive mode)
 
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(scene_, film_, max_verts_, seed_, sched_);
+        ar(scene_, film_, max_verts_, seed_, sched_, sampler_, progressive_, accum_);
     }
 
     virtual void foreach_underlying(const ComponentVisitor& visit) override {
         comp::visit(visit, scene_);
         comp::visit(visit, film_);
         comp::visit(visit, sched_);
+        comp::visit(visit, sampler_);
     }
 
 public:
@@ -40,6 +45,10 @@ public:
         film_ = json::comp_ref<Film>(prop, "output");
         max_verts_ = json::value<int>(prop, "max_verts");
         seed_ = json::value_or_none<unsigned int>(prop, "seed");
+        progressive_ = json::value<bool>(prop, "progressive", false);
+        if (const auto sampler_name = json::value_or_none<std::string>(prop, "sampler")) {
+            sampler_ = comp::create<Sampler>("sampler::" + *sampler_name, make_loc("sampler"), prop);
+        }
 
         // Scheduler is fixed to image space scheduler
         const auto sched_name = json::value<std::string>(prop, "scheduler");
@@ -49,14 +58,29 @@ public:
 
     virtual Json render() const override {
         scene_->require_renderable();
-        film_->clear();
         const auto size = film_->size();
+        const auto norm = Float(size.w * size.h);
+
+        // Clear film.
+        // In progressive mode, the film keeps the samples of the previous renderings.
+        if (progressive_) {
+            accum_.begin(film_, norm);
+        }
+        else {
+            film_->clear();
+        }
         timer::ScopedTimer st;
 
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+
+        // In progressive mode, the sample indices continue from the previous renderings
+        const auto sample_offset = progressive_ ? accum_.count() : 0;
+
         // Execute parallel process
-        const auto processed = sched_->run([&](long long, long long, int threadid) {
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
+        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int) {
+            // Random number generator determined by the pixel and sample indices
+            Rng rng(seed, pixel_index, sample_offset + sample_index, sampler_.get());
 
             // ------------------------------------------------------------------------------------
 
@@ -167,10 +191,18 @@ public:
         });
 
         // Rescale film
-        film_->rescale(Float(size.w * size.h) / processed);
+        if (progressive_) {
+            const auto total_processed = accum_.end(film_, norm, processed);
+            return { {"processed", processed}, {"total_processed", total_processed}, {"elapsed", st.now()} };
+        }
+        film_->rescale(norm / processed);
 
         return { {"processed", processed}, {"elapsed", st.now()} };
     }
+
+    virtual void reset() override {
+        accum_.reset();
+    }
 };
 
 LM_COMP_REG_IMPL(Renderer_LT_NEE, "renderer::lt");
@@ -9,6 +9,8 @@
 #include <lm/scene.h>
 #include <lm/film.h>
 #include <lm/scheduler.h>
+#include <lm/sampler.h>
+#include <lm/aov.h>
 #include <lm/path.h>
 #include <lm/timer.h>
 
@@ -35,16 +37,22 @@ private:
     SamplingMode sampling_mode_;                        // Sampling mode
     PrimaryRaySampleMode primary_ray_sampling_mode_;    // Sampling mode of the primary ray
     Component::Ptr<scheduler::Scheduler> sched_;        // Scheduler for parallel processing
+    Component::Ptr<Sampler> sampler_;                   // Sampler (optional)
+    aov::Outputs aovs_;                                 // Auxiliary outputs
+    bool progressive_;                                  // True to accumulate the images across renderings
+    mutable ProgressiveAccumulator accum_;              // Accumulated images (progressive mode)
 
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(scene_, film_, max_verts_, sampling_mode_, sched_);
+        ar(scene_, film_, max_verts_, sampling_mode_, sched_, sampler_, aovs_, progressive_, accum_);
     }
 
     virtual void foreach_underlying(const ComponentVisitor& visit) override {
         comp::visit(visit, scene_);
         comp::visit(visit, film_);
         comp::visit(visit, sched_);
+        comp::visit(visit, sampler_);
+        aovs_.foreach_underlying(visit);
     }
 
 public:
@@ -53,6 +61,11 @@ public:
         film_ = json::comp_ref<Film>(prop, "output");
         max_verts_ = json::value<int>(prop, "max_verts");
         seed_ = json::value_or_none<unsigned int>(prop, "seed");
+        aovs_.construct(prop);
+        progressive_ = json::value<bool>(prop, "progressive", false);
+        if (const auto sampler_name = json::value_or_none<std::string>(prop, "sampler")) {
+            sampler_ = comp::create<Sampler>("sampler::" + *sampler_name, make_loc("sampler"), prop);
+        }
         {
             const auto s = json::value<std::string>(prop, "sampling_mode", "mis");
             if (s == "naive")    sampling_mode_ = SamplingMode::Naive;
@@ -80,239 +93,300 @@ public:
     virtual Json render() const override {
         scene_->require_renderable();
 
-        // Clear film
-        film_->clear();
+        // Normalization factor of the image
         const auto size = film_->size();
+        const auto norm = primary_ray_sampling_mode_ == PrimaryRaySampleMode::Pixel
+            ? 1_f : Float(size.w * size.h);
+
+        // Clear film.
+        // In progressive mode, the film keeps the samples of the previous renderings.
+        // The auxiliary outputs are also accumulated while the film keeps the samples.
+        if (progressive_) {
+            accum_.begin(film_, norm);
+        }
+        else {
+            film_->clear();
+        }
+        aovs_.clear(film_, progressive_ && accum_.count() > 0);
         timer::ScopedTimer st;
 
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+
+        // In progressive mode, the sample indices continue from the previous renderings
+        // so that the renderings with the same seed generate different samples
+        const auto sample_offset = progressive_ ? accum_.count() : 0;
+
         // Execute parallel process
-        const auto processed = sched_->run([&](long long pixel_index, long long, int threadid) {
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
-
-            // ------------------------------------------------------------------------------------
-
-            // Sample window
-            const auto window = [&]() -> Vec4 {
-                if (primary_ray_sampling_mode_ == PrimaryRaySampleMode::Pixel) {
-                    const int x = int(pixel_index % size.w);
-                    const int y = int(pixel_index / size.w);
-                    const auto dx = 1_f / size.w;
-                    const auto dy = 1_f / size.h;
-                    return { dx * x, dy * y, dx, dy };
-                }
-                else {
-                    return { 0_f, 0_f, 1_f, 1_f };
-                }
-            }();
-
-            // ------------------------------------------------------------------------------------
-
-            // Sample initial vertex
-            const auto sE = path::sample_position(rng, scene_, TransDir::EL);
-            const auto sE_comp = path::sample_component(rng, scene_, sE->sp, {});
-            auto sp = sE->sp;
-            int comp = sE_comp.comp;
-            auto throughput = sE->weight * sE_comp.weight;
-
-            // ------------------------------------------------------------------------------------
-
-            // Perform random walk
-            Vec3 wi{};
-            Vec2 raster_pos{};
-            for (int num_verts = 1; num_verts < max_verts_; num_verts++) {
-                // Sample NEE edge
-
-                // Flag indicating if the nee edge is samplable
-                const bool samplable_by_nee = [&]() {
-                    if (sampling_mode_ == SamplingMode::Naive) {
-                        // Skip if sampling mode is naive
-                        return false;
-                    }
-                    const auto is_specular = path::is_specular_component(scene_, sp, comp);
+        const auto processed = sched_->run_range([&](const scheduler::Range& range, int) {
+            long long range_index = 0;
+            range.foreach([&](long long pixel_index, long long sample_index) {
+                // Random number generator determined by the pixel and sample indices
+                Rng rng(seed, pixel_index, sample_offset + sample_index, sampler_.get());
+
+                // Splat the contribution and record the sum for the scheduler
+                Vec3 L(0_f);
+                const auto splat = [&](Vec2 rp, Vec3 C) {
+                    film_->splat(rp, C);
+                    L += C;
+                };
+
+                // --------------------------------------------------------------------------------
+
+                // Sample window
+                const auto window = [&]() -> Vec4 {
                     if (primary_ray_sampling_mode_ == PrimaryRaySampleMode::Pixel) {
-                        // In pixel sampling mode, the nee edge is only samplable when nv>1
-                        return num_verts > 1 && !is_specular;
+                        const int x = int(pixel_index % size.w);
+                        const int y = int(pixel_index / size.w);
+                        const auto dx = 1_f / size.w;
+                        const auto dy = 1_f / size.h;
+                        return { dx * x, dy * y, dx, dy };
                     }
                     else {
-                        return !is_specular;
+                        return { 0_f, 0_f, 1_f, 1_f };
                     }
                 }();
 
-                if (samplable_by_nee) [&]{
-                    // Sample a light
-                    const auto sL = path::sample_direct(rng, scene_, sp, TransDir::LE);
-                    if (!sL) {
-                        return;
-                    }
-                    if (!scene_->visible(sp, sL->sp)) {
-                        return;
-                    }
+                // --------------------------------------------------------------------------------
 
-                    // Recompute raster position for the primary edge
-                    Vec2 rp = raster_pos;
-                    if (num_verts == 1) {
-                        const auto rp_ = path::raster_position(scene_, -sL->wo);
-                        if (!rp_) { return; }
-                        rp = *rp_;
-                    }
+                // Sample initial vertex.
+                // The dimensions of the sample are assigned by PathSampleDims if the sampler is used.
+                using Dims = PathSampleDims;
+                rng.set_dim(Dims::fixed(0, Dims::Position));
+                const auto sE = path::sample_position(rng, scene_, TransDir::EL);
+                rng.set_dim(Dims::fixed(0, Dims::Component));
+                const auto sE_comp = path::sample_component(rng, scene_, sE->sp, {});
+                auto sp = sE->sp;
+                int comp = sE_comp.comp;
+                auto throughput = sE->weight * sE_comp.weight;
 
-                    // Evaluate BSDF
-                    const auto wo = -sL->wo;
-                    const auto fs = path::eval_contrb_direction(scene_, sp, wi, wo, comp, TransDir::EL, true);
-                    if (math::is_zero(fs)) {
-                        return;
-                    }
+                // --------------------------------------------------------------------------------
 
-                    // Evaluate MIS weight
-                    const auto mis_w = [&]() -> Float {
-                        // Skip if sampling mode is NEE
-                        if (sampling_mode_ == SamplingMode::NEE) {
-                            return 1_f;
+                // Perform random walk
+                Vec3 wi{};
+                Vec2 raster_pos{};
+                for (int num_verts = 1; num_verts < max_verts_; num_verts++) {
+                    // Sample NEE edge
+
+                    // Flag indicating if the nee edge is samplable
+                    const bool samplable_by_nee = [&]() {
+                        if (sampling_mode_ == SamplingMode::Naive) {
+                            // Skip if sampling mode is naive
+                            return false;
+                        }
+                        const auto is_specular = path::is_specular_component(scene_, sp, comp);
+                        if (primary_ray_sampling_mode_ == PrimaryRaySampleMode::Pixel) {
+                            // In pixel sampling mode, the nee edge is only samplable when nv>1
+                            return num_verts > 1 && !is_specular;
                         }
+                        else {
+                            return !is_specular;
+                        }
+                    }();
 
-                        // When the light is not samplable by BSDF sampling, we will use only NEE.
-                        // This includes, for instance, the light sampling for
-                        // directional light, environment light, point light, etc.
-                        const bool is_specular_L = path::is_specular_component(scene_, sL->sp, {});
-                        const bool samplable_by_bsdf = !is_specular_L && !sL->sp.geom.degenerated;
-                        if (!samplable_by_bsdf) {
-                            return 1_f;
+                    if (samplable_by_nee) [&]{
+                        // Sample a light
+                        rng.set_dim(Dims::fixed(num_verts - 1, Dims::NEE));
+                        const auto sL = path::sample_direct(rng, scene_, sp, TransDir::LE);
+                        if (!sL) {
+                            return;
+                        }
+                        if (!scene_->visible(sp, sL->sp)) {
+                            return;
                         }
 
-                        // MIS weight using balance heuristic
-                        const auto p_light = path::pdf_direct(scene_, sp, sL->sp, sL->wo, true);
-                        const auto p_bsdf = path::pdf_direction(scene_, sp, wi, wo, comp, true);
-                        return math::balance_heuristic(p_light, p_bsdf);
-                    }();
+                        // Recompute raster position for the primary edge
+                        Vec2 rp = raster_pos;
+                        if (num_verts == 1) {
+                            const auto rp_ = path::raster_position(scene_, -sL->wo);
+                            if (!rp_) { return; }
+                            rp = *rp_;
+                        }
 
-                    // Accumulate contribution
-                    const auto C = throughput * fs * sL->weight * mis_w;
-                    film_->splat(rp, C);
-                }();
+                        // Evaluate BSDF
+                        const auto wo = -sL->wo;
+                        const auto fs = path::eval_contrb_direction(scene_, sp, wi, wo, comp, TransDir::EL, true);
+                        if (math::is_zero(fs)) {
+                            return;
+                        }
 
-                // --------------------------------------------------------------------------------
+                        // Evaluate MIS weight
+                        const auto mis_w = [&]() -> Float {
+                            // Skip if sampling mode is NEE
+                            if (sampling_mode_ == SamplingMode::NEE) {
+                                return 1_f;
+                            }
+
+                            // When the light is not samplable by BSDF sampling, we will use only NEE.
+                            // This includes, for instance, the light sampling for
+                            // directional light, environment light, point light, etc.
+                            const bool is_specular_L = path::is_specular_component(scene_, sL->sp, {});
+                            const bool samplable_by_bsdf = !is_specular_L && !sL->sp.geom.degenerated;
+                            if (!samplable_by_bsdf) {
+                                return 1_f;
+                            }
+
+                            // MIS weight using balance heuristic
+                            const auto p_light = path::pdf_direct(scene_, sp, sL->sp, sL->wo, true);
+                            const auto p_bsdf = path::pdf_direction(scene_, sp, wi, wo, comp, true);
+                            return math::balance_heuristic(p_light, p_bsdf);
+                        }();
+
+                        // Accumulate contribution
+                        const auto C = throughput * fs * sL->weight * mis_w;
+                        splat(rp, C);
+                    }();
 
-                // Sample direction
-                const auto s = [&]() -> std::optional<path::DirectionSample> {
-                    if (num_verts == 1) {
-                        const auto [x, y, w, h] = window.data.data;
-                        const auto ud = Vec2(x+w*rng.u(), y+h*rng.u());
-                        return path::sample_direction({ ud, rng.next<Vec2>() }, scene_, sp, wi, comp, TransDir::EL);
-                    }
-                    else {
-                        return path::sample_direction(rng, scene_, sp, wi, comp, TransDir::EL);
-                    }
-                }();
-                if (!s) {
-                    break;
-                }
+                    // ----------------------------------------------------------------------------
 
-                // --------------------------------------------------------------------------------
+                    // Sample direction
+                    rng.set_dim(Dims::fixed(num_verts - 1, Dims::Direction));
+                    const auto s = [&]() -> std::optional<path::DirectionSample> {
+                        if (num_verts == 1) {
+                            const auto [x, y, w, h] = window.data.data;
+                            const auto ud = Vec2(x+w*rng.u(), y+h*rng.u());
+                            return path::sample_direction({ ud, rng.next<Vec2>() }, scene_, sp, wi, comp, TransDir::EL);
+                        }
+                        else {
+                            return path::sample_direction(rng, scene_, sp, wi, comp, TransDir::EL);
+                        }
+                    }();
+                    if (!s) {
+                        break;
+                    }
 
-                // Compute and cache raster position
-                if (num_verts == 1) {
-                    raster_pos = *path::raster_position(scene_, s->wo);
-                }
+                    // ----------------------------------------------------------------------------
 
-                // --------------------------------------------------------------------------------
+                    // Compute and cache raster position
+                    if (num_verts == 1) {
+                        raster_pos = *path::raster_position(scene_, s->wo);
+                    }
 
-                // Intersection to next surface
-                const auto hit = scene_->intersect({ sp.geom.p, s->wo });
-                if (!hit) {
-                    break;
-                }
+                    // ----------------------------------------------------------------------------
 
-                // --------------------------------------------------------------------------------
+                    // Intersection to next surface
+                    const auto hit = scene_->intersect({ sp.geom.p, s->wo });
+                    if (num_verts == 1) {
+                        aovs_.add(scene_, raster_pos, sp.geom.p, hit);
+                    }
+                    if (!hit) {
+                        break;
+                    }
 
-                // Update throughput
-                throughput *= s->weight;
+                    // ----------------------------------------------------------------------------
 
-                // --------------------------------------------------------------------------------
+                    // Update throughput
+                    throughput *= s->weight;
 
-                // Contribution from direct hit against a light
+                    // ----------------------------------------------------------------------------
 
-                // Flag indicating if the light can be samplable by direct hit
-                const bool samplable_by_direct_hit = [&]() {
-                    if (sampling_mode_ == SamplingMode::NEE) {
-                        // Accumulate contribution from the direct hit only when a NEE edge is not samplable
-                        return !samplable_by_nee;
-                    }
-                    else {
-                        return true;
-                    }
-                }();
+                    // Contribution from direct hit against a light
 
-                if (samplable_by_direct_hit && scene_->is_light(*hit)) [&]{
-                    // Compute contribution from the direct hit
-                    const auto spL = hit->as_type(SceneInteraction::LightEndpoint);
-                    const auto woL = -s->wo;
-                    const auto fs = path::eval_contrb_direction(scene_, spL, {}, woL, comp, TransDir::LE, true);
-                    const auto mis_w = [&]() -> Float {
-                        // Skip if sampling mode is naive
-                        if (sampling_mode_ == SamplingMode::Naive) {
-                            return 1_f;
+                    // Flag indicating if the light can be samplable by direct hit
+                    const bool samplable_by_direct_hit = [&]() {
+                        if (sampling_mode_ == SamplingMode::NEE) {
+                            // Accumulate contribution from the direct hit only when a NEE edge is not samplable
+                            return !samplable_by_nee;
                         }
-
-                        // The weight is one if the hit cannot be sampled by nee
-                        if (!samplable_by_nee) {
-                            return 1_f;
+                        else {
+                            return true;
                         }
-
-                        // MIS weight using balance heuristic
-                        const auto pdf_bsdf = path::pdf_direction(scene_, sp, wi, s->wo, comp, true);
-                        const auto pdf_light = path::pdf_direct(scene_, sp, spL, woL, true);
-                        return math::balance_heuristic(pdf_bsdf, pdf_light);
                     }();
 
-                    // Accumulate contribution
-                    const auto C = throughput * fs * mis_w;
-                    film_->splat(raster_pos, C);
-                }();
+                    if (samplable_by_direct_hit && scene_->is_light(*hit)) [&]{
+                        // Compute contribution from the direct hit
+                        const auto spL = hit->as_type(SceneInteraction::LightEndpoint);
+                        const auto woL = -s->wo;
+                        const auto fs = path::eval_contrb_direction(scene_, spL, {}, woL, comp, TransDir::LE, true);
+                        const auto mis_w = [&]() -> Float {
+                            // Skip if sampling mode is naive
+                            if (sampling_mode_ == SamplingMode::Naive) {
+                                return 1_f;
+                            }
+
+                            // The weight is one if the hit cannot be sampled by nee
+                            if (!samplable_by_nee) {
+                                return 1_f;
+                            }
+
+                            // MIS weight using balance heuristic
+                            const auto pdf_bsdf = path::pdf_direction(scene_, sp, wi, s->wo, comp, true);
+                            const auto pdf_light = path::pdf_direct(scene_, sp, spL, woL, true);
+                            return math::balance_heuristic(pdf_bsdf, pdf_light);
+                        }();
+
+                        // Accumulate contribution
+                        const auto C = throughput * fs * mis_w;
+                        splat(raster_pos, C);
+                    }();
                 
-                // --------------------------------------------------------------------------------
+                    // ----------------------------------------------------------------------------
 
-                // Termination on a hit with environment
-                if (hit->geom.infinite) {
-                    break;
-                }
-
-                // Russian roulette
-                if (num_verts > 5) {
-                    const auto q = glm::max(.2_f, 1_f - glm::compMax(throughput));
-                    if (rng.u() < q) {
+                    // Termination on a hit with environment
+                    if (hit->geom.infinite) {
                         break;
                     }
-                    throughput /= 1_f - q;
-                }
 
-                // --------------------------------------------------------------------------------
+                    // Russian roulette
+                    if (num_verts > 5) {
+                        rng.set_dim(Dims::fixed(num_verts, Dims::RR));
+                        const auto q = glm::max(.2_f, 1_f - glm::compMax(throughput));
+                        if (rng.u() < q) {
+                            break;
+                        }
+                        throughput /= 1_f - q;
+                    }
 
-                // Sample component
-                const auto s_comp = path::sample_component(rng, scene_, *hit, -s->wo);
-                throughput *= s_comp.weight;
+                    // ----------------------------------------------------------------------------
 
-                // --------------------------------------------------------------------------------
+                    // Sample component
+                    rng.set_dim(Dims::fixed(num_verts, Dims::Component));
+                    const auto s_comp = path::sample_component(rng, scene_, *hit, -s->wo);
+                    throughput *= s_comp.weight;
+
+                    // ----------------------------------------------------------------------------
+
+                    // Update information
+                    wi = -s->wo;
+                    sp = *hit;
+                    comp = s_comp.comp;
+                }
 
-                // Update information
-                wi = -s->wo;
-                sp = *hit;
-                comp = s_comp.comp;
+                // Report the contribution of the sample.
+                // Only in pixel sampling mode the sample contributes only to its own pixel.
+                if (range.contributions && primary_ray_sampling_mode_ == PrimaryRaySampleMode::Pixel) {
+                    range.contributions[range_index] = L;
+                }
+                range_index++;
+            });
+            if (range.contributions_reported && primary_ray_sampling_mode_ == PrimaryRaySampleMode::Pixel) {
+                *range.contributions_reported = true;
             }
-        });
+        }, sample_offset);
 
         // ----------------------------------------------------------------------------------------
         
-        // Rescale film
-        if (primary_ray_sampling_mode_ == PrimaryRaySampleMode::Pixel) {
-            film_->rescale(1_f / processed);
+        // Rescale film.
+        // In progressive mode, the film is normalized by the total number of samples.
+        long long total_processed = processed;
+        if (progressive_) {
+            total_processed = accum_.end(film_, norm, processed);
         }
         else {
-            film_->rescale(Float(size.w * size.h) / processed);
+            film_->rescale(norm / processed);
+        }
+        aovs_.finalize();
+
+        if (progressive_) {
+            return { {"processed", processed}, {"total_processed", total_processed}, {"elapsed", st.now()} };
         }
 
         return { {"processed", processed}, {"elapsed", st.now()} };
     }
+
+    virtual void reset() override {
+        accum_.reset();
+    }
 };
 
 LM_COMP_REG_IMPL(Renderer_PT, "renderer::pt");
@@ -12,6 +12,7 @@
 #include <lm/parallel.h>
 #include <lm/scheduler.h>
 #include <lm/path.h>
+#include <lm/aov.h>
 #include <lm/timer.h>
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE)
@@ -25,16 +26,18 @@ private:
     bool visualize_normal_;
     std::optional<Vec3> color_;
     Component::Ptr<scheduler::Scheduler> sched_;
+    aov::Outputs aovs_;
 
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(scene_, film_, bg_color_, use_constant_color_, visualize_normal_, sched_);
+        ar(scene_, film_, bg_color_, use_constant_color_, visualize_normal_, sched_, aovs_);
     }
 
     virtual void foreach_underlying(const ComponentVisitor& visit) override {
         comp::visit(visit, scene_);
         comp::visit(visit, film_);
         comp::visit(visit, sched_);
+        aovs_.foreach_underlying(visit);
     }
 
     virtual Component* underlying(const std::string& name) const override {
@@ -52,6 +55,7 @@ public:
         visualize_normal_ = json::value(prop, "visualize_normal", false);
         color_ = json::value_or_none<Vec3>(prop, "color");
         film_ = json::comp_ref<Film>(prop, "output");
+        aovs_.construct(prop);
         sched_ = comp::create<scheduler::Scheduler>(
             "scheduler::spp::sample", make_loc("scheduler"), {
                 {"spp", 1},
@@ -65,13 +69,16 @@ public:
 		scene_->require_camera();
 
         film_->clear();
+        aovs_.clear(film_);
         const auto size = film_->size();
         timer::ScopedTimer st;
         sched_->run([&](long long index, long long, int) {
             const int x = int(index % size.w);
             const int y = int(index / size.w);
-            const auto ray = path::primary_ray(scene_, {(x+.5_f)/size.w, (y+.5_f)/size.h});
+            const Vec2 rp((x+.5_f)/size.w, (y+.5_f)/size.h);
+            const auto ray = path::primary_ray(scene_, rp);
             const auto sp = scene_->intersect(ray);
+            aovs_.add(scene_, rp, ray.o, sp);
             if (!sp) {
                 film_->set_pixel(x, y, bg_color_);
                 return;
@@ -96,6 +103,7 @@ public:
                 }
             }
         });
+        aovs_.finalize();
 
         return { {"elapsed", st.now()} };
     }
@@ -9,6 +9,8 @@
 #include <lm/scene.h>
 #include <lm/film.h>
 #include <lm/scheduler.h>
+#include <lm/sampler.h>
+#include <lm/aov.h>
 #include <lm/path.h>
 #include <lm/timer.h>
 
@@ -24,16 +26,22 @@ protected:
     Float rr_prob_;
     std::optional<unsigned int> seed_;
     Component::Ptr<scheduler::Scheduler> sched_;
+    Component::Ptr<Sampler> sampler_;
+    aov::Outputs aovs_;
+    bool progressive_;
+    mutable ProgressiveAccumulator accum_;
 
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(scene_, film_, max_verts_, rr_prob_, sched_);
+        ar(scene_, film_, max_verts_, rr_prob_, sched_, sampler_, aovs_, progressive_, accum_);
     }
 
     virtual void foreach_underlying(const ComponentVisitor& visit) override {
         comp::visit(visit, scene_);
         comp::visit(visit, film_);
         comp::visit(visit, sched_);
+        comp::visit(visit, sampler_);
+        aovs_.foreach_underlying(visit);
     }
 
 public:
@@ -42,6 +50,11 @@ public:
         film_ = json::comp_ref<Film>(prop, "output");
         max_verts_ = json::value<int>(prop, "max_verts");
         seed_ = json::value_or_none<unsigned int>(prop, "seed");
+        aovs_.construct(prop);
+        progressive_ = json::value<bool>(prop, "progressive", false);
+        if (const auto sampler_name = json::value_or_none<std::string>(prop, "sampler")) {
+            sampler_ = comp::create<Sampler>("sampler::" + *sampler_name, make_loc("sampler"), prop);
+        }
         rr_prob_ = json::value<Float>(prop, "rr_prob", .2_f);
         const auto sched_name = json::value<std::string>(prop, "scheduler");
         #if VOLPT_IMAGE_SAMPLING
@@ -52,6 +65,50 @@ public:
             "scheduler::spp::" + sched_name, make_loc("scheduler"), prop);
         #endif
     }
+
+    virtual void reset() override {
+        accum_.reset();
+    }
+
+protected:
+    // Normalization factor of the image
+    Float norm() const {
+        #if VOLPT_IMAGE_SAMPLING
+        const auto size = film_->size();
+        return Float(size.w * size.h);
+        #else
+        return 1_f;
+        #endif
+    }
+
+    // Clears film. In progressive mode, the film keeps the samples of the previous renderings.
+    void clear_film() const {
+        if (progressive_) {
+            accum_.begin(film_, norm());
+        }
+        else {
+            film_->clear();
+        }
+        aovs_.clear(film_);
+    }
+
+    // Rescales film and returns the result of the rendering
+    Json finalize_film(long long processed, const timer::ScopedTimer& st) const {
+        long long total_processed = processed;
+        if (progressive_) {
+            total_processed = accum_.end(film_, norm(), processed);
+        }
+        else {
+            film_->rescale(norm() / processed);
+        }
+        aovs_.finalize();
+
+        if (progressive_) {
+            return { {"processed", processed}, {"total_processed", total_processed}, {"elapsed", st.now()} };
+        }
+
+        return { {"processed", processed}, {"elapsed", st.now()} };
+    }
 };
 
 // ------------------------------------------------------------------------------------------------
@@ -61,21 +118,23 @@ public:
     virtual Json render() const override {
 		scene_->require_renderable();
 
-        film_->clear();
+        clear_film();
         const auto size = film_->size();
         timer::ScopedTimer st;
-        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int threadid) {
-            LM_KEEP_UNUSED(sample_index);
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+        const auto sample_offset = progressive_ ? accum_.count() : 0;
 
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
+        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int) {
+            // Random number generator determined by the pixel and sample indices
+            Rng rng(seed, pixel_index, sample_offset + sample_index, sampler_.get());
 
             // ------------------------------------------------------------------------------------
 
             // Sample window
             Vec4 window(0,0,1,1);
             #if VOLPT_IMAGE_SAMPLING
-            LM_UNUSED(pixel_index);
+            LM_UNUSED(pixel_index, size);
             #else
             {
                 const int x = int(pixel_index % size.w);
@@ -88,8 +147,12 @@ public:
 
             // ------------------------------------------------------------------------------------
 
-            // Sample initial vertex
+            // Sample initial vertex.
+            // The dimensions of the sample are assigned by PathSampleDims if the sampler is used.
+            using Dims = PathSampleDims;
+            rng.set_dim(Dims::fixed(0, Dims::Position));
             const auto sE = path::sample_position(rng, scene_, TransDir::EL);
+            rng.set_dim(Dims::fixed(0, Dims::Component));
             const auto sE_comp = path::sample_component(rng, scene_, sE->sp, {});
             auto sp = sE->sp;
             int comp = sE_comp.comp;
@@ -102,6 +165,7 @@ public:
             Vec2 raster_pos{};
             for (int num_verts = 1; num_verts < max_verts_; num_verts++) {
                 // Sample direction
+                rng.set_dim(Dims::fixed(num_verts - 1, Dims::Direction));
                 const auto s = [&]() -> std::optional<path::DirectionSample> {
                     if (num_verts == 1) {
                         const auto [x, y, w, h] = window.data.data;
@@ -126,7 +190,11 @@ public:
                 // --------------------------------------------------------------------------------
 
                 // Sample next scene interaction
+                rng.set_dim(Dims::variable(num_verts - 1, Dims::Distance));
                 const auto sd = path::sample_distance(rng, scene_, sp, s->wo);
+                if (num_verts == 1) {
+                    aovs_.add(scene_, raster_pos, sp.geom.p, sd ? std::optional(sd->sp) : std::nullopt);
+                }
                 if (!sd) {
                     break;
                 }
@@ -156,6 +224,7 @@ public:
 
                 // Russian roulette
                 if (num_verts > 5) {
+                    rng.set_dim(Dims::fixed(num_verts, Dims::RR));
                     const auto q = glm::max(rr_prob_, 1_f - glm::compMax(throughput));
                     if (rng.u() < q) {
                         break;
@@ -166,6 +235,7 @@ public:
                 // --------------------------------------------------------------------------------
 
                 // Sample component
+                rng.set_dim(Dims::fixed(num_verts, Dims::Component));
                 const auto s_comp = path::sample_component(rng, scene_, sd->sp, -s->wo);
                 throughput *= s_comp.weight;
 
@@ -176,16 +246,10 @@ public:
                 sp = sd->sp;
                 comp = s_comp.comp;
             }
-        });
+        }, sample_offset);
 
         // Rescale film
-        #if VOLPT_IMAGE_SAMPLING
-        film_->rescale(Float(size.w* size.h) / processed);
-        #else
-        film_->rescale(1_f / processed);
-        #endif
-
-        return { {"processed", processed}, {"elapsed", st.now()} };
+        return finalize_film(processed, st);
     }
 };
 
@@ -198,21 +262,23 @@ public:
     virtual Json render() const override {
 		scene_->require_renderable();
 
-        film_->clear();
+        clear_film();
         const auto size = film_->size();
         timer::ScopedTimer st;
-        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int threadid) {
-            LM_KEEP_UNUSED(sample_index);
+        // Seed of the random number generators
+        const auto seed = seed_ ? *seed_ : math::rng_seed();
+        const auto sample_offset = progressive_ ? accum_.count() : 0;
 
-            // Per-thread random number generator
-            thread_local Rng rng(seed_ ? *seed_ + threadid : math::rng_seed());
+        const auto processed = sched_->run([&](long long pixel_index, long long sample_index, int) {
+            // Random number generator determined by the pixel and sample indices
+            Rng rng(seed, pixel_index, sample_offset + sample_index, sampler_.get());
 
             // ------------------------------------------------------------------------------------
 
             // Sample window
             Vec4 window(0,0,1,1);
             #if VOLPT_IMAGE_SAMPLING
-            LM_UNUSED(pixel_index);
+            LM_UNUSED(pixel_index, size);
             #else
             {
                 const int x = int(pixel_index % size.w);
@@ -225,8 +291,12 @@ public:
 
             // ------------------------------------------------------------------------------------
 
-            // Sample initial vertex
+            // Sample initial vertex.
+            // The dimensions of the sample are assigned by PathSampleDims if the sampler is used.
+            using Dims = PathSampleDims;
+            rng.set_dim(Dims::fixed(0, Dims::Position));
             const auto sE = path::sample_position(rng, scene_, TransDir::EL);
+            rng.set_dim(Dims::fixed(0, Dims::Component));
             const auto sE_comp = path::sample_component(rng, scene_, sE->sp, {});
             auto sp = sE->sp;
             int comp = sE_comp.comp;
@@ -246,6 +316,7 @@ public:
                 #endif
                 if (samplable_by_nee) [&] {
                     // Sample a light
+                    rng.set_dim(Dims::fixed(num_verts - 1, Dims::NEE));
                     const auto sL = path::sample_direct(rng, scene_, sp, TransDir::LE);
                     if (!sL) {
                         return;
@@ -260,6 +331,7 @@ public:
                     }
 
                     // Transmittance
+                    rng.set_dim(Dims::variable(num_verts - 1, Dims::Transmittance));
                     const auto Tr = path::eval_transmittance(rng, scene_, sp, sL->sp);
                     if (math::is_zero(Tr)) {
                         return;
@@ -280,6 +352,7 @@ public:
                 // --------------------------------------------------------------------------------
 
                 // Sample direction
+                rng.set_dim(Dims::fixed(num_verts - 1, Dims::Direction));
                 const auto s = [&]() -> std::optional<path::DirectionSample> {
                     if (num_verts == 1) {
                         const auto [x, y, w, h] = window.data.data;
@@ -304,7 +377,11 @@ public:
                 // --------------------------------------------------------------------------------
 
                 // Sample next scene interaction
+                rng.set_dim(Dims::variable(num_verts - 1, Dims::Distance));
                 const auto sd = path::sample_distance(rng, scene_, sp, s->wo);
+                if (num_verts == 1) {
+                    aovs_.add(scene_, raster_pos, sp.geom.p, sd ? std::optional(sd->sp) : std::nullopt);
+                }
                 if (!sd) {
                     break;
                 }
@@ -334,6 +411,7 @@ public:
 
                 // Russian roulette
                 if (num_verts > 5) {
+                    rng.set_dim(Dims::fixed(num_verts, Dims::RR));
                     const auto q = glm::max(rr_prob_, 1_f - glm::compMax(throughput));
                     if (rng.u() < q) {
                         break;
@@ -344,6 +422,7 @@ public:
                 // --------------------------------------------------------------------------------
 
                 // Sample component
+                rng.set_dim(Dims::fixed(num_verts, Dims::Component));
                 const auto s_comp = path::sample_component(rng, scene_, sd->sp, -s->wo);
                 throughput *= s_comp.weight;
 
@@ -354,16 +433,10 @@ public:
                 sp = sd->sp;
                 comp = s_comp.comp;
             }
-        });
+        }, sample_offset);
 
         // Rescale film
-        #if VOLPT_IMAGE_SAMPLING
-        film_->rescale(Float(size.w* size.h) / processed);
-        #else
-        film_->rescale(1_f / processed);
-        #endif
-
-        return { {"processed", processed}, {"elapsed", st.now()} };
+        return finalize_film(processed, st);
     }
 };
 
@@ -0,0 +1,248 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include <lm/core.h>
+#include <lm/sampler.h>
+
+LM_NAMESPACE_BEGIN(LM_NAMESPACE)
+
+LM_PUBLIC_API double detail::sampler_u(const Sampler* sampler, unsigned int seed, long long pixel, long long sample, int dim) {
+    return sampler->u(seed, pixel, sample, dim);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+namespace {
+
+// Finalizer of splitmix64
+unsigned long long mix64(unsigned long long x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Combines the hash value with a value
+unsigned long long hash_combine(unsigned long long h, unsigned long long v) {
+    return mix64(h ^ mix64(v + 0x9e3779b97f4a7c15ULL));
+}
+
+// Converts the upper 53 bits of the hash value to a double in [0,1)
+double to_unit(unsigned long long h) {
+    return double(h >> 11) / double(1ULL << 53);
+}
+
+// Reverses the bits of 32-bit integer
+unsigned int reverse_bits(unsigned int x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Hash-based Owen scrambling of 32-bit integer.
+// cf. B. Burley, Practical Hash-based Owen Scrambling, JCGT 2020.
+unsigned int nested_uniform_scramble(unsigned int x, unsigned int seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+// Random permutation of [0,l) indexed by p.
+// cf. A. Kensler, Correlated Multi-Jittered Sampling, Pixar Technical Memo 13-01, 2013.
+unsigned int permute(unsigned int i, unsigned int l, unsigned int p) {
+    unsigned int w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// Direction numbers of the first two dimensions of Sobol sequence
+struct SobolDirections {
+    unsigned int v[2][32];
+
+    SobolDirections() {
+        // The first dimension is van der Corput sequence.
+        // The second dimension is given by the primitive polynomial x+1
+        // and the initial direction number m_1 = 1.
+        // cf. S. Joe and F. Y. Kuo, new-joe-kuo-6.21201.
+        unsigned int m = 1;
+        for (int k = 0; k < 32; k++) {
+            v[0][k] = 1u << (31 - k);
+            v[1][k] = m << (31 - k);
+            m ^= m << 1;
+        }
+    }
+
+    // Computes the dimension of the point of the index
+    unsigned int sample(unsigned int index, int dim) const {
+        unsigned int x = 0;
+        for (int k = 0; index; k++, index >>= 1) {
+            if (index & 1) {
+                x ^= v[dim][k];
+            }
+        }
+        return x;
+    }
+};
+
+}
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+\rst
+.. function:: sampler::independent
+
+    Independent sampler.
+
+    This component generates the independent uniform random numbers for all dimensions,
+    determined by the hash of the seed, the pixel, the sample index, and the dimension.
+    The convergence is same as pure Monte Carlo sampling.
+\endrst
+*/
+class Sampler_Independent final : public Sampler {
+public:
+    virtual double u(unsigned int seed, long long pixel, long long sample, int dim) const override {
+        auto h = hash_combine(seed, (unsigned long long)(pixel));
+        h = hash_combine(h, (unsigned long long)(sample));
+        h = hash_combine(h, (unsigned long long)(dim));
+        return to_unit(h);
+    }
+};
+
+LM_COMP_REG_IMPL(Sampler_Independent, "sampler::independent");
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+\rst2
+.. function:: sampler::stratified
+
+    Stratified sampler.
+
+    :param int strata: Number of strata per dimension.
+                       Default: value of ``spp`` if specified, otherwise ``16``.
+
+    This component stratifies each dimension independently into ``strata`` intervals.
+    Each consecutive ``strata`` samples of a pixel take one jittered value from each interval.
+    The order of the intervals is randomly permuted for each pixel and dimension
+    to decorrelate the dimensions.
+    The variance is reduced most if the number of samples per pixel is a multiple of ``strata``.
+\endrst2
+*/
+class Sampler_Stratified final : public Sampler {
+private:
+    long long strata_;
+
+public:
+    LM_SERIALIZE_IMPL(ar) {
+        ar(strata_);
+    }
+
+public:
+    virtual void construct(const Json& prop) override {
+        strata_ = json::value<long long>(prop, "strata", json::value<long long>(prop, "spp", 16));
+        if (strata_ <= 0) {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Number of strata must be positive [strata={}]", strata_);
+        }
+    }
+
+    virtual double u(unsigned int seed, long long pixel, long long sample, int dim) const override {
+        // Permutation of the strata for each pixel, dimension, and set of strata samples
+        auto h = hash_combine(seed, (unsigned long long)(pixel));
+        h = hash_combine(h, (unsigned long long)(dim));
+        h = hash_combine(h, (unsigned long long)(sample / strata_));
+        const auto i = (unsigned int)(sample % strata_);
+        const auto stratum = permute(i, (unsigned int)(strata_), (unsigned int)(h));
+
+        // Jitter inside the stratum
+        const auto jitter = to_unit(hash_combine(h, i));
+        const auto u = (stratum + jitter) / double(strata_);
+        return std::min(u, std::nextafter(1.0, 0.0));
+    }
+};
+
+LM_COMP_REG_IMPL(Sampler_Stratified, "sampler::stratified");
+
+// ------------------------------------------------------------------------------------------------
+
+/*
+\rst3
+.. function:: sampler::sobol
+
+    Owen-scrambled Sobol sampler.
+
+    This component generates the samples of a pixel from Owen-scrambled Sobol sequence
+    with hash-based scrambling [Burley2020]_.
+    The dimensions are grouped into the pairs starting at the even dimensions.
+    Each pair takes the first two dimensions of Sobol sequence
+    where the sample index is shuffled with the seed of the pair,
+    which pads the pairs of dimensions with decorrelated low-discrepancy points.
+    The first two dimensions of Sobol sequence form a (0,2)-sequence,
+    thus the first :math:`2^m` samples of a pixel, or any aligned block of :math:`2^m` samples,
+    are stratified in every elementary interval of the area :math:`2^{-m}` of a pair,
+    while the dimensions in different pairs are only stratified independently.
+    The renderers following :cpp:class:`lm::PathSampleDims`, e.g., ``renderer::pt``,
+    place the two-dimensional samples such as the raster position or the direction
+    at even dimensions.
+
+    .. [Burley2020] B. Burley,
+                    Practical Hash-based Owen Scrambling,
+                    Journal of Computer Graphics Techniques, 9(4), 2020.
+\endrst3
+*/
+class Sampler_Sobol final : public Sampler {
+public:
+    virtual double u(unsigned int seed, long long pixel, long long sample, int dim) const override {
+        static const SobolDirections directions;
+
+        // Seed for the pair of dimensions
+        auto h = hash_combine(seed, (unsigned long long)(pixel));
+        h = hash_combine(h, (unsigned long long)(dim / 2));
+
+        // Shuffle the sample index and compute the scrambled point
+        const auto index = nested_uniform_scramble((unsigned int)(sample), (unsigned int)(h));
+        const auto x = nested_uniform_scramble(
+            directions.sample(index, dim % 2),
+            (unsigned int)(hash_combine(h, (unsigned long long)(dim % 2))));
+        return double(x) / double(1ULL << 32);
+    }
+};
+
+LM_COMP_REG_IMPL(Sampler_Sobol, "sampler::sobol");
+
+LM_NAMESPACE_END(LM_NAMESPACE)
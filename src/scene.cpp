@@ -14,9 +14,44 @@
 #include <lm/model.h>
 #include <lm/medium.h>
 #include <lm/phase.h>
+#include <lm/mappedfile.h>
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE)
 
+namespace {
+
+// Incremental 64-bit FNV-1a hash of memory images
+class ContentHash {
+private:
+    unsigned long long h_ = 14695981039346656037ull;
+
+public:
+    template <typename T>
+    void add(const T& v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        static_assert(!std::is_pointer_v<T>, "Addresses are not stable across processes");
+        add_bytes(&v, sizeof(T));
+    }
+
+    void add(const std::string& s) {
+        add(s.size());
+        add_bytes(s.data(), s.size());
+    }
+
+    void add_bytes(const void* data, size_t size) {
+        const auto* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            h_ = (h_ ^ p[i]) * 1099511628211ull;
+        }
+    }
+
+    unsigned long long value() const {
+        return h_;
+    }
+};
+
+}
+
 class Scene_ final : public Scene {
 private:
     Accel* accel_;                                   // Acceleration structure
@@ -26,10 +61,14 @@ private:
     std::unordered_map<int, int> light_indices_map_; // Map from node indices to light indices.
     std::optional<int> env_light_;                   // Environment light index
     std::optional<int> medium_;                      // Medium index
+    std::string accel_cache_dir_;                    // Directory of accel cache (empty if disabled)
+    std::optional<unsigned long long> topology_hash_;  // Hash of the scene graph structure at the last build
+    std::optional<unsigned long long> transform_hash_; // Hash of the transformations at the last build or update
 
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(accel_, nodes_, camera_, lights_, light_indices_map_, env_light_);
+        ar(accel_, nodes_, camera_, lights_, light_indices_map_, env_light_, accel_cache_dir_,
+            topology_hash_, transform_hash_);
     }
 
     virtual void foreach_underlying(const ComponentVisitor& visit) override {
@@ -47,6 +86,7 @@ public:
 public:
     virtual void construct(const Json& prop) override {
         accel_ = json::comp_ref_or_nullptr<Accel>(prop, "accel");
+        accel_cache_dir_ = json::value<std::string>(prop, "accel_cache_dir", "");
         reset();
     }
 
@@ -58,6 +98,8 @@ public:
         light_indices_map_.clear();
         env_light_ = {};
         medium_ = {};
+        topology_hash_ = {};
+        transform_hash_ = {};
         nodes_.push_back(SceneNode::make_group(0, false, {}));
     }
 
@@ -269,9 +311,73 @@ public:
 
     virtual void set_accel(const std::string& accel_loc) override {
         accel_ = comp::get<Accel>(accel_loc);
+        topology_hash_ = {};
+        transform_hash_ = {};
     }
 
     virtual void build() override {
+        // Update lights and scene bound
+        const bool use_cache = !accel_cache_dir_.empty();
+        const auto hash = update_lights_and_bound(use_cache);
+
+        // Build acceleration structure
+        LM_INFO("Building acceleration structure [name='{}']", accel_->name());
+        LM_INDENT();
+        if (use_cache) {
+            build_accel_with_cache(hash);
+        }
+        else {
+            accel_->build(*this);
+        }
+
+        // Record the state of the scene graph to detect the changes in update()
+        topology_hash_ = topology_hash();
+        transform_hash_ = transform_hash();
+    }
+
+    virtual void update() override {
+        // Fall back to full build if the topology of the scene graph is changed
+        if (!topology_hash_ || *topology_hash_ != topology_hash()) {
+            build();
+            return;
+        }
+
+        // Nothing to do if transformations are not changed
+        const auto th = transform_hash();
+        if (transform_hash_ && *transform_hash_ == th) {
+            return;
+        }
+
+        // Update lights and scene bound
+        update_lights_and_bound(false);
+
+        // Refit acceleration structure
+        LM_INFO("Refitting acceleration structure [name='{}']", accel_->name());
+        LM_INDENT();
+        if (!accel_->refit(*this)) {
+            LM_INFO("Refit is not supported. Rebuilding.");
+            accel_->build(*this);
+        }
+        transform_hash_ = th;
+    }
+
+    virtual void set_transform(int node_index, Mat4 transform) override {
+        if (node_index < 0 || node_index >= int(nodes_.size())) {
+            LM_ERROR("Missing node index [index='{}']", node_index);
+            return;
+        }
+        auto& node = nodes_.at(node_index);
+        if (node.type != SceneNodeType::Group) {
+            LM_ERROR("Setting transform to non-group node [index='{}']", node_index);
+            return;
+        }
+        node.group.local_transform = transform;
+    }
+
+private:
+    // Updates the global transforms of the lights and the scene bound.
+    // Returns the hash of the flattened triangles and transforms if compute_hash is true.
+    unsigned long long update_lights_and_bound(bool compute_hash) {
         // Update light indices
         // We keep the global transformation of the light primitive as well as the references.
         // We need to recompute the indices when an update of the scene happens,
@@ -285,8 +391,10 @@ public:
             }
         });
 
-        // Compute scene bound
+        // Compute scene bound.
+        // We also compute the hash of the flattened triangles and transforms if requested.
         Bound bound;
+        ContentHash hash;
         traverse_primitive_nodes([&](const SceneNode& node, Mat4 global_transform) {
             if (node.type != SceneNodeType::Primitive) {
                 return;
@@ -294,13 +402,23 @@ public:
             if (!node.primitive.mesh) {
                 return;
             }
-            node.primitive.mesh->foreach_triangle([&](int, const Mesh::Tri& tri) {
+            if (compute_hash) {
+                hash.add(node.index);
+                hash.add(global_transform);
+            }
+            node.primitive.mesh->foreach_triangle([&](int face, const Mesh::Tri& tri) {
                 const auto p1 = global_transform * Vec4(tri.p1.p, 1_f);
                 const auto p2 = global_transform * Vec4(tri.p2.p, 1_f);
                 const auto p3 = global_transform * Vec4(tri.p3.p, 1_f);
                 bound = merge(bound, p1);
                 bound = merge(bound, p2);
                 bound = merge(bound, p3);
+                if (compute_hash) {
+                    hash.add(face);
+                    hash.add(tri.p1.p);
+                    hash.add(tri.p2.p);
+                    hash.add(tri.p3.p);
+                }
             });
         });
         
@@ -310,14 +428,106 @@ public:
             light->set_scene_bound(bound);
         }
 
-        // Build acceleration structure
-        LM_INFO("Building acceleration structure [name='{}']", accel_->name());
-        LM_INDENT();
+        return hash.value();
+    }
+
+    // Builds acceleration structure using the cache identified by the content hash
+    void build_accel_with_cache(unsigned long long hash) {
+        // Use accel cache if available
+        auto key = accel_->key();
+        std::replace(key.begin(), key.end(), ':', '_');
+        const auto path = fs::path(accel_cache_dir_) / fmt::format("{}_{:016x}.bin", key, hash);
+        if (fs::exists(path)) {
+            LM_INFO("Loading accel cache [path='{}']", path.string());
+            const auto file = std::make_shared<MappedFile>(path.string());
+            if (accel_->load_cache(file)) {
+                return;
+            }
+            LM_INFO("Accel cache is not compatible. Rebuilding.");
+        }
         accel_->build(*this);
+
+        // Save the cache.
+        // We write to a temporary file first so that concurrent jobs never read incomplete files.
+        fs::create_directories(fs::path(accel_cache_dir_));
+        const auto tmp_path = fs::path(path.string() + fmt::format(".{:08x}.tmp", std::random_device{}()));
+        {
+            std::ofstream os(tmp_path.string(), std::ios::out | std::ios::binary);
+            if (!accel_->save_cache(os)) {
+                os.close();
+                fs::remove(tmp_path);
+                LM_INFO("Accel does not support cache [name='{}']", accel_->name());
+                return;
+            }
+        }
+        std::error_code ec;
+        fs::rename(tmp_path, path, ec);
+        if (ec) {
+            // Another job might have saved the same cache
+            fs::remove(tmp_path, ec);
+            return;
+        }
+        LM_INFO("Saved accel cache [path='{}']", path.string());
+    }
+
+    // Computes the hash of the structure of the scene graph except transformations.
+    // The meshes are identified by their locators so that the hash is stable
+    // across processes, e.g., after the scene is deserialized.
+    unsigned long long topology_hash() const {
+        ContentHash hash;
+        for (const auto& node : nodes_) {
+            hash.add(node.type);
+            if (node.type == SceneNodeType::Primitive) {
+                hash.add(node.primitive.mesh ? node.primitive.mesh->loc() : std::string());
+                hash.add(node.primitive.mesh ? node.primitive.mesh->num_triangles() : 0);
+            }
+            else {
+                hash.add(node.group.instanced);
+                for (int child : node.group.children) {
+                    hash.add(child);
+                }
+                hash.add(-1);
+            }
+        }
+        return hash.value();
     }
 
+    // Computes the hash of the global transformations of the primitives
+    unsigned long long transform_hash() const {
+        ContentHash hash;
+        traverse_primitive_nodes([&](const SceneNode& node, Mat4 global_transform) {
+            if (node.type == SceneNodeType::Primitive) {
+                hash.add(global_transform);
+            }
+        });
+        return hash.value();
+    }
+
+public:
+
     virtual std::optional<SceneInteraction> intersect(Ray ray, Float tmin, Float tmax) const override {
         const auto hit = accel_->intersect(ray, tmin, tmax);
+        return make_scene_interaction(ray, tmax, hit ? &*hit : nullptr);
+    }
+
+    virtual bool occluded(Ray ray, Float tmin, Float tmax) const override {
+        return accel_->occluded(ray, tmin, tmax);
+    }
+
+    virtual void intersect_stream(const RayStream& rays, std::optional<SceneInteraction>* sis) const override {
+        thread_local std::vector<Accel::Hit> hits;
+        hits.resize(rays.n);
+        accel_->intersect_stream(rays, hits.data());
+        for (int i = 0; i < rays.n; i++) {
+            const auto& hit = hits[i];
+            sis[i] = make_scene_interaction(rays.ray(i), rays.tmax[i], hit.primitive >= 0 ? &hit : nullptr);
+        }
+    }
+
+private:
+    // Make scene interaction from the hit of the acceleration structure.
+    // hit is nullptr if no intersection is found.
+    std::optional<SceneInteraction> make_scene_interaction(Ray ray, Float tmax, const Accel::Hit* hit) const {
         if (!hit) {
             // Use environment light when tmax = Inf
             if (tmax < Inf) {
@@ -346,6 +556,7 @@ public:
 
     #pragma endregion
 
+public:
     // --------------------------------------------------------------------------------------------
 
     #pragma region Primitive type checking
@@ -10,9 +10,47 @@
 #include <lm/progress.h>
 #include <lm/serial.h>
 #include <lm/film.h>
+#include <lm/exception.h>
 
 LM_NAMESPACE_BEGIN(LM_NAMESPACE::scheduler)
 
+namespace {
+
+// Number of samples processed between the checks of the deadline
+constexpr long long DeadlineCheckInterval = 64;
+
+// Rescales the pixels of the film taken different number of samples,
+// so that rescaling the film by 1/(base_spp+spp) with the returned spp gives the per-pixel averages.
+// count(p) returns the number of samples taken in the pixel with index p.
+// base_spp is the number of samples per pixel already accumulated in the film.
+// Pixels without samples in the current run are scaled as well if the film has accumulated samples.
+template <typename CountFunc>
+long long normalize_by_sample_counts(Film* film, long long num_pixels, long long base_spp, CountFunc count) {
+    const int w = film->size().w;
+    long long spp = 0;
+    for (long long p = 0; p < num_pixels; p++) {
+        spp = std::max(spp, count(p));
+    }
+
+    // Merge the pending splats once here
+    // so that update_pixel() does not merge them for each pixel in the parallel loop
+    film->flush();
+
+    parallel::foreach(num_pixels, [&](long long p, int) {
+        const auto n = count(p);
+        if (n == spp || base_spp + n == 0) {
+            return;
+        }
+        const auto s = Float(base_spp + spp) / (base_spp + n);
+        film->update_pixel(int(p % w), int(p / w), [&](Vec3 curr) -> Vec3 {
+            return curr * s;
+        });
+    });
+    return spp;
+}
+
+}
+
 // Sample-based SPPScheduler
 class Scheduler_SPP_Sample : public Scheduler {
 private:
@@ -34,13 +72,13 @@ public:
         film_ = json::comp_ref<Film>(prop, "output");
     }
 
-    virtual long long run(const ProcessFunc& process) const override {
+    virtual long long run_range(const RangeProcessFunc& process, long long) const override {
         const auto numPixels = film_->num_pixels();
         progress::ScopedReport progress_ctx_(numPixels * spp_);
         
         // Parallel loop for each pixel
-        parallel::foreach(numPixels * spp_, [&](long long index, int threadid) {
-            process(index / spp_, index % spp_, threadid);
+        parallel::foreach_range(numPixels * spp_, [&](long long begin, long long end, int threadid) {
+            process({ begin, end, spp_, 0 }, threadid);
         }, [&](long long processed) {
             progress::update(processed);
         });
@@ -53,15 +91,273 @@ LM_COMP_REG_IMPL(Scheduler_SPP_Sample, "scheduler::spp::sample");
 
 // ------------------------------------------------------------------------------------------------
 
-// Time-based SPPScheduler
+// Tile-based SPPScheduler.
+// The film is split into tiles ordered along a space filling curve
+// and each thread renders all samples of a tile before moving on to the next tile.
+class Scheduler_SPP_Tile : public Scheduler {
+private:
+    enum class TileOrder {
+        Hilbert,
+        Morton,
+        Scanline,
+    };
+
+private:
+    long long spp_;
+    int tile_size_;
+    TileOrder order_;
+    Film* film_;
+
+public:
+    LM_SERIALIZE_IMPL(ar) {
+        ar(spp_, tile_size_, order_, film_);
+    }
+
+    virtual void foreach_underlying(const ComponentVisitor& visit) override {
+        comp::visit(visit, film_);
+    }
+
+public:
+    virtual void construct(const Json& prop) override {
+        spp_ = json::value<long long>(prop, "spp");
+        tile_size_ = json::value<int>(prop, "tile_size", 32);
+        film_ = json::comp_ref<Film>(prop, "output");
+        const auto order = json::value<std::string>(prop, "tile_order", "hilbert");
+        if (order == "hilbert") {
+            order_ = TileOrder::Hilbert;
+        }
+        else if (order == "morton") {
+            order_ = TileOrder::Morton;
+        }
+        else if (order == "scanline") {
+            order_ = TileOrder::Scanline;
+        }
+        else {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Invalid tile order [order='{}']", order);
+        }
+        if (tile_size_ <= 0) {
+            LM_THROW_EXCEPTION(Error::InvalidArgument, "Tile size must be positive [tile_size={}]", tile_size_);
+        }
+    }
+
+    virtual long long run_range(const RangeProcessFunc& process, long long) const override {
+        // Order the tiles along the curve
+        const auto size = film_->size();
+        const int w = size.w;
+        const int h = size.h;
+        const int nx = (w + tile_size_ - 1) / tile_size_;
+        const int ny = (h + tile_size_ - 1) / tile_size_;
+        std::vector<std::pair<unsigned long long, int>> keys(nx * ny);
+        unsigned int n = 1;
+        while (n < unsigned(std::max(nx, ny))) {
+            n *= 2;
+        }
+        for (int i = 0; i < nx * ny; i++) {
+            const unsigned int tx = i % nx;
+            const unsigned int ty = i / nx;
+            const auto key = order_ == TileOrder::Hilbert ? math::hilbert_index_2d(n, tx, ty)
+                           : order_ == TileOrder::Morton  ? math::morton_code_2d(tx, ty)
+                           : (unsigned long long)(i);
+            keys[i] = { key, i };
+        }
+        std::sort(keys.begin(), keys.end());
+
+        // Parallel loop for each tile.
+        // The samples of a row in a tile are dispatched as a range.
+        progress::ScopedReport progress_ctx_(nx * ny);
+        parallel::foreach_range(nx * ny, [&](long long begin, long long end, int threadid) {
+            for (long long t = begin; t < end; t++) {
+                const int i = keys[t].second;
+                const int x0 = (i % nx) * tile_size_;
+                const int y0 = (i / nx) * tile_size_;
+                const int x1 = std::min(x0 + tile_size_, w);
+                const int y1 = std::min(y0 + tile_size_, h);
+                for (int y = y0; y < y1; y++) {
+                    const long long p0 = (long long)(y) * w + x0;
+                    const long long p1 = (long long)(y) * w + x1;
+                    process({ p0 * spp_, p1 * spp_, spp_, 0 }, threadid);
+                }
+            }
+        }, [&](long long processed) {
+            progress::update(processed);
+        });
+
+        return spp_;
+    }
+};
+
+LM_COMP_REG_IMPL(Scheduler_SPP_Tile, "scheduler::spp::tile");
+
+// ------------------------------------------------------------------------------------------------
+
+// Adaptive SPPScheduler.
+// The samples are distributed in rounds. After the initial round of spp_min samples per pixel,
+// each round dispatches spp_round samples only to the pixels whose estimated relative error
+// is above the threshold, until all pixels converge, reach spp_max, or the time runs out.
+// The per-pixel error is estimated from the mean and variance of the contributions of the samples
+// reported by the renderer via Range::contributions.
+// Thus this scheduler is only valid for renderers that write only to the sampled pixel
+// and report the contributions, e.g., renderer::pt with pixel sampling mode.
+// The other renderers are rejected after the first processed pixel.
+class Scheduler_SPP_Adaptive : public Scheduler {
+private:
+    long long spp_min_;         // Number of samples per pixel in the initial round
+    long long spp_max_;         // Maximum number of samples per pixel
+    long long spp_round_;       // Number of samples per pixel in the subsequent rounds
+    Float max_error_;           // Target relative error
+    Float render_time_;         // Maximum render time in seconds (0: unlimited)
+    Film* film_;
+
+    // Per-pixel statistics of the sample contributions
+    struct PixelStat {
+        long long n = 0;        // Number of samples
+        long long k = 0;        // Number of samples with finite contributions
+        Float mean = 0_f;       // Mean of the finite contributions
+        Float m2 = 0_f;         // Sum of squared deviations from the mean
+
+        // Update statistics with Welford's algorithm.
+        // Non-finite contributions are counted as samples but excluded from the statistics.
+        void add(Float v) {
+            n++;
+            if (!std::isfinite(v)) {
+                return;
+            }
+            k++;
+            const auto d = v - mean;
+            mean += d / k;
+            m2 += d * (v - mean);
+        }
+
+        // Estimated relative error of the mean
+        Float relative_error() const {
+            if (k < 2) {
+                return Inf;
+            }
+            const auto var = m2 / (k - 1);
+            return std::sqrt(var / k) / std::max(mean, Eps);
+        }
+    };
+
+public:
+    LM_SERIALIZE_IMPL(ar) {
+        ar(spp_min_, spp_max_, spp_round_, max_error_, render_time_, film_);
+    }
+
+    virtual void foreach_underlying(const ComponentVisitor& visit) override {
+        comp::visit(visit, film_);
+    }
+
+public:
+    virtual void construct(const Json& prop) override {
+        spp_min_ = json::value<long long>(prop, "spp_min", 16);
+        spp_max_ = json::value<long long>(prop, "spp_max", 1024);
+        spp_round_ = json::value<long long>(prop, "spp_round", spp_min_);
+        max_error_ = json::value<Float>(prop, "max_error", 0.01_f);
+        render_time_ = json::value<Float>(prop, "render_time", 0_f);
+        film_ = json::comp_ref<Film>(prop, "output");
+        if (spp_min_ < 2 || spp_round_ <= 0 || spp_max_ < spp_min_) {
+            LM_THROW_EXCEPTION(Error::InvalidArgument,
+                "Invalid number of samples [spp_min={}, spp_max={}, spp_round={}]",
+                spp_min_, spp_max_, spp_round_);
+        }
+    }
+
+    virtual long long run_range(const RangeProcessFunc& process, long long base_spp) const override {
+        const auto num_pixels = film_->num_pixels();
+        std::vector<PixelStat> stats(num_pixels);
+        const auto start = std::chrono::high_resolution_clock::now();
+        const auto elapsed = [&]() -> double {
+            using namespace std::chrono;
+            const auto now = high_resolution_clock::now();
+            return duration_cast<milliseconds>(now - start).count() / 1000.0;
+        };
+
+        // Progress is reported by the number of samples relative to the worst case
+        progress::ScopedReport progress_ctx_(num_pixels * spp_max_);
+        std::atomic<long long> taken = 0;
+
+        // Active pixels in the current round. Initially all pixels are active.
+        std::vector<long long> active(num_pixels);
+        std::iota(active.begin(), active.end(), 0LL);
+        long long spp = spp_min_;
+        std::atomic<bool> unsupported = false;
+        while (!active.empty()) {
+            // Process the samples of the round pixel by pixel.
+            // Since a pixel is processed only by a single thread within a round,
+            // the statistics of a pixel are updated without synchronization.
+            parallel::foreach_range((long long)(active.size()), [&](long long begin, long long end, int threadid) {
+                thread_local std::vector<Vec3> contributions;
+                for (long long i = begin; i < end; i++) {
+                    if (unsupported) {
+                        return;
+                    }
+                    const auto p = active[i];
+                    auto& stat = stats[p];
+                    const auto n = std::min(spp, spp_max_ - stat.n);
+
+                    // The renderer notifies that it stores the contributions
+                    bool reported = false;
+                    contributions.assign(n, Vec3(0_f));
+                    process({ p * n, (p + 1) * n, n, stat.n, contributions.data(), &reported }, threadid);
+                    if (!reported) {
+                        unsupported = true;
+                        return;
+                    }
+                    for (const auto& c : contributions) {
+                        stat.add((c.x + c.y + c.z) / 3_f);
+                    }
+                    taken += n;
+                }
+            }, [&](long long) {
+                progress::update(taken);
+            });
+            if (unsupported) {
+                LM_THROW_EXCEPTION(Error::Unsupported,
+                    "The renderer does not report the contributions of the samples "
+                    "required by scheduler::spp::adaptive");
+            }
+
+            // Check termination by time
+            if (render_time_ > 0_f && elapsed() > render_time_) {
+                break;
+            }
+
+            // Select the pixels for the next round
+            std::vector<long long> next;
+            for (long long p : active) {
+                const auto& stat = stats[p];
+                if (stat.n < spp_max_ && stat.relative_error() > max_error_) {
+                    next.push_back(p);
+                }
+            }
+            active.swap(next);
+            spp = spp_round_;
+        }
+
+        // Normalize the pixels by the number of samples taken in each pixel
+        return normalize_by_sample_counts(film_, num_pixels, base_spp, [&](long long p) {
+            return stats[p].n;
+        });
+    }
+};
+
+LM_COMP_REG_IMPL(Scheduler_SPP_Adaptive, "scheduler::spp::adaptive");
+
+// ------------------------------------------------------------------------------------------------
+
+// Time-based SPPScheduler.
+// By default the elapsed time is checked after each pass over all pixels.
+// With hard_deadline, the pass running at the deadline is cancelled
+// and the film is normalized by the number of samples taken in each pixel.
 class Scheduler_SPP_Time : public Scheduler {
 private:
     double render_time_;
+    bool hard_deadline_;
     Film* film_;
 
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(render_time_, film_);
+        ar(render_time_, hard_deadline_, film_);
     }
 
     virtual void foreach_underlying(const ComponentVisitor& visit) override {
@@ -71,38 +367,71 @@ public:
 public:
     virtual void construct(const Json& prop) override {
         render_time_ = json::value<Float>(prop, "render_time");
+        hard_deadline_ = json::value<bool>(prop, "hard_deadline", false);
         film_ = json::comp_ref<Film>(prop, "output");
     }
     
-    virtual long long run(const ProcessFunc& process) const override {
+    virtual long long run_range(const RangeProcessFunc& process, long long base_spp) const override {
         const auto numPixels = film_->num_pixels();
         progress::ScopedTimeReport progress_ctx_(render_time_);
         
         const auto start = std::chrono::high_resolution_clock::now();
+        const auto elapsed = [&]() -> double {
+            using namespace std::chrono;
+            const auto now = high_resolution_clock::now();
+            return duration_cast<milliseconds>(now - start).count() / 1000.0;
+        };
+
+        // Number of samples taken in each pixel.
+        // Only used with hard deadline where the last pass can be partial.
+        std::vector<long long> counts(hard_deadline_ ? numPixels : 0);
+
         long long spp = 0;
         while (true) {
             // Parallel loop for each pixel
-            parallel::foreach(numPixels, [&](long long index, int threadid) {
-                process(index, spp, threadid);
+            parallel::foreach_range(numPixels, [&](long long begin, long long end, int threadid) {
+                if (!hard_deadline_) {
+                    process({ begin, end, 1, spp }, threadid);
+                    return;
+                }
+
+                // Process the range in small chunks to stop shortly after the deadline.
+                // A pixel is processed only once in a pass so we can count the samples without atomics.
+                for (long long b = begin; b < end; b += DeadlineCheckInterval) {
+                    if (parallel::cancelled()) {
+                        return;
+                    }
+                    if (elapsed() > render_time_) {
+                        parallel::cancel();
+                        return;
+                    }
+                    const auto e = std::min(b + DeadlineCheckInterval, end);
+                    process({ b, e, 1, spp }, threadid);
+                    for (long long p = b; p < e; p++) {
+                        counts[p]++;
+                    }
+                }
             }, [&](long long) {
-                using namespace std::chrono;
-                const auto now = high_resolution_clock::now();
-                const auto elapsed = duration_cast<milliseconds>(now - start).count() / 1000.0;
-                progress::update_time(elapsed);
+                progress::update_time(elapsed());
             });
 
             // Update processed spp
             spp++;
 
             // Check termination
-            const auto curr = std::chrono::high_resolution_clock::now();
-            const double elapsed = (double)(std::chrono::duration_cast<std::chrono::milliseconds>(curr - start).count()) / 1000.0;
-            if (elapsed > render_time_) {
+            if (elapsed() > render_time_) {
                 break;
             }
         }
 
-        return spp;
+        if (!hard_deadline_) {
+            return spp;
+        }
+
+        // Normalize the pixels by the number of samples taken in each pixel
+        return normalize_by_sample_counts(film_, numPixels, base_spp, [&](long long p) {
+            return counts[p];
+        });
     }
 };
 
@@ -125,10 +454,10 @@ public:
         num_samples_ = json::value<long long>(prop, "num_samples");
     }
 
-    virtual long long run(const ProcessFunc& process) const override {
+    virtual long long run_range(const RangeProcessFunc& process, long long) const override {
         progress::ScopedReport progress_ctx_(num_samples_);
-        parallel::foreach(num_samples_, [&](long long index, int threadid) {
-            process(0, index, threadid);
+        parallel::foreach_range(num_samples_, [&](long long begin, long long end, int threadid) {
+            process({ begin, end, 0, 0 }, threadid);
         }, [&](long long processed) {
             progress::update(processed);
         });
@@ -141,45 +470,71 @@ LM_COMP_REG_IMPL(Scheduler_SPI_Sample, "scheduler::spi::sample");
 
 // ------------------------------------------------------------------------------------------------
 
-// Time-based SPIScheduler
+// Time-based SPIScheduler.
+// With hard_deadline, the iteration running at the deadline is cancelled
+// and the exact number of processed samples is returned.
 class Scheduler_SPI_Time : public Scheduler {
 private:
     double render_time_;
     long long samples_per_iter_;
+    bool hard_deadline_;
 
 public:
     LM_SERIALIZE_IMPL(ar) {
-        ar(render_time_, samples_per_iter_);
+        ar(render_time_, samples_per_iter_, hard_deadline_);
     }
 
 public:
     virtual void construct(const Json& prop) override {
         render_time_ = json::value<Float>(prop, "render_time");
         samples_per_iter_ = json::value<long long>(prop, "samples_per_iter", 100000);
+        hard_deadline_ = json::value<bool>(prop, "hard_deadline", false);
     }
 
-    virtual long long run(const ProcessFunc& process) const override {
+    virtual long long run_range(const RangeProcessFunc& process, long long) const override {
         progress::ScopedTimeReport progress_ctx_(render_time_);
         const auto start = std::chrono::high_resolution_clock::now();
+        const auto elapsed = [&]() -> double {
+            using namespace std::chrono;
+            const auto now = high_resolution_clock::now();
+            return duration_cast<milliseconds>(now - start).count() / 1000.0;
+        };
+
         long long processed = 0;
         while (true) {
+            // Number of samples processed in the iteration
+            std::atomic<long long> processed_iter = 0;
+
             // Parallel loop
-            parallel::foreach(samples_per_iter_, [&](long long index, int threadid) {
-                process(0, processed + index, threadid);
+            parallel::foreach_range(samples_per_iter_, [&](long long begin, long long end, int threadid) {
+                if (!hard_deadline_) {
+                    process({ begin, end, 0, processed }, threadid);
+                    processed_iter += end - begin;
+                    return;
+                }
+
+                // Process the range in small chunks to stop shortly after the deadline
+                for (long long b = begin; b < end; b += DeadlineCheckInterval) {
+                    if (parallel::cancelled()) {
+                        return;
+                    }
+                    if (elapsed() > render_time_) {
+                        parallel::cancel();
+                        return;
+                    }
+                    const auto e = std::min(b + DeadlineCheckInterval, end);
+                    process({ b, e, 0, processed }, threadid);
+                    processed_iter += e - b;
+                }
             }, [&](long long) {
-                using namespace std::chrono;
-                const auto now = high_resolution_clock::now();
-                const auto elapsed = duration_cast<milliseconds>(now - start).count() / 1000.0;
-                progress::update_time(elapsed);
+                progress::update_time(elapsed());
             });
 
             // Update processed samples
-            processed += samples_per_iter_;
+            processed += processed_iter;
 
             // Check termination
-            const auto curr = std::chrono::high_resolution_clock::now();
-            const double elapsed = (double)(std::chrono::duration_cast<std::chrono::milliseconds>(curr - start).count()) / 1000.0;
-            if (elapsed > render_time_) {
+            if (elapsed() > render_time_) {
                 break;
             }
         }
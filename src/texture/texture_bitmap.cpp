@@ -6,6 +6,7 @@
 #include <pch.h>
 #include <lm/core.h>
 #include <lm/texture.h>
+#include <lm/parallel.h>
 #pragma warning(push)
 #pragma warning(disable:4244) // possible loss of data
 #define STB_IMAGE_IMPLEMENTATION
@@ -63,6 +64,9 @@ public:
         // Allocate and copy the data
         data_.assign(data, data + (w_*h_*c_));
         stbi_image_free(data);
+
+        // Distribute the pages across NUMA nodes since the texture is read from all threads
+        parallel::interleave_memory(data_.data(), data_.size() * sizeof(float));
     }
 
     virtual Vec3 eval(Vec2 t) const override {
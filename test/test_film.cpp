@@ -0,0 +1,171 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include "test_common.h"
+#include <lm/film.h>
+#include <lm/parallel.h>
+
+LM_NAMESPACE_BEGIN(LM_TEST_NAMESPACE)
+
+// Writes v to a pixel of the film and reads it back
+static lm::Float round_trip(lm::Film* film, lm::Float v) {
+    film->set_pixel(1, 2, lm::Vec3(v));
+    return film->get_pixel(1, 2).x;
+}
+
+TEST_CASE("Film") {
+    lm::log::ScopedInit init;
+
+    SUBCASE("Concurrent accesses to film::bitmap") {
+        // The film is read by another thread while the parallel loop splats.
+        // None of the splats must be lost by the merges during the reads.
+        lm::parallel::ScopedInit parallel("openmp", {{"num_threads", 4}});
+        const int w = 16;
+        const int h = 8;
+        const long long spp = 2000;
+        for (const auto* accumulation : { "atomic", "per_thread" }) {
+            auto film = lm::comp::create<lm::Film>("film::bitmap", "", {
+                {"w", w},
+                {"h", h},
+                {"accumulation", accumulation}
+            });
+            REQUIRE(film);
+
+            std::atomic<bool> done = false;
+            bool monotonic = true;
+            bool bounded = true;
+            std::thread reader([&] {
+                lm::Float prev = 0;
+                while (!done) {
+                    // Pixel values only increase during the rendering
+                    const auto v = film->get_pixel(3, 5).x;
+                    monotonic = monotonic && v >= prev;
+                    prev = v;
+                    const auto snapshot = film->snapshot();
+                    bounded = bounded && snapshot.data[3*(5*w+3)] <= spp;
+                    const auto buf = film->buffer();
+                    bounded = bounded && buf.data[3*(5*w+3)] <= spp;
+                }
+            });
+            lm::parallel::foreach(w * h * spp, [&](long long i, int) {
+                const int x = int(i % w);
+                const int y = int(i / w % h);
+                film->splat_pixel(x, y, lm::Vec3(1, 2, 0));
+            });
+            done = true;
+            reader.join();
+            CHECK(monotonic);
+            CHECK(bounded);
+
+            // Every splat is reflected to the film
+            const auto buf = film->buffer();
+            bool all = true;
+            for (int i = 0; i < w * h; i++) {
+                all = all && buf.data[3*i] == spp && buf.data[3*i+1] == 2 * spp && buf.data[3*i+2] == 0;
+            }
+            CHECK(all);
+            CHECK(film->get_pixel(3, 5) == lm::Vec3(spp, 2 * spp, 0));
+
+            // Splats after the merge are also reflected
+            film->splat_pixel(0, 0, lm::Vec3(1));
+            CHECK(film->get_pixel(0, 0) == lm::Vec3(spp + 1, 2 * spp + 1, 1));
+            film->rescale(.5);
+            CHECK(film->get_pixel(0, 0) == lm::Vec3(spp + 1, 2 * spp + 1, 1) * .5);
+
+            // Clearing discards the pending values
+            film->splat_pixel(1, 0, lm::Vec3(1));
+            film->clear();
+            CHECK(film->get_pixel(1, 0) == lm::Vec3(0));
+        }
+    }
+
+    SUBCASE("Parallel updates after splats to film::bitmap") {
+        // The pending splats must be merged before any update in the parallel loop,
+        // e.g., normalization of the AOVs by the sample counts
+        lm::parallel::ScopedInit parallel("openmp", {{"num_threads", 4}});
+        const int w = 64;
+        const int h = 32;
+        const int spp = 16;
+        auto film = lm::comp::create<lm::Film>("film::bitmap", "", {
+            {"w", w},
+            {"h", h},
+            {"accumulation", "per_thread"}
+        });
+        REQUIRE(film);
+        lm::parallel::foreach(w * h * spp, [&](long long i, int) {
+            film->splat_pixel(int(i % w), int(i / w % h), lm::Vec3(2));
+        });
+        lm::parallel::foreach(w * h, [&](long long i, int) {
+            film->update_pixel(int(i % w), int(i / w), [&](lm::Vec3 curr) -> lm::Vec3 {
+                return curr / lm::Float(spp);
+            });
+        });
+        bool all = true;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                all = all && film->get_pixel(x, y) == lm::Vec3(2);
+            }
+        }
+        CHECK(all);
+    }
+
+    SUBCASE("Half precision of film::tiled") {
+        auto film = lm::comp::create<lm::Film>("film::tiled", "", {
+            {"w", 4},
+            {"h", 4},
+            {"tile_size", 2},
+            {"precision", "half"}
+        });
+        REQUIRE(film);
+
+        SUBCASE("Representable values") {
+            CHECK(round_trip(film.get(), 0) == 0);
+            CHECK(round_trip(film.get(), 1) == 1);
+            CHECK(round_trip(film.get(), .5) == .5);
+            CHECK(round_trip(film.get(), -2) == -2);
+            CHECK(round_trip(film.get(), 65504) == 65504);
+            CHECK(round_trip(film.get(), std::ldexp(1., -14)) == std::ldexp(1., -14));
+        }
+
+        SUBCASE("Round to nearest even") {
+            CHECK(round_trip(film.get(), 1 + std::ldexp(1., -11)) == 1);
+            CHECK(round_trip(film.get(), 1 + std::ldexp(3., -11)) == 1 + std::ldexp(1., -9));
+            CHECK(round_trip(film.get(), 65519) == 65504);
+        }
+
+        SUBCASE("Subnormal") {
+            // Smallest and largest subnormals
+            CHECK(round_trip(film.get(), std::ldexp(1., -24)) == std::ldexp(1., -24));
+            CHECK(round_trip(film.get(), std::ldexp(1023., -24)) == std::ldexp(1023., -24));
+            CHECK(round_trip(film.get(), -std::ldexp(5., -24)) == -std::ldexp(5., -24));
+
+            // Ties are rounded to even
+            CHECK(round_trip(film.get(), std::ldexp(1., -25)) == 0);
+            CHECK(round_trip(film.get(), std::ldexp(3., -25)) == std::ldexp(1., -23));
+
+            // Rounding carries into the smallest normal
+            CHECK(round_trip(film.get(), std::ldexp(2047., -25)) == std::ldexp(1., -14));
+
+            // Underflow
+            CHECK(round_trip(film.get(), std::ldexp(1., -26)) == 0);
+        }
+
+        SUBCASE("Overflow") {
+            const auto inf = std::numeric_limits<lm::Float>::infinity();
+            CHECK(round_trip(film.get(), 65520) == inf);
+            CHECK(round_trip(film.get(), 1e5) == inf);
+            CHECK(round_trip(film.get(), -1e5) == -inf);
+            CHECK(round_trip(film.get(), inf) == inf);
+            CHECK(std::isnan(round_trip(film.get(), std::numeric_limits<lm::Float>::quiet_NaN())));
+        }
+
+        SUBCASE("Splat is unsupported") {
+            CHECK_THROWS(film->splat_pixel(0, 0, lm::Vec3(1)));
+        }
+    }
+}
+
+LM_NAMESPACE_END(LM_TEST_NAMESPACE)
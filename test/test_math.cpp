@@ -0,0 +1,118 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include "test_common.h"
+#include <lm/math.h>
+#include <lm/parallel.h>
+
+LM_NAMESPACE_BEGIN(LM_TEST_NAMESPACE)
+
+// Uniform random number made of two 32-bit words of Philox output
+static double philox_u(unsigned int hi, unsigned int lo) {
+    return double((((unsigned long long)(hi) << 32) | lo) >> 11) / double(1ULL << 53);
+}
+
+TEST_CASE("Rng") {
+    using RngD = lm::detail::RngImpl<double>;
+
+    SUBCASE("Philox4x32-10 known answer") {
+        // The key and the counter are zero for the first block of
+        // (seed, pixel, sample) = (0, 0, 0).
+        // Expected values are the known answer test vectors of Random123.
+        RngD rng(0u, 0, 0);
+        CHECK(rng.u() == philox_u(0x6627e8d5, 0xe169c58d));
+        CHECK(rng.u() == philox_u(0xbc57ac4c, 0x9b00dbd8));
+    }
+
+    SUBCASE("Counter and key from the sample") {
+        // key = { seed, upper bits of sample }
+        // counter = { block, lower bits of sample, pixel }
+        RngD rng(0xa4093822u, 0x0370734413198a2eLL, 0x299f31d085a308d3LL);
+        CHECK(rng.u() == philox_u(0x3f6d24d7, 0x529108a0));
+        CHECK(rng.u() == philox_u(0xf8a37e29, 0xe7a9b43b));
+        CHECK(rng.u() == philox_u(0x14e0a6ea, 0xbbea52f1));
+    }
+
+    SUBCASE("Independent of the number of threads") {
+        // The random numbers of a sample only depend on (seed, pixel, sample),
+        // so the results must not depend on the threads processing the samples
+        const long long N = 10000;
+        const int M = 8;
+        const auto generate = [&](const std::string& type, int num_threads) {
+            lm::parallel::ScopedInit init(type, {{"num_threads", num_threads}});
+            std::vector<double> v(N * M);
+            lm::parallel::foreach(N, [&](long long i, int) {
+                RngD rng(42u, i % 100, i / 100);
+                for (int j = 0; j < M; j++) {
+                    v[i * M + j] = rng.u();
+                }
+            });
+            return v;
+        };
+        const auto ref = generate("openmp", 1);
+        CHECK(generate("openmp", 4) == ref);
+        CHECK(generate("workstealing", 3) == ref);
+    }
+
+    SUBCASE("Different samples") {
+        RngD rng1(1u, 0, 0);
+        RngD rng2(1u, 0, 1);
+        RngD rng3(1u, 1, 0);
+        RngD rng4(2u, 0, 0);
+        const auto u1 = rng1.u();
+        CHECK(u1 != rng2.u());
+        CHECK(u1 != rng3.u());
+        CHECK(u1 != rng4.u());
+    }
+}
+
+TEST_CASE("Space filling curves") {
+    SUBCASE("Morton code") {
+        // Bits of x and y are interleaved starting from x
+        CHECK(lm::math::morton_code_2d(0, 0) == 0);
+        CHECK(lm::math::morton_code_2d(1, 0) == 1);
+        CHECK(lm::math::morton_code_2d(0, 1) == 2);
+        CHECK(lm::math::morton_code_2d(5, 3) == 0b011011);
+        CHECK(lm::math::morton_code_2d(0xffff, 0) == 0x55555555u);
+        CHECK(lm::math::morton_code_2d(0xffff, 0xffff) == 0xffffffffu);
+
+        // Bits of x, y, and z are interleaved starting from z
+        CHECK(lm::math::morton_code_3d(0, 0, 1) == 1);
+        CHECK(lm::math::morton_code_3d(0, 1, 0) == 2);
+        CHECK(lm::math::morton_code_3d(1, 0, 0) == 4);
+        CHECK(lm::math::morton_code_3d(1023, 1023, 1023) == 0x3fffffffu);
+    }
+
+    SUBCASE("Hilbert index") {
+        // The curve visits every cell once and moves to an adjacent cell at each step
+        for (unsigned int n : { 1u, 2u, 8u, 64u }) {
+            std::vector<int> xs(n*n, -1);
+            std::vector<int> ys(n*n, -1);
+            bool bijective = true;
+            for (unsigned int y = 0; y < n; y++) {
+                for (unsigned int x = 0; x < n; x++) {
+                    const auto d = lm::math::hilbert_index_2d(n, x, y);
+                    if (d >= n*n || xs[d] >= 0) {
+                        bijective = false;
+                        continue;
+                    }
+                    xs[d] = int(x);
+                    ys[d] = int(y);
+                }
+            }
+            REQUIRE(bijective);
+            CHECK(xs[0] == 0);
+            CHECK(ys[0] == 0);
+            bool adjacent = true;
+            for (unsigned int d = 1; d < n*n; d++) {
+                adjacent = adjacent && std::abs(xs[d] - xs[d-1]) + std::abs(ys[d] - ys[d-1]) == 1;
+            }
+            CHECK(adjacent);
+        }
+    }
+}
+
+LM_NAMESPACE_END(LM_TEST_NAMESPACE)
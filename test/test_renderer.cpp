@@ -0,0 +1,95 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include "test_common.h"
+#include <lm/renderer.h>
+#include <lm/film.h>
+#include <lm/parallel.h>
+
+LM_NAMESPACE_BEGIN(LM_TEST_NAMESPACE)
+
+using namespace lm::literals;
+
+// Splats n samples with value v to the pixel (x,y)
+static void splat_samples(lm::Film* film, int x, int y, int n, lm::Float v) {
+    for (int i = 0; i < n; i++) {
+        film->splat_pixel(x, y, lm::Vec3(v));
+    }
+}
+
+TEST_CASE("ProgressiveAccumulator") {
+    lm::log::ScopedInit log;
+    lm::parallel::ScopedInit parallel;
+
+    auto film = lm::comp::create<lm::Film>("film::bitmap", "", {
+        {"w", 2},
+        {"h", 1}
+    });
+    REQUIRE(film);
+
+    lm::ProgressiveAccumulator accum;
+    CHECK(accum.count() == 0);
+
+    // First rendering with 2 samples per pixel
+    accum.begin(film.get(), 1_f);
+    splat_samples(film.get(), 0, 0, 2, 1_f);
+    splat_samples(film.get(), 1, 0, 2, 3_f);
+    CHECK(accum.end(film.get(), 1_f, 2) == 2);
+    CHECK(film->get_pixel(0, 0).x == doctest::Approx(1));
+    CHECK(film->get_pixel(1, 0).x == doctest::Approx(3));
+
+    SUBCASE("Accumulate") {
+        // The film is the average of all samples of the renderings
+        accum.begin(film.get(), 1_f);
+        splat_samples(film.get(), 0, 0, 2, 4_f);
+        splat_samples(film.get(), 1, 0, 2, 3_f);
+        CHECK(accum.end(film.get(), 1_f, 2) == 4);
+        CHECK(accum.count() == 4);
+        CHECK(film->get_pixel(0, 0).x == doctest::Approx(2.5));
+        CHECK(film->get_pixel(1, 0).x == doctest::Approx(3));
+    }
+
+    SUBCASE("Accumulate with image sampling") {
+        // The image is normalized by the number of pixels over the number of samples
+        accum.reset();
+        accum.begin(film.get(), 2_f);
+        splat_samples(film.get(), 0, 0, 1, 2_f);
+        CHECK(accum.end(film.get(), 2_f, 2) == 2);
+        CHECK(film->get_pixel(0, 0).x == doctest::Approx(2));
+        CHECK(film->get_pixel(1, 0).x == doctest::Approx(0));
+        accum.begin(film.get(), 2_f);
+        splat_samples(film.get(), 1, 0, 1, 4_f);
+        CHECK(accum.end(film.get(), 2_f, 2) == 4);
+        CHECK(film->get_pixel(0, 0).x == doctest::Approx(1));
+        CHECK(film->get_pixel(1, 0).x == doctest::Approx(2));
+    }
+
+    SUBCASE("Reset") {
+        // The film is cleared on the next rendering
+        accum.reset();
+        CHECK(accum.count() == 0);
+        accum.begin(film.get(), 1_f);
+        CHECK(film->get_pixel(0, 0).x == 0_f);
+        splat_samples(film.get(), 0, 0, 1, 4_f);
+        CHECK(accum.end(film.get(), 1_f, 1) == 1);
+        CHECK(film->get_pixel(0, 0).x == doctest::Approx(4));
+    }
+
+    SUBCASE("Film size changed") {
+        // The accumulation is reset when the film changes its size
+        auto film2 = lm::comp::create<lm::Film>("film::bitmap", "", {
+            {"w", 3},
+            {"h", 1}
+        });
+        accum.begin(film2.get(), 1_f);
+        CHECK(accum.count() == 0);
+        splat_samples(film2.get(), 2, 0, 1, 5_f);
+        CHECK(accum.end(film2.get(), 1_f, 1) == 1);
+        CHECK(film2->get_pixel(2, 0).x == doctest::Approx(5));
+    }
+}
+
+LM_NAMESPACE_END(LM_TEST_NAMESPACE)
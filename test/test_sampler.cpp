@@ -0,0 +1,105 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include "test_common.h"
+#include <lm/sampler.h>
+
+LM_NAMESPACE_BEGIN(LM_TEST_NAMESPACE)
+
+// Checks if the n samples starting from the sample index offset
+// take exactly one value in each of the n intervals of the dimension
+static bool stratified_1d(const lm::Sampler* sampler, long long n, long long offset, int dim) {
+    std::vector<int> counts(n);
+    for (long long i = 0; i < n; i++) {
+        const auto u = sampler->u(7, 3, offset + i, dim);
+        if (u < 0 || u >= 1) {
+            return false;
+        }
+        counts[(long long)(u * n)]++;
+    }
+    return std::all_of(counts.begin(), counts.end(), [](int c) { return c == 1; });
+}
+
+// Checks if the n = 2^m samples starting from the sample index offset
+// take exactly one point in each elementary interval of the area 1/n
+// of the pair of the dimensions (dim, dim+1)
+static bool stratified_2d(const lm::Sampler* sampler, int m, long long offset, int dim) {
+    const long long n = 1LL << m;
+    for (int a = 0; a <= m; a++) {
+        const long long nx = 1LL << a;
+        const long long ny = n >> a;
+        std::vector<int> counts(n);
+        for (long long i = 0; i < n; i++) {
+            const auto x = (long long)(sampler->u(7, 3, offset + i, dim) * nx);
+            const auto y = (long long)(sampler->u(7, 3, offset + i, dim + 1) * ny);
+            counts[y * nx + x]++;
+        }
+        if (!std::all_of(counts.begin(), counts.end(), [](int c) { return c == 1; })) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE("Sampler") {
+    lm::log::ScopedInit init;
+
+    SUBCASE("sampler::sobol") {
+        auto sampler = lm::comp::create<lm::Sampler>("sampler::sobol", "");
+        REQUIRE(sampler);
+        for (int m : { 1, 4, 8 }) {
+            const long long n = 1LL << m;
+            for (long long offset : { 0LL, n, 3 * n }) {
+                for (int dim = 0; dim < 8; dim++) {
+                    CHECK(stratified_1d(sampler.get(), n, offset, dim));
+                }
+                for (int dim : { 0, 2, 6, 20 }) {
+                    CHECK(stratified_2d(sampler.get(), m, offset, dim));
+                }
+            }
+        }
+    }
+
+    SUBCASE("sampler::stratified") {
+        auto sampler = lm::comp::create<lm::Sampler>("sampler::stratified", "", {
+            {"strata", 12}
+        });
+        REQUIRE(sampler);
+        for (long long offset : { 0LL, 12LL, 36LL }) {
+            for (int dim = 0; dim < 8; dim++) {
+                CHECK(stratified_1d(sampler.get(), 12, offset, dim));
+            }
+        }
+    }
+
+    SUBCASE("sampler::independent") {
+        auto sampler = lm::comp::create<lm::Sampler>("sampler::independent", "");
+        REQUIRE(sampler);
+        for (int i = 0; i < 100; i++) {
+            const auto u = sampler->u(7, 3, i, 5);
+            CHECK(u >= 0);
+            CHECK(u < 1);
+            CHECK(u == sampler->u(7, 3, i, 5));
+        }
+    }
+
+    SUBCASE("Dimensions of Rng") {
+        // Rng takes the dimensions in order, starting from the one given by set_dim()
+        auto sampler = lm::comp::create<lm::Sampler>("sampler::sobol", "");
+        REQUIRE(sampler);
+        lm::detail::RngImpl<double> rng(7u, 3, 5, sampler.get());
+        CHECK(rng.u() == sampler->u(7, 3, 5, 0));
+        CHECK(rng.u() == sampler->u(7, 3, 5, 1));
+        using Dims = lm::PathSampleDims;
+        rng.set_dim(Dims::fixed(2, Dims::Direction));
+        CHECK(rng.u() == sampler->u(7, 3, 5, 2 * Dims::BlockSize + Dims::Direction));
+        CHECK(rng.u() == sampler->u(7, 3, 5, 2 * Dims::BlockSize + Dims::Direction + 1));
+        rng.set_dim(Dims::variable(1, Dims::Distance));
+        CHECK(rng.u() == sampler->u(7, 3, 5, Dims::VariableBase + 2 * Dims::VariableSize));
+    }
+}
+
+LM_NAMESPACE_END(LM_TEST_NAMESPACE)
@@ -0,0 +1,262 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include "test_common.h"
+#include <lm/assetgroup.h>
+#include <lm/scene.h>
+#include <lm/accel.h>
+#include <lm/mappedfile.h>
+
+LM_NAMESPACE_BEGIN(LM_TEST_NAMESPACE)
+
+using namespace lm::literals;
+
+// Creates properties of mesh::raw for the grid of n x n quads on [-1,1]^2 in xy plane
+static lm::Json grid_mesh(int n) {
+    std::vector<lm::Float> ps;
+    for (int y = 0; y <= n; y++) {
+        for (int x = 0; x <= n; x++) {
+            ps.insert(ps.end(), { 2_f*x/n - 1_f, 2_f*y/n - 1_f, 0_f });
+        }
+    }
+    std::vector<int> fs;
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            const int i = y * (n + 1) + x;
+            fs.insert(fs.end(), { i, i+1, i+n+2, i, i+n+2, i+n+1 });
+        }
+    }
+    return {
+        {"ps", ps},
+        {"ns", {0,0,1}},
+        {"ts", {0,0}},
+        {"fs", {
+            {"p", fs},
+            {"n", std::vector<int>(fs.size(), 0)},
+            {"t", std::vector<int>(fs.size(), 0)}
+        }}
+    };
+}
+
+// Creates a scene with two instances of the grid transformed by M1 and M2
+static lm::Scene* create_scene(lm::AssetGroup* assets, const std::string& name, const lm::Json& prop, lm::Mat4 M1, lm::Mat4 M2) {
+    auto* accel = assets->load_asset(name + "_accel", "accel::sahbvh", {});
+    REQUIRE(accel);
+    auto scene_prop = prop;
+    scene_prop["accel"] = accel->loc();
+    auto* scene = dynamic_cast<lm::Scene*>(assets->load_asset(name, "scene::default", scene_prop));
+    REQUIRE(scene);
+    for (const auto& M : { M1, M2 }) {
+        const int g = scene->create_group_node(M);
+        scene->add_child(scene->root_node(), g);
+        scene->add_child(g, scene->create_primitive_node({
+            {"mesh", "$.mesh"},
+            {"material", "$.material"}
+        }));
+    }
+    return scene;
+}
+
+// Checks if the two scenes give the same intersections for the rays toward -z
+static void check_same_intersections(const lm::Scene* s1, const lm::Scene* s2) {
+    const int n = 32;
+    int num_hits = 0;
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            const lm::Ray ray{ lm::Vec3(4_f*(x+.5_f)/n - 2_f, 4_f*(y+.5_f)/n - 2_f, 10_f), lm::Vec3(0,0,-1) };
+            const auto h1 = s1->intersect(ray);
+            const auto h2 = s2->intersect(ray);
+            REQUIRE(bool(h1) == bool(h2));
+            if (!h1) {
+                continue;
+            }
+            num_hits++;
+            CHECK(h1->primitive == h2->primitive);
+            CHECK(h1->geom.p.x == doctest::Approx(h2->geom.p.x));
+            CHECK(h1->geom.p.y == doctest::Approx(h2->geom.p.y));
+            CHECK(h1->geom.p.z == doctest::Approx(h2->geom.p.z));
+        }
+    }
+    CHECK(num_hits > 0);
+}
+
+// Number of cache files in the directory
+static int num_cache_files(const fs::path& dir) {
+    int n = 0;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (entry.path().extension() == ".bin") {
+            n++;
+        }
+    }
+    return n;
+}
+
+TEST_CASE("Scene") {
+    lm::log::ScopedInit init;
+
+    auto assets = lm::comp::create<lm::AssetGroup>("asset_group::default", "$");
+    REQUIRE(assets);
+    lm::comp::detail::register_root_comp(assets.get());
+    REQUIRE(assets->load_asset("mesh", "mesh::raw", grid_mesh(8)));
+    REQUIRE(assets->load_asset("material", "material::diffuse", { {"Kd", {1,1,1}} }));
+
+    const auto M1 = glm::translate(lm::Mat4(1_f), lm::Vec3(-.5_f, 0_f, 1_f));
+    const auto M2 = glm::translate(lm::Mat4(1_f), lm::Vec3(.5_f, .25_f, 0_f));
+
+    SUBCASE("Accel cache") {
+        const auto dir = fs::temp_directory_path() / "lm_test_accel_cache";
+        fs::remove_all(dir);
+        const lm::Json prop{ {"accel_cache_dir", dir.string()} };
+
+        // Reference scene without cache
+        auto* ref = create_scene(assets.get(), "ref", {}, M1, M2);
+        ref->build();
+
+        // The first build saves the cache
+        auto* s1 = create_scene(assets.get(), "s1", prop, M1, M2);
+        s1->build();
+        CHECK(num_cache_files(dir) == 1);
+        check_same_intersections(ref, s1);
+
+        SUBCASE("Cache hit") {
+            // The second build of the same scene loads the cache
+            auto* s2 = create_scene(assets.get(), "s2", prop, M1, M2);
+            const auto out = capture_stdout([&] { s2->build(); });
+            CHECK(out.find("Loading accel cache") != std::string::npos);
+            CHECK(num_cache_files(dir) == 1);
+            check_same_intersections(ref, s2);
+        }
+
+        SUBCASE("Cache miss by the change of the scene") {
+            // The change of the transformation changes the hash of the content
+            const auto M3 = glm::translate(lm::Mat4(1_f), lm::Vec3(.5_f, .5_f, 0_f));
+            auto* s2 = create_scene(assets.get(), "s2", prop, M1, M3);
+            const auto out = capture_stdout([&] { s2->build(); });
+            CHECK(out.find("Loading accel cache") == std::string::npos);
+            CHECK(num_cache_files(dir) == 2);
+            auto* ref2 = create_scene(assets.get(), "ref2", {}, M1, M3);
+            ref2->build();
+            check_same_intersections(ref2, s2);
+        }
+
+        SUBCASE("Incompatible cache") {
+            // Broken cache is detected and the accel is rebuilt
+            for (const auto& entry : fs::directory_iterator(dir)) {
+                std::ofstream os(entry.path().string(), std::ios::out | std::ios::binary | std::ios::trunc);
+                os << "broken";
+            }
+            auto* s2 = create_scene(assets.get(), "s2", prop, M1, M2);
+            const auto out = capture_stdout([&] { s2->build(); });
+            CHECK(out.find("Accel cache is not compatible") != std::string::npos);
+            check_same_intersections(ref, s2);
+        }
+
+        fs::remove_all(dir);
+    }
+
+    SUBCASE("Refit") {
+        // Node 1 is the group node of the first instance
+        const auto M3 = glm::rotate(glm::translate(lm::Mat4(1_f), lm::Vec3(.25_f, -.5_f, 2_f)), .3_f, lm::Vec3(0,1,1));
+        auto* s = create_scene(assets.get(), "s", {}, M1, M2);
+        s->build();
+
+        // Refitted scene must give the same intersections as the scene built from scratch
+        s->set_transform(1, M3);
+        const auto out = capture_stdout([&] { s->update(); });
+        CHECK(out.find("Refitting acceleration structure") != std::string::npos);
+        CHECK(out.find("Refit is not supported") == std::string::npos);
+        auto* ref = create_scene(assets.get(), "ref", {}, M3, M2);
+        ref->build();
+        check_same_intersections(ref, s);
+
+        SUBCASE("Refit back to the original transformation") {
+            s->set_transform(1, M1);
+            s->update();
+            auto* ref2 = create_scene(assets.get(), "ref2", {}, M1, M2);
+            ref2->build();
+            check_same_intersections(ref2, s);
+        }
+
+        SUBCASE("No change") {
+            const auto out2 = capture_stdout([&] { s->update(); });
+            CHECK(out2.find("Refitting acceleration structure") == std::string::npos);
+        }
+
+        SUBCASE("Change of topology") {
+            // Adding a node falls back to the full build
+            const int g = s->create_group_node(glm::translate(lm::Mat4(1_f), lm::Vec3(0_f, 0_f, -1_f)));
+            s->add_child(s->root_node(), g);
+            s->add_child(g, s->create_primitive_node({
+                {"mesh", "$.mesh"},
+                {"material", "$.material"}
+            }));
+            const auto out2 = capture_stdout([&] { s->update(); });
+            CHECK(out2.find("Building acceleration structure") != std::string::npos);
+            CHECK(out2.find("Refitting acceleration structure") == std::string::npos);
+        }
+    }
+}
+
+TEST_CASE("MappedFile") {
+    lm::log::ScopedInit init;
+
+    const auto path = (fs::temp_directory_path() / "lm_test_mappedfile.bin").string();
+    fs::remove(path);
+
+    // Write the contents through the mapping
+    {
+        lm::MappedFile file(path, 16);
+        REQUIRE(file.size() == 16);
+        auto* data = static_cast<unsigned char*>(file.data());
+        for (int i = 0; i < 16; i++) {
+            data[i] = (unsigned char)(i);
+        }
+    }
+    CHECK(fs::file_size(path) == 16);
+
+    SUBCASE("Read") {
+        lm::MappedFile file(path);
+        REQUIRE(file.size() == 16);
+        const auto* data = static_cast<const unsigned char*>(file.data());
+        for (int i = 0; i < 16; i++) {
+            CHECK(data[i] == i);
+        }
+    }
+
+    SUBCASE("Extend") {
+        // The contents in the range are kept and the extended region reads as zero
+        {
+            lm::MappedFile file(path, 32);
+            REQUIRE(file.size() == 32);
+        }
+        lm::MappedFile file(path);
+        REQUIRE(file.size() == 32);
+        const auto* data = static_cast<const unsigned char*>(file.data());
+        CHECK(data[15] == 15);
+        CHECK(data[16] == 0);
+        CHECK(data[31] == 0);
+    }
+
+    SUBCASE("Truncate") {
+        {
+            lm::MappedFile file(path, 8, true);
+            REQUIRE(file.size() == 8);
+        }
+        lm::MappedFile file(path);
+        REQUIRE(file.size() == 8);
+        const auto* data = static_cast<const unsigned char*>(file.data());
+        CHECK(data[0] == 0);
+        CHECK(data[7] == 0);
+    }
+
+    SUBCASE("Missing file") {
+        CHECK_THROWS(lm::MappedFile((fs::temp_directory_path() / "lm_test_missing.bin").string()));
+    }
+
+    fs::remove(path);
+}
+
+LM_NAMESPACE_END(LM_TEST_NAMESPACE)
@@ -0,0 +1,67 @@
+/*
+    Lightmetrica - Copyright (c) 2019 Hisanari Otsu
+    Distributed under MIT license. See LICENSE file for details.
+*/
+
+#include <pch.h>
+#include "test_common.h"
+#include <lm/assetgroup.h>
+#include <lm/scheduler.h>
+#include <lm/film.h>
+#include <lm/parallel.h>
+
+LM_NAMESPACE_BEGIN(LM_TEST_NAMESPACE)
+
+using namespace lm::literals;
+
+TEST_CASE("Scheduler") {
+    lm::log::ScopedInit log;
+    lm::parallel::ScopedInit parallel("openmp", {{"num_threads", 1}});
+
+    auto assets = lm::comp::create<lm::AssetGroup>("asset_group::default", "$");
+    REQUIRE(assets);
+    lm::comp::detail::register_root_comp(assets.get());
+    const int w = 256;
+    auto* film = dynamic_cast<lm::Film*>(assets->load_asset("film", "film::bitmap", {
+        {"w", w},
+        {"h", 1}
+    }));
+    REQUIRE(film);
+
+    SUBCASE("scheduler::spp::time with hard deadline in progressive rendering") {
+        // The film keeps the sum of base_spp samples of value 1 of the previous rendering
+        const long long base_spp = 2;
+        for (int x = 0; x < w; x++) {
+            film->set_pixel(x, 0, lm::Vec3(lm::Float(base_spp)));
+        }
+
+        // The deadline hits during the first pass, so some pixels take no samples
+        auto sched = lm::comp::create<lm::scheduler::Scheduler>("scheduler::spp::time", "", {
+            {"render_time", .05},
+            {"hard_deadline", true},
+            {"output", "$.film"}
+        });
+        REQUIRE(sched);
+        std::vector<int> counts(w);
+        const auto spp = sched->run_range([&](const lm::scheduler::Range& range, int) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            range.foreach([&](long long pixel_index, long long) {
+                film->splat_pixel(int(pixel_index), 0, lm::Vec3(1));
+                counts[pixel_index]++;
+            });
+        }, base_spp);
+        CHECK(spp == 1);
+        REQUIRE(std::count(counts.begin(), counts.end(), 0) > 0);
+        REQUIRE(std::count(counts.begin(), counts.end(), 1) > 0);
+
+        // Every pixel is the average of the samples after the normalization
+        film->rescale(1_f / lm::Float(base_spp + spp));
+        bool all = true;
+        for (int x = 0; x < w; x++) {
+            all = all && std::abs(film->get_pixel(x, 0).x - 1_f) < 1e-6_f;
+        }
+        CHECK(all);
+    }
+}
+
+LM_NAMESPACE_END(LM_TEST_NAMESPACE)
@@ -7,6 +7,7 @@
 #include "test_common.h"
 #include <lm/serial.h>
 #include <lm/math.h>
+#include <lm/film.h>
 
 // Serializaition helper
 namespace lm::serial {
@@ -392,6 +393,56 @@ TEST_CASE("Serialization") {
                 );
             }
 
+            SUBCASE("Tiled film") {
+                for (const auto* precision : { "float", "half" }) {
+                    auto orig = lm::comp::create<lm::Component>("film::tiled", {}, {
+                        {"w", 5}, {"h", 3}, {"tile_size", 2}, {"precision", precision}
+                    });
+                    auto* film = dynamic_cast<lm::Film*>(orig.get());
+                    REQUIRE(film);
+                    film->set_pixel(0, 0, lm::Vec3(1, 2, 3));
+                    film->set_pixel(4, 2, lm::Vec3(.5, .25, 4));
+                    check_save_and_load_round_trip_compare_loaded(orig);
+
+                    // Check the values of the touched and untouched tiles
+                    std::stringstream ss;
+                    lm::serial::save(ss, orig);
+                    lm::Component::Ptr<lm::Component> loaded;
+                    lm::serial::load(ss, loaded);
+                    auto* loaded_film = dynamic_cast<lm::Film*>(loaded.get());
+                    REQUIRE(loaded_film);
+                    CHECK(loaded_film->size().w == 5);
+                    CHECK(loaded_film->size().h == 3);
+                    CHECK(loaded_film->get_pixel(0, 0) == lm::Vec3(1, 2, 3));
+                    CHECK(loaded_film->get_pixel(4, 2) == lm::Vec3(.5, .25, 4));
+                    CHECK(loaded_film->get_pixel(2, 0) == lm::Vec3(0));
+                }
+
+                // Loading a film backed by a file keeps the file of the original film
+                const auto path = (fs::temp_directory_path() / "lm_test_film_tiled.bin").string();
+                {
+                    auto orig = lm::comp::create<lm::Component>("film::tiled", {}, {
+                        {"w", 5}, {"h", 3}, {"tile_size", 2}, {"path", path}
+                    });
+                    auto* film = dynamic_cast<lm::Film*>(orig.get());
+                    REQUIRE(film);
+                    film->set_pixel(4, 2, lm::Vec3(1, 2, 3));
+                    std::stringstream ss;
+                    lm::serial::save(ss, orig);
+                    lm::Component::Ptr<lm::Component> loaded;
+                    lm::serial::load(ss, loaded);
+                    auto* loaded_film = dynamic_cast<lm::Film*>(loaded.get());
+                    REQUIRE(loaded_film);
+                    CHECK(loaded_film->get_pixel(4, 2) == lm::Vec3(1, 2, 3));
+                    CHECK(film->get_pixel(4, 2) == lm::Vec3(1, 2, 3));
+
+                    // The loaded film is stored in memory
+                    loaded_film->set_pixel(4, 2, lm::Vec3(4));
+                    CHECK(film->get_pixel(4, 2) == lm::Vec3(1, 2, 3));
+                }
+                fs::remove(path);
+            }
+
             SUBCASE("Mesh") {
                 check_save_and_load_round_trip_compare_loaded(
                     lm::comp::create<lm::Component>("mesh::raw", {}, {